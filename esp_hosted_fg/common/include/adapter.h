@@ -11,6 +11,15 @@
 
 /* ESP Payload Header Flags */
 #define MORE_FRAGMENT                             (1 << 0)
+#define SPI_HOST_VAR_LEN                          (1 << 1)
+
+/* SPI host sets SPI_HOST_VAR_LEN in each frame it clocks out, dummy ones
+ * included, when it clocks transaction length announced by ESP. reserved2
+ * then carries length host needs for its next frame, and ESP answers with
+ * length of its next transaction in reserved2 of each frame it clocks out.
+ * Both are in units of below, 0 meaning nothing pending on host side and
+ * full SPI buffer on ESP side */
+#define SPI_NEXT_TX_LEN_UNIT                      8
 
 /* Serial interface */
 #define SERIAL_IF_FILE                            "/dev/esps0"
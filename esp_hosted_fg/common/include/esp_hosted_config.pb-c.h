@@ -58,6 +58,7 @@ typedef struct CtrlMsgEventESPInit CtrlMsgEventESPInit;
 typedef struct CtrlMsgEventHeartbeat CtrlMsgEventHeartbeat;
 typedef struct CtrlMsgEventStationDisconnectFromAP CtrlMsgEventStationDisconnectFromAP;
 typedef struct CtrlMsgEventStationDisconnectFromESPSoftAP CtrlMsgEventStationDisconnectFromESPSoftAP;
+typedef struct CtrlMsgEventScanResult CtrlMsgEventScanResult;
 typedef struct CtrlMsg CtrlMsg;
 
 
@@ -199,11 +200,12 @@ typedef enum _CtrlMsgId {
   CTRL_MSG_ID__Event_Heartbeat = 302,
   CTRL_MSG_ID__Event_StationDisconnectFromAP = 303,
   CTRL_MSG_ID__Event_StationDisconnectFromESPSoftAP = 304,
+  CTRL_MSG_ID__Event_ScanResult = 305,
   /*
    * Add new control path command notification before Event_Max
    * and update Event_Max 
    */
-  CTRL_MSG_ID__Event_Max = 305
+  CTRL_MSG_ID__Event_Max = 306
     PROTOBUF_C__FORCE_ENUM_TO_BE_INT_SIZE(CTRL_MSG_ID)
 } CtrlMsgId;
 
@@ -446,10 +448,18 @@ struct  CtrlMsgRespStartSoftAP
 struct  CtrlMsgReqScanResult
 {
   ProtobufCMessage base;
+  /*
+   * 0: blocking, 1: streaming, 2: cached 
+   */
+  int32_t scan_mode;
+  /*
+   * cached scan: oldest acceptable result, 0 for default 
+   */
+  uint32_t max_age_sec;
 };
 #define CTRL_MSG__REQ__SCAN_RESULT__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&ctrl_msg__req__scan_result__descriptor) \
-     }
+    , 0, 0 }
 
 
 struct  CtrlMsgRespScanResult
@@ -687,6 +697,21 @@ struct  CtrlMsgEventStationDisconnectFromESPSoftAP
     , 0, {0,NULL} }
 
 
+struct  CtrlMsgEventScanResult
+{
+  ProtobufCMessage base;
+  int32_t resp;
+  uint32_t chnl;
+  uint32_t count;
+  size_t n_entries;
+  ScanResult **entries;
+  protobuf_c_boolean scan_done;
+};
+#define CTRL_MSG__EVENT__SCAN_RESULT__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&ctrl_msg__event__scan_result__descriptor) \
+    , 0, 0, 0, 0,NULL, 0 }
+
+
 typedef enum {
   CTRL_MSG__PAYLOAD__NOT_SET = 0,
   CTRL_MSG__PAYLOAD_REQ_GET_MAC_ADDRESS = 101,
@@ -734,7 +759,8 @@ typedef enum {
   CTRL_MSG__PAYLOAD_EVENT_ESP_INIT = 301,
   CTRL_MSG__PAYLOAD_EVENT_HEARTBEAT = 302,
   CTRL_MSG__PAYLOAD_EVENT_STATION_DISCONNECT_FROM__AP = 303,
-  CTRL_MSG__PAYLOAD_EVENT_STATION_DISCONNECT_FROM__ESP__SOFT_AP = 304
+  CTRL_MSG__PAYLOAD_EVENT_STATION_DISCONNECT_FROM__ESP__SOFT_AP = 304,
+  CTRL_MSG__PAYLOAD_EVENT_SCAN_RESULT = 305
     PROTOBUF_C__FORCE_ENUM_TO_BE_INT_SIZE(CTRL_MSG__PAYLOAD__CASE)
 } CtrlMsg__PayloadCase;
 
@@ -806,6 +832,7 @@ struct  CtrlMsg
     CtrlMsgEventHeartbeat *event_heartbeat;
     CtrlMsgEventStationDisconnectFromAP *event_station_disconnect_from_ap;
     CtrlMsgEventStationDisconnectFromESPSoftAP *event_station_disconnect_from_esp_softap;
+    CtrlMsgEventScanResult *event_scan_result;
   };
 };
 #define CTRL_MSG__INIT \
@@ -1630,6 +1657,25 @@ CtrlMsgEventStationDisconnectFromESPSoftAP *
 void   ctrl_msg__event__station_disconnect_from_espsoft_ap__free_unpacked
                      (CtrlMsgEventStationDisconnectFromESPSoftAP *message,
                       ProtobufCAllocator *allocator);
+/* CtrlMsgEventScanResult methods */
+void   ctrl_msg__event__scan_result__init
+                     (CtrlMsgEventScanResult         *message);
+size_t ctrl_msg__event__scan_result__get_packed_size
+                     (const CtrlMsgEventScanResult   *message);
+size_t ctrl_msg__event__scan_result__pack
+                     (const CtrlMsgEventScanResult   *message,
+                      uint8_t             *out);
+size_t ctrl_msg__event__scan_result__pack_to_buffer
+                     (const CtrlMsgEventScanResult   *message,
+                      ProtobufCBuffer     *buffer);
+CtrlMsgEventScanResult *
+       ctrl_msg__event__scan_result__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   ctrl_msg__event__scan_result__free_unpacked
+                     (CtrlMsgEventScanResult *message,
+                      ProtobufCAllocator *allocator);
 /* CtrlMsg methods */
 void   ctrl_msg__init
                      (CtrlMsg         *message);
@@ -1780,6 +1826,9 @@ typedef void (*CtrlMsgEventStationDisconnectFromAP_Closure)
 typedef void (*CtrlMsgEventStationDisconnectFromESPSoftAP_Closure)
                  (const CtrlMsgEventStationDisconnectFromESPSoftAP *message,
                   void *closure_data);
+typedef void (*CtrlMsgEventScanResult_Closure)
+                 (const CtrlMsgEventScanResult *message,
+                  void *closure_data);
 typedef void (*CtrlMsg_Closure)
                  (const CtrlMsg *message,
                   void *closure_data);
@@ -1841,6 +1890,7 @@ extern const ProtobufCMessageDescriptor ctrl_msg__event__espinit__descriptor;
 extern const ProtobufCMessageDescriptor ctrl_msg__event__heartbeat__descriptor;
 extern const ProtobufCMessageDescriptor ctrl_msg__event__station_disconnect_from_ap__descriptor;
 extern const ProtobufCMessageDescriptor ctrl_msg__event__station_disconnect_from_espsoft_ap__descriptor;
+extern const ProtobufCMessageDescriptor ctrl_msg__event__scan_result__descriptor;
 extern const ProtobufCMessageDescriptor ctrl_msg__descriptor;
 
 PROTOBUF_C__END_DECLS
@@ -77,6 +77,14 @@ static const char TAG_TX_S[] = "CONTROL S -> H";
 
 #define ETH_DATA_LEN                     1500
 
+#if CONFIG_ESP_WLAN_RX_ZERO_COPY
+/* 802.11 header, replaced by shorter ethernet header in WLAN Rx buffer,
+ * leaves room to build esp_payload_header in front of frame */
+  #define WLAN_RX_HEADROOM               sizeof(struct esp_payload_header)
+#else
+  #define WLAN_RX_HEADROOM               0
+#endif
+
 volatile uint8_t datapath = 0;
 volatile uint8_t station_connected = 0;
 volatile uint8_t softap_started = 0;
@@ -231,6 +239,7 @@ esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb)
 	buf_handle.if_num = 0;
 	buf_handle.payload_len = len;
 	buf_handle.payload = buffer;
+	buf_handle.headroom = WLAN_RX_HEADROOM;
 	buf_handle.wlan_buf_handle = eb;
 	buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
 
@@ -259,6 +268,7 @@ esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb)
 	buf_handle.if_num = 0;
 	buf_handle.payload_len = len;
 	buf_handle.payload = buffer;
+	buf_handle.headroom = WLAN_RX_HEADROOM;
 	buf_handle.wlan_buf_handle = eb;
 	buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
 
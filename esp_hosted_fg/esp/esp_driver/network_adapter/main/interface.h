@@ -27,6 +27,11 @@
 
 #endif
 
+#ifdef CONFIG_ESP_SPI_HOST_INTERFACE
+/* SPI DMA reads this many bytes from every Tx buffer, whatever the frame length */
+#define SPI_BUFFER_SIZE                  1600
+#endif
+
 typedef enum {
 	LENGTH_1_BYTE  = 1,
 	LENGTH_2_BYTE  = 2,
@@ -62,7 +67,12 @@ typedef struct {
 	uint8_t if_num;
 	uint8_t *payload;
 	uint8_t flag;
+	/* Writable, DMA capable bytes in front of payload. Lets transport
+	 * build its header in place instead of copying payload */
+	uint8_t headroom;
 	uint16_t payload_len;
+	/* Bytes of same buffer after payload, which transport DMA may read */
+	uint16_t tailroom;
 	uint16_t seq_num;
 
 	void (*free_buf_handle)(void *buf_handle);
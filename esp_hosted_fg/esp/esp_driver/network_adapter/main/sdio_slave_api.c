@@ -21,11 +21,19 @@
 #include "adapter.h"
 #include "sdio_slave_api.h"
 #include "driver/sdio_slave.h"
+#include "freertos/task.h"
 #include "soc/sdio_slave_periph.h"
 #include "endian.h"
 #include "mempool.h"
 #include "stats.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
 
+/* Also bounds Tx buffers in flight, sdio_write() blocks once it is full */
 #define SDIO_SLAVE_QUEUE_SIZE   20
 #define BUFFER_SIZE     	1536 /* 512*3 */
 #define BUFFER_NUM      	10
@@ -33,6 +41,7 @@
 static uint8_t sdio_slave_rx_buffer[BUFFER_NUM][BUFFER_SIZE];
 
 static struct mempool * buf_mp_g;
+static struct mempool * tx_ctx_mp_g;
 
 interface_context_t context;
 interface_handle_t if_handle_g;
@@ -55,13 +64,16 @@ if_ops_t if_ops = {
 static inline void sdio_mempool_create(void)
 {
 	buf_mp_g = mempool_create(BUFFER_SIZE);
+	tx_ctx_mp_g = mempool_create(sizeof(interface_buffer_handle_t));
 #ifdef CONFIG_ESP_CACHE_MALLOC
 	assert(buf_mp_g);
+	assert(tx_ctx_mp_g);
 #endif
 }
 static inline void sdio_mempool_destroy(void)
 {
 	mempool_destroy(buf_mp_g);
+	mempool_destroy(tx_ctx_mp_g);
 }
 static inline void *sdio_buffer_alloc(uint need_memset)
 {
@@ -71,6 +83,51 @@ static inline void sdio_buffer_free(void *buf)
 {
 	mempool_free(buf_mp_g, buf);
 }
+static inline interface_buffer_handle_t *sdio_tx_ctx_alloc(void)
+{
+	return mempool_alloc(tx_ctx_mp_g, sizeof(interface_buffer_handle_t), MEMSET_REQUIRED);
+}
+static inline void sdio_tx_ctx_free(interface_buffer_handle_t *tx_ctx)
+{
+	mempool_free(tx_ctx_mp_g, tx_ctx);
+}
+
+/* Release Tx buffer to its owner, once host has read it */
+static void sdio_tx_done(interface_buffer_handle_t *tx_ctx)
+{
+	if (tx_ctx->free_buf_handle && tx_ctx->priv_buffer_handle) {
+		tx_ctx->free_buf_handle(tx_ctx->priv_buffer_handle);
+		tx_ctx->priv_buffer_handle = NULL;
+	}
+
+	sdio_tx_ctx_free(tx_ctx);
+}
+
+/* Queue buffer to SDIO driver without waiting for host to read it.
+ * Blocks only if SDIO_SLAVE_QUEUE_SIZE buffers are already in flight */
+static esp_err_t sdio_tx_queue_buf(uint8_t *sendbuf, uint32_t len,
+		interface_buffer_handle_t *tx_ctx)
+{
+	esp_err_t ret = sdio_slave_send_queue(sendbuf, len, tx_ctx, portMAX_DELAY);
+
+	if (ret != ESP_OK)
+		sdio_tx_done(tx_ctx);
+
+	return ret;
+}
+
+static void sdio_tx_done_task(void* pvParameters)
+{
+	void *tx_ctx = NULL;
+
+	for (;;) {
+		if (sdio_slave_send_get_finished(&tx_ctx, portMAX_DELAY) != ESP_OK)
+			continue;
+
+		if (tx_ctx)
+			sdio_tx_done(tx_ctx);
+	}
+}
 
 interface_context_t *interface_insert_driver(int (*event_handler)(uint8_t val))
 {
@@ -110,6 +167,7 @@ void generate_startup_event(uint8_t cap)
 	uint8_t *pos = NULL;
 	uint16_t len = 0;
 	uint8_t raw_tp_cap = 0;
+	interface_buffer_handle_t *tx_ctx = NULL;
 	esp_err_t ret = ESP_OK;
 
 	raw_tp_cap = debug_get_raw_tp_conf();
@@ -119,6 +177,11 @@ void generate_startup_event(uint8_t cap)
 	buf_handle.payload = sdio_buffer_alloc(MEMSET_REQUIRED);
 	assert(buf_handle.payload);
 
+	tx_ctx = sdio_tx_ctx_alloc();
+	assert(tx_ctx);
+	tx_ctx->priv_buffer_handle = buf_handle.payload;
+	tx_ctx->free_buf_handle = sdio_buffer_free;
+
 	header = (struct esp_payload_header *) buf_handle.payload;
 
 	header->if_type = ESP_PRIV_IF;
@@ -162,14 +225,11 @@ void generate_startup_event(uint8_t cap)
 	header->checksum = htole16(compute_checksum(buf_handle.payload, buf_handle.payload_len));
 #endif
 
-	ret = sdio_slave_transmit(buf_handle.payload, buf_handle.payload_len);
+	ret = sdio_tx_queue_buf(buf_handle.payload, buf_handle.payload_len, tx_ctx);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG , "sdio slave tx error, ret : 0x%x\r\n", ret);
-		sdio_buffer_free(buf_handle.payload);
 		return;
 	}
-
-	sdio_buffer_free(buf_handle.payload);
 }
 
 static void sdio_read_done(void *handle)
@@ -181,7 +241,9 @@ static interface_handle_t * sdio_init(void)
 {
 	esp_err_t ret = ESP_OK;
 	sdio_slave_config_t config = {
-		.sending_mode       = SDIO_SLAVE_SEND_STREAM,
+		/* Several sends are queued at once. Packet mode keeps each of them
+		 * a separate host read, as hosts expect one packet per read */
+		.sending_mode       = SDIO_SLAVE_SEND_PACKET,
 		.send_queue_size    = SDIO_SLAVE_QUEUE_SIZE,
 		.recv_buffer_size   = BUFFER_SIZE,
 		.event_cb           = event_cb,
@@ -237,11 +299,32 @@ static interface_handle_t * sdio_init(void)
 	memset(&if_handle_g, 0, sizeof(if_handle_g));
 
 	sdio_mempool_create();
+
+	assert(xTaskCreate(sdio_tx_done_task, "sdio_tx_done_task",
+			CONFIG_ESP_DEFAULT_TASK_STACK_SIZE, NULL,
+			CONFIG_ESP_DEFAULT_TASK_PRIO, NULL) == pdTRUE);
+
 	if_handle_g.state = INIT;
 
 	return &if_handle_g;
 }
 
+/* Header could be built in front of payload, if caller left enough DMA capable
+ * headroom */
+static bool can_tx_in_place(interface_buffer_handle_t *buf_handle)
+{
+	uint8_t *header = buf_handle->payload - sizeof(struct esp_payload_header);
+
+	if (buf_handle->headroom < sizeof(struct esp_payload_header))
+		return false;
+
+	/* Transport needs to own buffer until host reads it */
+	if (!buf_handle->free_buf_handle || !buf_handle->priv_buffer_handle)
+		return false;
+
+	return !((uint32_t)header & 3) && esp_ptr_dma_capable(header);
+}
+
 static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t *buf_handle)
 {
 	esp_err_t ret = ESP_OK;
@@ -249,6 +332,7 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 	uint8_t* sendbuf = NULL;
 	uint16_t offset = 0;
 	struct esp_payload_header *header = NULL;
+	interface_buffer_handle_t *tx_ctx = NULL;
 
 	if (!handle || !buf_handle) {
 		ESP_LOGE(TAG , "Invalid arguments");
@@ -266,12 +350,34 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 
 	total_len = buf_handle->payload_len + sizeof (struct esp_payload_header);
 
-	sendbuf = sdio_buffer_alloc(MEMSET_REQUIRED);
-	if (sendbuf == NULL) {
-		ESP_LOGE(TAG , "Malloc send buffer fail!");
+	tx_ctx = sdio_tx_ctx_alloc();
+	if (tx_ctx == NULL) {
+		ESP_LOGE(TAG , "Malloc tx context fail!");
 		return ESP_FAIL;
 	}
 
+	if (can_tx_in_place(buf_handle)) {
+		sendbuf = buf_handle->payload - sizeof(struct esp_payload_header);
+
+		/* Ownership moves to transport, until host reads the packet */
+		tx_ctx->priv_buffer_handle = buf_handle->priv_buffer_handle;
+		tx_ctx->free_buf_handle = buf_handle->free_buf_handle;
+		buf_handle->priv_buffer_handle = NULL;
+	} else {
+		sendbuf = sdio_buffer_alloc(MEMSET_REQUIRED);
+		if (sendbuf == NULL) {
+			ESP_LOGE(TAG , "Malloc send buffer fail!");
+			sdio_tx_ctx_free(tx_ctx);
+			return ESP_FAIL;
+		}
+
+		memcpy(sendbuf + sizeof(struct esp_payload_header),
+				buf_handle->payload, buf_handle->payload_len);
+
+		tx_ctx->priv_buffer_handle = sendbuf;
+		tx_ctx->free_buf_handle = sdio_buffer_free;
+	}
+
 	header = (struct esp_payload_header *) sendbuf;
 
 	memset (header, 0, sizeof(struct esp_payload_header));
@@ -283,22 +389,18 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 	offset = sizeof(struct esp_payload_header);
 	header->offset = htole16(offset);
 
-	memcpy(sendbuf + offset, buf_handle->payload, buf_handle->payload_len);
-
 #if CONFIG_ESP_SDIO_CHECKSUM
 	header->checksum = htole16(compute_checksum(sendbuf,
 				offset+buf_handle->payload_len));
 #endif
 
-	ret = sdio_slave_transmit(sendbuf, total_len);
+	/* Buffer is released by sdio_tx_done_task(), once host reads it */
+	ret = sdio_tx_queue_buf(sendbuf, total_len, tx_ctx);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG , "sdio slave transmit error, ret : 0x%x\r\n", ret);
-		sdio_buffer_free(sendbuf);
 		return ESP_FAIL;
 	}
 
-	sdio_buffer_free(sendbuf);
-
 	return buf_handle->payload_len;
 }
 
@@ -365,17 +467,15 @@ static esp_err_t sdio_reset(interface_handle_t *handle)
 		return ret;
 
 	while (1) {
-		sdio_slave_buf_handle_t handle = NULL;
+		void *tx_ctx = NULL;
 
-		/* Return buffers to driver */
-		ret = sdio_slave_send_get_finished(&handle, 0);
+		/* Release Tx buffers flushed by reset */
+		ret = sdio_slave_send_get_finished(&tx_ctx, 0);
 		if (ret != ESP_OK)
 			break;
 
-		if (handle) {
-			ret = sdio_slave_recv_load_buf(handle);
-			ESP_ERROR_CHECK_WITHOUT_ABORT(ret);
-		}
+		if (tx_ctx)
+			sdio_tx_done(tx_ctx);
 	}
 
 	return ESP_OK;
@@ -19,7 +19,9 @@
 #include "driver/uart.h"
 #include "esp_bt.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "slave_bt.h"
+#include "interface.h"
 #include "soc/lldesc.h"
 
 
@@ -51,22 +53,27 @@ static int host_rcv_pkt(uint8_t *data, uint16_t len)
 {
 	interface_buffer_handle_t buf_handle;
 	uint8_t *buf = NULL;
+	uint16_t buf_len = len + sizeof(struct esp_payload_header);
 
-	buf = (uint8_t *) malloc(len);
+	/* Reserve DMA capable headroom so that transport builds its header
+	 * in place, without copying packet again */
+	buf = (uint8_t *) heap_caps_malloc(buf_len, MALLOC_CAP_DMA);
 
 	if (!buf) {
 		ESP_LOGE(BT_TAG, "HCI Send packet: memory allocation failed");
 		return ESP_FAIL;
 	}
 
-	memcpy(buf, data, len);
+	memcpy(buf + sizeof(struct esp_payload_header), data, len);
 
 	memset(&buf_handle, 0, sizeof(buf_handle));
 
 	buf_handle.if_type = ESP_HCI_IF;
 	buf_handle.if_num = 0;
 	buf_handle.payload_len = len;
-	buf_handle.payload = buf;
+	buf_handle.payload = buf + sizeof(struct esp_payload_header);
+	buf_handle.headroom = sizeof(struct esp_payload_header);
+	buf_handle.tailroom = buf_len - sizeof(struct esp_payload_header) - len;
 	buf_handle.wlan_buf_handle = buf;
 	buf_handle.free_buf_handle = free;
 
@@ -15,6 +15,7 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_private/wifi.h"
 #include "slave_control.h"
@@ -53,6 +54,16 @@
 #define MIN_HEARTBEAT_INTERVAL      (10)
 #define MAX_HEARTBEAT_INTERVAL      (60*60)
 
+/* Scan modes of CtrlMsg_Req_ScanResult */
+#define SCAN_MODE_BLOCKING          0
+#define SCAN_MODE_STREAMING         1
+#define SCAN_MODE_CACHED            2
+
+/* BSS cache, filled by every scan */
+#define SCAN_CACHE_MAX_ENTRIES      64
+#define SCAN_CACHE_DFLT_AGE_SEC     30
+#define SCAN_MAX_CHNL               14
+
 #define mem_free(x)                 \
         {                           \
             if (x) {                \
@@ -61,6 +72,33 @@
             }                       \
         }
 
+typedef struct {
+	uint8_t ssid[SSID_LENGTH];
+	uint8_t bssid[MAC_LEN];
+	uint8_t chnl;
+	int8_t rssi;
+	uint8_t authmode;
+	bool valid;
+	TickType_t last_seen;
+} scan_cache_entry_t;
+
+/* Event data of CTRL_MSG_ID__Event_ScanResult. Queued by pointer, so
+ * kept in scan_stream till notification is built. Start of the scan it
+ * belongs to is copied, as next scan may begin before notify task runs */
+typedef struct {
+	uint8_t chnl;
+	uint8_t done;
+	TickType_t start;
+} scan_chunk_t;
+
+typedef struct {
+	volatile bool active;
+	uint8_t chnl;
+	uint8_t last_chnl;
+	TickType_t start;
+	scan_chunk_t chunk[SCAN_MAX_CHNL + 1];
+} scan_stream_t;
+
 typedef struct esp_ctrl_msg_cmd {
 	int req_num;
 	esp_err_t (*command_handler)(CtrlMsg *req,
@@ -77,6 +115,14 @@ static bool event_registered = false;
 static EventGroupHandle_t wifi_event_group;
 
 static bool scan_done = false;
+static scan_cache_entry_t scan_cache[SCAN_CACHE_MAX_ENTRIES];
+static SemaphoreHandle_t scan_cache_lock;
+static bool scan_cache_complete;
+static TickType_t scan_cache_complete_tick;
+/* Entry of last scan was evicted or dropped, so cache can't answer it */
+static bool scan_cache_overflow;
+static scan_stream_t scan_stream;
+static bool scan_stream_event_registered;
 static esp_ota_handle_t handle;
 const esp_partition_t* update_partition = NULL;
 static int ota_msg = 0;
@@ -984,44 +1030,273 @@ err:
 	return ESP_OK;
 }
 
-/* Function sends scanned list of available APs */
-static esp_err_t req_get_ap_scan_list_handler (CtrlMsg *req,
-		CtrlMsg *resp, void *priv_data)
+/* Called from control task, before any scan is started */
+static esp_err_t scan_cache_init(void)
+{
+	if (scan_cache_lock)
+		return ESP_OK;
+
+	scan_cache_lock = xSemaphoreCreateMutex();
+	if (!scan_cache_lock) {
+		ESP_LOGE(TAG, "Failed to create scan cache lock");
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+static bool scan_cache_entry_fresh(const scan_cache_entry_t *entry,
+		TickType_t now, TickType_t window)
+{
+	return entry->valid && ((TickType_t)(now - entry->last_seen) <= window);
+}
+
+/* Update entry of same BSSID, else take free or oldest entry. Entries of
+ * same batch are never evicted, record is dropped instead. Losing an entry
+ * seen since scan_start marks the cache as overflown */
+static void scan_cache_add(const wifi_ap_record_t *ap, TickType_t now,
+		TickType_t scan_start)
+{
+	scan_cache_entry_t *entry = NULL;
+	scan_cache_entry_t *oldest = NULL;
+
+	for (int i = 0; i < SCAN_CACHE_MAX_ENTRIES; i++) {
+		if (scan_cache[i].valid &&
+		    !memcmp(scan_cache[i].bssid, ap->bssid, MAC_LEN)) {
+			entry = &scan_cache[i];
+			break;
+		}
+		if (!scan_cache[i].valid) {
+			if (!entry)
+				entry = &scan_cache[i];
+		} else if (!oldest ||
+		           (TickType_t)(now - scan_cache[i].last_seen) >
+		           (TickType_t)(now - oldest->last_seen)) {
+			oldest = &scan_cache[i];
+		}
+	}
+	if (!entry) {
+		/* Full with records of this very batch */
+		if (oldest->last_seen == now) {
+			scan_cache_overflow = true;
+			return;
+		}
+		if (scan_cache_entry_fresh(oldest, now, now - scan_start))
+			scan_cache_overflow = true;
+		entry = oldest;
+	}
+
+	memcpy(entry->ssid, ap->ssid, SSID_LENGTH);
+	memcpy(entry->bssid, ap->bssid, MAC_LEN);
+	entry->chnl = ap->primary;
+	entry->rssi = ap->rssi;
+	entry->authmode = ap->authmode;
+	entry->last_seen = now;
+	entry->valid = true;
+}
+
+/* Take records of finished scan from wifi driver. *ap_info is NULL if
+ * no AP was found, else caller frees it */
+static esp_err_t scan_get_ap_records(wifi_ap_record_t **ap_info,
+		uint16_t *ap_count)
+{
+	esp_err_t ret = ESP_OK;
+
+	*ap_info = NULL;
+	*ap_count = 0;
+
+	ret = esp_wifi_scan_get_ap_num(ap_count);
+	if (ret) {
+		ESP_LOGE(TAG,"Failed to get scan AP number");
+		return ret;
+	}
+	if (!*ap_count)
+		return ESP_OK;
+
+	*ap_info = (wifi_ap_record_t *)calloc(*ap_count,sizeof(wifi_ap_record_t));
+	if (!*ap_info) {
+		ESP_LOGE(TAG,"Failed to allocate memory");
+		return ESP_ERR_NO_MEM;
+	}
+
+	ret = esp_wifi_scan_get_ap_records(ap_count,*ap_info);
+	if (ret) {
+		ESP_LOGE(TAG,"Failed to scan ap records");
+		mem_free(*ap_info);
+		*ap_count = 0;
+		return ret;
+	}
+	return ESP_OK;
+}
+
+static void scan_cache_update(const wifi_ap_record_t *ap_info,
+		uint16_t ap_count, TickType_t scan_start)
+{
+	TickType_t now = xTaskGetTickCount();
+
+	xSemaphoreTake(scan_cache_lock, portMAX_DELAY);
+	for (int i = 0; i < ap_count; i++)
+		scan_cache_add(&ap_info[i], now, scan_start);
+	xSemaphoreGive(scan_cache_lock);
+}
+
+/* Move records of finished scan from wifi driver to cache */
+static esp_err_t scan_cache_refresh(TickType_t scan_start)
 {
 	esp_err_t ret = ESP_OK;
-	wifi_mode_t mode = 0;
 	uint16_t ap_count = 0;
-	credentials_t credentials = {0};
 	wifi_ap_record_t *ap_info = NULL;
-	ScanResult **results = NULL;
-	CtrlMsgRespScanResult *resp_payload = NULL;
-	wifi_scan_config_t scanConf = {
-		.show_hidden = true
-	};
 
-	if (!req || !resp) {
-		ESP_LOGE(TAG, "Invalid parameters");
-		return ESP_FAIL;
+	ret = scan_get_ap_records(&ap_info, &ap_count);
+	if (ret)
+		return ret;
+
+	scan_cache_update(ap_info, ap_count, scan_start);
+	mem_free(ap_info);
+	return ESP_OK;
+}
+
+static void free_scan_results(ScanResult **entries, size_t n_entries)
+{
+	if (!entries)
+		return;
+
+	for (int i = 0; i < n_entries; i++) {
+		if (entries[i]) {
+			mem_free(entries[i]->ssid.data);
+			mem_free(entries[i]->bssid.data);
+			mem_free(entries[i]);
+		}
 	}
+	free(entries);
+}
 
-	resp_payload = (CtrlMsgRespScanResult *)
-		calloc(1,sizeof(CtrlMsgRespScanResult));
-	if (!resp_payload) {
+static ScanResult *scan_result_new(const uint8_t *ssid, const uint8_t *bssid_mac,
+		uint8_t chnl, int8_t rssi, uint8_t authmode)
+{
+	char bssid[BSSID_LENGTH] = "";
+	ScanResult *result = NULL;
+
+	result = (ScanResult *)calloc(1,sizeof(ScanResult));
+	if (!result)
+		return NULL;
+	scan_result__init(result);
+
+	result->ssid.len = strnlen((char *)ssid, SSID_LENGTH);
+	result->ssid.data = (uint8_t *)strndup((char *)ssid, SSID_LENGTH);
+
+	snprintf(bssid, BSSID_LENGTH, MACSTR, MAC2STR(bssid_mac));
+	result->bssid.len = strnlen(bssid, BSSID_LENGTH);
+	result->bssid.data = (uint8_t *)strndup(bssid, BSSID_LENGTH);
+
+	if (!result->ssid.data || !result->bssid.data) {
+		mem_free(result->ssid.data);
+		mem_free(result->bssid.data);
+		mem_free(result);
+		return NULL;
+	}
+
+	result->chnl = chnl;
+	result->rssi = rssi;
+	result->sec_prot = authmode;
+	return result;
+}
+
+/* Build scan results of all records of a finished scan. Partial results
+ * are left in *entries on failure, for caller to free */
+static esp_err_t scan_results_from_records(ScanResult ***entries,
+		size_t *n_entries, const wifi_ap_record_t *ap_info, uint16_t ap_count)
+{
+	ScanResult **results = NULL;
+
+	*entries = NULL;
+	*n_entries = 0;
+
+	if (!ap_count)
+		return ESP_OK;
+
+	results = (ScanResult **)calloc(ap_count, sizeof(ScanResult *));
+	if (!results) {
 		ESP_LOGE(TAG,"Failed To allocate memory");
 		return ESP_ERR_NO_MEM;
 	}
+	*entries = results;
 
-	ctrl_msg__resp__scan_result__init(resp_payload);
-	resp->payload_case = CTRL_MSG__PAYLOAD_RESP_SCAN_AP_LIST;
-	resp->resp_scan_ap_list = resp_payload;
+	for (int i = 0; i < ap_count; i++) {
+		results[i] = scan_result_new(ap_info[i].ssid, ap_info[i].bssid,
+				ap_info[i].primary, ap_info[i].rssi, ap_info[i].authmode);
+		if (!results[i]) {
+			ESP_LOGE(TAG,"Failed to allocate memory for scan result entry");
+			return ESP_ERR_NO_MEM;
+		}
+		ESP_LOGD(TAG, "AP %s chnl %u rssi %d", results[i]->bssid.data,
+				ap_info[i].primary, ap_info[i].rssi);
+		(*n_entries)++;
+	}
+	return ESP_OK;
+}
 
-	ap_scan_list_event_register();
-	ret = esp_wifi_get_mode(&mode);
-	if (ret) {
-		ESP_LOGE(TAG,"Failed to get wifi mode");
-		goto err;
+/* Build scan results of cache entries seen within window ticks.
+ * chnl 0 matches all channels. Partial results are left in *entries
+ * on failure, for caller to free */
+static esp_err_t scan_cache_collect(ScanResult ***entries, size_t *n_entries,
+		uint8_t chnl, TickType_t window)
+{
+	esp_err_t ret = ESP_OK;
+	TickType_t now = xTaskGetTickCount();
+	ScanResult **results = NULL;
+	uint16_t count = 0;
+
+	*entries = NULL;
+	*n_entries = 0;
+
+	xSemaphoreTake(scan_cache_lock, portMAX_DELAY);
+	for (int i = 0; i < SCAN_CACHE_MAX_ENTRIES; i++) {
+		if (scan_cache_entry_fresh(&scan_cache[i], now, window) &&
+		    (!chnl || scan_cache[i].chnl == chnl))
+			count++;
+	}
+	if (!count)
+		goto out;
+
+	results = (ScanResult **)calloc(count, sizeof(ScanResult *));
+	if (!results) {
+		ESP_LOGE(TAG,"Failed To allocate memory");
+		ret = ESP_ERR_NO_MEM;
+		goto out;
+	}
+	*entries = results;
+
+	for (int i = 0; i < SCAN_CACHE_MAX_ENTRIES && *n_entries < count; i++) {
+		if (!scan_cache_entry_fresh(&scan_cache[i], now, window) ||
+		    (chnl && scan_cache[i].chnl != chnl))
+			continue;
+
+		results[*n_entries] = scan_result_new(scan_cache[i].ssid,
+				scan_cache[i].bssid, scan_cache[i].chnl,
+				scan_cache[i].rssi, scan_cache[i].authmode);
+		if (!results[*n_entries]) {
+			ESP_LOGE(TAG,"Failed to allocate memory for scan result entry");
+			ret = ESP_ERR_NO_MEM;
+			goto out;
+		}
+		ESP_LOGD(TAG, "AP %s chnl %u rssi %d",
+				results[*n_entries]->bssid.data,
+				scan_cache[i].chnl, scan_cache[i].rssi);
+		(*n_entries)++;
 	}
 
+out:
+	xSemaphoreGive(scan_cache_lock);
+	return ret;
+}
+
+static void scan_set_wifi_mode(void)
+{
+	wifi_mode_t mode = 0;
+
+	if (esp_wifi_get_mode(&mode))
+		ESP_LOGE(TAG,"Failed to get wifi mode");
+
 	if ((softap_started) &&
 	    ((mode != WIFI_MODE_STA) && (mode != WIFI_MODE_NULL))) {
 		ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
@@ -1030,116 +1305,214 @@ static esp_err_t req_get_ap_scan_list_handler (CtrlMsg *req,
 		ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
 		ESP_LOGI(TAG,"Station mode set in scan handler");
 	}
+}
+
+/* Scans all channels, returns once done. Control path is held meanwhile.
+ * Records are added to cache and handed to caller, who frees *ap_info */
+static esp_err_t scan_blocking(wifi_ap_record_t **ap_info, uint16_t *ap_count)
+{
+	esp_err_t ret = ESP_OK;
+	TickType_t start = xTaskGetTickCount();
+	wifi_scan_config_t scanConf = {
+		.show_hidden = true
+	};
 
+	*ap_info = NULL;
+	*ap_count = 0;
+
+	scan_set_wifi_mode();
+
+	scan_done = false;
+	scan_cache_complete = false;
+	scan_cache_overflow = false;
+	ap_scan_list_event_register();
 	ret = esp_wifi_scan_start(&scanConf, true);
+	ap_scan_list_event_unregister();
 	if (ret) {
 		ESP_LOGE(TAG,"Failed to start scan start command");
-		goto err;
+		return ret;
 	}
 	if (!scan_done) {
 		ESP_LOGE(TAG,"Scanning incomplete");
-		goto err;
+		return ESP_FAIL;
 	}
 
-	ret = esp_wifi_scan_get_ap_num(&ap_count);
-	if (ret) {
-		ESP_LOGE(TAG,"Failed to get scan AP number");
-		goto err;
+	ret = scan_get_ap_records(ap_info, ap_count);
+	if (ret)
+		return ret;
+
+	scan_cache_update(*ap_info, *ap_count, start);
+	scan_cache_complete = true;
+	scan_cache_complete_tick = start;
+	return ESP_OK;
+}
+
+static esp_err_t scan_stream_next(void)
+{
+	wifi_scan_config_t scanConf = {
+		.show_hidden = true,
+		.channel = scan_stream.chnl,
+	};
+
+	return esp_wifi_scan_start(&scanConf, false);
+}
+
+/* Runs in event task: collect results of channel just scanned, notify host
+ * and move on to next channel */
+static void ap_scan_stream_event_handler(void *arg, esp_event_base_t event_base,
+		int32_t event_id, void *event_data)
+{
+	scan_chunk_t *chunk = NULL;
+
+	if (!scan_stream.active)
+		return;
+
+	scan_cache_refresh(scan_stream.start);
+
+	chunk = &scan_stream.chunk[scan_stream.chnl];
+	chunk->chnl = scan_stream.chnl;
+	chunk->done = (scan_stream.chnl >= scan_stream.last_chnl);
+	chunk->start = scan_stream.start;
+
+	if (chunk->done) {
+		scan_cache_complete = true;
+		scan_cache_complete_tick = scan_stream.start;
+	} else {
+		scan_stream.chnl++;
+		if (scan_stream_next()) {
+			ESP_LOGE(TAG, "Failed to scan channel %u", scan_stream.chnl);
+			chunk->done = true;
+		}
 	}
-	if (!ap_count) {
-		ESP_LOGE(TAG,"No AP available");
-		goto err;
+
+	if (chunk->done)
+		scan_stream.active = false;
+
+	send_event_data_to_host(CTRL_MSG_ID__Event_ScanResult,
+			(uint8_t *)chunk, sizeof(scan_chunk_t));
+}
+
+/* Scan one channel at a time, without blocking control path. Results of
+ * each channel are sent as CTRL_MSG_ID__Event_ScanResult */
+static esp_err_t scan_stream_start(void)
+{
+	esp_err_t ret = ESP_OK;
+	wifi_country_t country = {0};
+
+	scan_stream.chnl = 1;
+	scan_stream.last_chnl = 11;
+	if (!esp_wifi_get_country(&country) && country.nchan) {
+		scan_stream.chnl = country.schan;
+		scan_stream.last_chnl = min(country.schan + country.nchan - 1,
+				SCAN_MAX_CHNL);
 	}
 
-	ap_info = (wifi_ap_record_t *)calloc(ap_count,sizeof(wifi_ap_record_t));
-	if (!ap_info) {
-		ESP_LOGE(TAG,"Failed to allocate memory");
-		goto err;
+	if (!scan_stream_event_registered) {
+		ret = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE,
+				&ap_scan_stream_event_handler, NULL);
+		if (ret) {
+			ESP_LOGE(TAG, "Failed to register scan stream event");
+			return ret;
+		}
+		scan_stream_event_registered = true;
 	}
 
-	ret = esp_wifi_scan_get_ap_records(&ap_count,ap_info);
+	scan_set_wifi_mode();
+
+	scan_stream.start = xTaskGetTickCount();
+	scan_cache_complete = false;
+	scan_cache_overflow = false;
+	scan_stream.active = true;
+	ret = scan_stream_next();
 	if (ret) {
-		ESP_LOGE(TAG,"Failed to scan ap records");
-		goto err;
+		ESP_LOGE(TAG,"Failed to start scan start command");
+		scan_stream.active = false;
 	}
+	return ret;
+}
 
-	credentials.count = ap_count;
+/* Function sends scanned list of available APs.
+ * Blocking: scan all channels, then respond with results.
+ * Streaming: respond right away, results follow as events per channel.
+ * Cached: respond from BSS cache if it is fresh enough, else as blocking */
+static esp_err_t req_get_ap_scan_list_handler (CtrlMsg *req,
+		CtrlMsg *resp, void *priv_data)
+{
+	esp_err_t ret = ESP_OK;
+	int32_t scan_mode = SCAN_MODE_BLOCKING;
+	uint32_t max_age_sec = SCAN_CACHE_DFLT_AGE_SEC;
+	TickType_t window = 0;
+	uint16_t ap_count = 0;
+	wifi_ap_record_t *ap_info = NULL;
+	CtrlMsgRespScanResult *resp_payload = NULL;
 
-	results = (ScanResult **)
-		calloc(credentials.count, sizeof(ScanResult));
-	if (!results) {
+	if (!req || !resp) {
+		ESP_LOGE(TAG, "Invalid parameters");
+		return ESP_FAIL;
+	}
+
+	resp_payload = (CtrlMsgRespScanResult *)
+		calloc(1,sizeof(CtrlMsgRespScanResult));
+	if (!resp_payload) {
 		ESP_LOGE(TAG,"Failed To allocate memory");
-		goto err;
+		return ESP_ERR_NO_MEM;
 	}
 
-	resp_payload->entries = results;
-	ESP_LOGI(TAG,"Total APs scanned = %u",ap_count);
-	for (int i = 0; i < credentials.count; i++ ) {
-		results[i] = (ScanResult *)calloc(1,sizeof(ScanResult));
-		if (!results[i]) {
-			ESP_LOGE(TAG,"Failed to allocate memory");
-			goto err;
-		}
-		scan_result__init(results[i]);
+	ctrl_msg__resp__scan_result__init(resp_payload);
+	resp->payload_case = CTRL_MSG__PAYLOAD_RESP_SCAN_AP_LIST;
+	resp->resp_scan_ap_list = resp_payload;
 
-		ESP_LOGI(TAG,"Details of AP no %d",i);
+	/* Older hosts send no payload, these get blocking scan */
+	if (req->req_scan_ap_list) {
+		scan_mode = req->req_scan_ap_list->scan_mode;
+		if (req->req_scan_ap_list->max_age_sec)
+			max_age_sec = req->req_scan_ap_list->max_age_sec;
+	}
 
-		results[i]->ssid.len = strnlen((char *)ap_info[i].ssid, SSID_LENGTH);
+	if (scan_cache_init())
+		goto err;
 
+	if (scan_stream.active) {
+		ESP_LOGE(TAG, "Scan already in progress");
+		goto err;
+	}
 
-		results[i]->ssid.data = (uint8_t *)strndup((char *)ap_info[i].ssid,
-				SSID_LENGTH);
-		if (!results[i]->ssid.data) {
-			ESP_LOGE(TAG,"Failed to allocate memory for scan result entry SSID");
-			mem_free(results[i]);
+	if (scan_mode == SCAN_MODE_STREAMING) {
+		if (scan_stream_start())
 			goto err;
-		}
+		resp_payload->resp = SUCCESS;
+		return ESP_OK;
+	}
 
-		credentials.chnl = ap_info[i].primary;
-		results[i]->chnl = credentials.chnl;
-		credentials.rssi = ap_info[i].rssi;
-		results[i]->rssi = credentials.rssi;
-
-		snprintf((char *)credentials.bssid, BSSID_LENGTH,
-				MACSTR, MAC2STR(ap_info[i].bssid));
-		results[i]->bssid.len = strnlen((char *)credentials.bssid, BSSID_LENGTH);
-		if (!results[i]->bssid.len) {
-			ESP_LOGE(TAG, "Invalid BSSID length");
-			mem_free(results[i]);
-			goto err;
-		}
-		results[i]->bssid.data = (uint8_t *)strndup((char *)credentials.bssid,
-				BSSID_LENGTH);
-		if (!results[i]->bssid.data) {
-			ESP_LOGE(TAG, "Failed to allocate memory for scan result entry BSSID");
-			mem_free(results[i]);
+	window = max_age_sec * TIMEOUT_IN_SEC;
+	if ((scan_mode == SCAN_MODE_CACHED) && scan_cache_complete &&
+	    !scan_cache_overflow &&
+	    ((TickType_t)(xTaskGetTickCount() - scan_cache_complete_tick) <= window)) {
+		ret = scan_cache_collect(&resp_payload->entries,
+				&resp_payload->n_entries, 0, window);
+	} else {
+		/* Answered from records, cache may not hold all of them */
+		if (scan_blocking(&ap_info, &ap_count))
 			goto err;
-		}
-
-		credentials.ecn = ap_info[i].authmode;
-		results[i]->sec_prot = credentials.ecn;
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0) 
-		ESP_LOGI(TAG, "SSID      \t\t%s\nRSSI      \t\t%ld\nChannel   \t\t%lu\nBSSID     \t\t%s\nAuth mode \t\t%d\n",
-#else
-		ESP_LOGI(TAG,"\nSSID      \t\t%s\nRSSI      \t\t%d\nChannel   \t\t%d\nBSSID     \t\t%s\nAuth mode \t\t%d\n",
-#endif
-				results[i]->ssid.data, results[i]->rssi, results[i]->chnl,
-				results[i]->bssid.data, results[i]->sec_prot);
-		vTaskDelay(1);
+		ret = scan_results_from_records(&resp_payload->entries,
+				&resp_payload->n_entries, ap_info, ap_count);
+		mem_free(ap_info);
+	}
+	resp_payload->count = resp_payload->n_entries;
+	if (ret)
+		goto err;
 
-		resp_payload->n_entries++;
-		resp_payload->count++;
+	ESP_LOGI(TAG,"Total APs scanned = %u", (unsigned int)resp_payload->count);
+	if (!resp_payload->count) {
+		ESP_LOGE(TAG,"No AP available");
+		goto err;
 	}
 
 	resp_payload->resp = SUCCESS;
-	mem_free(ap_info);
-	ap_scan_list_event_unregister();
 	return ESP_OK;
 
 err:
 	resp_payload->resp = FAILURE;
-	mem_free(ap_info);
-	ap_scan_list_event_unregister();
 	return ESP_OK;
 }
 
@@ -2043,20 +2416,8 @@ static void esp_ctrl_msg_cleanup(CtrlMsg *resp)
 			break;
 		} case (CTRL_MSG_ID__Resp_GetAPScanList) : {
 			if (resp->resp_scan_ap_list) {
-				if (resp->resp_scan_ap_list->entries) {
-					for (int i=0 ; i<resp->resp_scan_ap_list->n_entries; i++) {
-						if (resp->resp_scan_ap_list->entries[i]) {
-							if (resp->resp_scan_ap_list->entries[i]->ssid.data) {
-								mem_free(resp->resp_scan_ap_list->entries[i]->ssid.data);
-							}
-							if (resp->resp_scan_ap_list->entries[i]->bssid.data) {
-								mem_free(resp->resp_scan_ap_list->entries[i]->bssid.data);
-							}
-							mem_free(resp->resp_scan_ap_list->entries[i]);
-						}
-				   }
-					mem_free(resp->resp_scan_ap_list->entries);
-				}
+				free_scan_results(resp->resp_scan_ap_list->entries,
+						resp->resp_scan_ap_list->n_entries);
 				mem_free(resp->resp_scan_ap_list);
 			}
 			break;
@@ -2118,6 +2479,13 @@ static void esp_ctrl_msg_cleanup(CtrlMsg *resp)
 		} case (CTRL_MSG_ID__Event_StationDisconnectFromESPSoftAP) : {
 			mem_free(resp->event_station_disconnect_from_esp_softap);
 			break;
+		} case (CTRL_MSG_ID__Event_ScanResult) : {
+			if (resp->event_scan_result) {
+				free_scan_results(resp->event_scan_result->entries,
+						resp->event_scan_result->n_entries);
+				mem_free(resp->event_scan_result);
+			}
+			break;
 		} default: {
 			ESP_LOGE(TAG, "Unsupported CtrlMsg type[%u]",resp->msg_id);
 			break;
@@ -2272,6 +2640,44 @@ err:
 	return ESP_OK;
 }
 
+/* Results of one channel of streaming scan */
+static esp_err_t ctrl_ntfy_ScanResult(CtrlMsg *ntfy,
+		const uint8_t *data, ssize_t len)
+{
+	const scan_chunk_t *chunk = (const scan_chunk_t *)data;
+	CtrlMsgEventScanResult *ntfy_payload = NULL;
+
+	ntfy_payload = (CtrlMsgEventScanResult*)
+		calloc(1,sizeof(CtrlMsgEventScanResult));
+	if (!ntfy_payload) {
+		ESP_LOGE(TAG,"Failed to allocate memory");
+		return ESP_ERR_NO_MEM;
+	}
+	ctrl_msg__event__scan_result__init(ntfy_payload);
+
+	ntfy->payload_case = CTRL_MSG__PAYLOAD_EVENT_SCAN_RESULT;
+	ntfy->event_scan_result = ntfy_payload;
+
+	if (!chunk || (len != sizeof(scan_chunk_t))) {
+		ESP_LOGE(TAG, "Invalid scan result event data");
+		goto err;
+	}
+
+	ntfy_payload->chnl = chunk->chnl;
+	ntfy_payload->scan_done = chunk->done;
+
+	if (scan_cache_collect(&ntfy_payload->entries, &ntfy_payload->n_entries,
+			chunk->chnl, xTaskGetTickCount() - chunk->start))
+		goto err;
+	ntfy_payload->count = ntfy_payload->n_entries;
+
+	ntfy_payload->resp = SUCCESS;
+	return ESP_OK;
+err:
+	ntfy_payload->resp = FAILURE;
+	return ESP_OK;
+}
+
 esp_err_t ctrl_notify_handler(uint32_t session_id,const uint8_t *inbuf,
 		ssize_t inlen, uint8_t **outbuf, ssize_t *outlen, void *priv_data)
 {
@@ -2300,6 +2706,9 @@ esp_err_t ctrl_notify_handler(uint32_t session_id,const uint8_t *inbuf,
 		} case CTRL_MSG_ID__Event_StationDisconnectFromESPSoftAP: {
 			ret = ctrl_ntfy_StationDisconnectFromESPSoftAP(&ntfy, inbuf, inlen);
 			break;
+		} case CTRL_MSG_ID__Event_ScanResult: {
+			ret = ctrl_ntfy_ScanResult(&ntfy, inbuf, inlen);
+			break;
 		} default: {
 			ESP_LOGE(TAG, "Incorrect/unsupported Ctrl Notification[%u]\n",ntfy.msg_id);
 			goto err;
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/param.h>
 #include "soc/gpio_reg.h"
 #include "esp_log.h"
 #include "interface.h"
@@ -27,6 +28,12 @@
 #include "freertos/task.h"
 #include "mempool.h"
 #include "stats.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
 
 static const char TAG[] = "SPI_DRIVER";
 /* SPI settings */
@@ -148,7 +155,6 @@ static const char TAG[] = "SPI_DRIVER";
 
 
 /* SPI internal configs */
-#define SPI_BUFFER_SIZE            1600
 #define SPI_QUEUE_SIZE             3
 
 #define SPI_RX_QUEUE_SIZE          CONFIG_ESP_SPI_RX_Q_SIZE
@@ -159,6 +165,18 @@ static interface_handle_t if_handle_g;
 static QueueHandle_t spi_rx_queue[MAX_PRIORITY_QUEUES] = {NULL};
 static QueueHandle_t spi_tx_queue[MAX_PRIORITY_QUEUES] = {NULL};
 
+/* Length host clocks for transaction being queued, as announced in previous
+ * one. Only shorter than SPI_BUFFER_SIZE once host sets SPI_HOST_VAR_LEN */
+static uint16_t tx_len_limit = SPI_BUFFER_SIZE;
+static bool host_var_len;
+static uint16_t host_tx_len;
+
+/* SPI transaction along with handle to release its Tx buffer once done */
+typedef struct {
+	spi_slave_transaction_t trans;
+	interface_buffer_handle_t tx_buf_handle;
+} spi_trans_ctx_t;
+
 static interface_handle_t * esp_spi_init(void);
 static int32_t esp_spi_write(interface_handle_t *handle,
 				interface_buffer_handle_t *buf_handle);
@@ -166,6 +184,7 @@ static int esp_spi_read(interface_handle_t *if_handle, interface_buffer_handle_t
 static esp_err_t esp_spi_reset(interface_handle_t *handle);
 static void esp_spi_deinit(interface_handle_t *handle);
 static void esp_spi_read_done(void *handle);
+static void esp_spi_tx_done(void *handle);
 static void queue_next_transaction(void);
 
 if_ops_t if_ops = {
@@ -182,7 +201,7 @@ static struct mempool * trans_mp_g;
 static inline void spi_mempool_create()
 {
 	buf_mp_g = mempool_create(SPI_BUFFER_SIZE);
-	trans_mp_g = mempool_create(sizeof(spi_slave_transaction_t));
+	trans_mp_g = mempool_create(sizeof(spi_trans_ctx_t));
 #ifdef CONFIG_ESP_CACHE_MALLOC
 	assert(buf_mp_g);
 	assert(trans_mp_g);
@@ -200,9 +219,9 @@ static inline void *spi_buffer_alloc(uint need_memset)
 	return mempool_alloc(buf_mp_g, SPI_BUFFER_SIZE, need_memset);
 }
 
-static inline spi_slave_transaction_t *spi_trans_alloc(uint need_memset)
+static inline spi_trans_ctx_t *spi_trans_alloc(uint need_memset)
 {
-	return mempool_alloc(trans_mp_g, sizeof(spi_slave_transaction_t), need_memset);
+	return mempool_alloc(trans_mp_g, sizeof(spi_trans_ctx_t), need_memset);
 }
 
 static inline void spi_buffer_free(void *buf)
@@ -210,11 +229,19 @@ static inline void spi_buffer_free(void *buf)
 	mempool_free(buf_mp_g, buf);
 }
 
-static inline void spi_trans_free(spi_slave_transaction_t *trans)
+static inline void spi_trans_free(spi_trans_ctx_t *trans)
 {
 	mempool_free(trans_mp_g, trans);
 }
 
+static inline void spi_tx_buffer_release(interface_buffer_handle_t *buf_handle)
+{
+	if (buf_handle->free_buf_handle && buf_handle->priv_buffer_handle) {
+		buf_handle->free_buf_handle(buf_handle->priv_buffer_handle);
+		buf_handle->priv_buffer_handle = NULL;
+	}
+}
+
 static inline void set_handshake_gpio(void)
 {
 	WRITE_PERI_REG(GPIO_OUT_W1TS_REG, GPIO_MASK_HANDSHAKE);
@@ -263,6 +290,8 @@ void generate_startup_event(uint8_t cap)
 	uint8_t raw_tp_cap = 0;
 
 	buf_handle.payload = spi_buffer_alloc(MEMSET_REQUIRED);
+	buf_handle.priv_buffer_handle = buf_handle.payload;
+	buf_handle.free_buf_handle = esp_spi_tx_done;
 
 	raw_tp_cap = debug_get_raw_tp_conf();
 
@@ -341,44 +370,48 @@ static void IRAM_ATTR spi_post_trans_cb(spi_slave_transaction_t *trans)
 	reset_handshake_gpio();
 }
 
-static uint8_t * get_next_tx_buffer(uint32_t *len)
+static int get_next_tx_buffer(interface_buffer_handle_t *buf_handle, uint16_t max_len)
 {
-	interface_buffer_handle_t buf_handle = {0};
-	esp_err_t ret = ESP_OK;
+	esp_err_t ret = pdFALSE;
 	uint8_t *sendbuf = NULL;
 	struct esp_payload_header *header = NULL;
+	uint8_t prio_q_idx = 0;
+	bool pending = false;
 
 	/* Get or create new tx_buffer
 	 *	1. Check if SPI TX queue has pending buffers. Return if valid buffer is obtained.
 	 *	2. Create a new empty tx buffer and return */
 
-	/* Get buffer from SPI Tx queue */
-	if (uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_SERIAL]))
-		ret = xQueueReceive(spi_tx_queue[PRIO_Q_SERIAL], &buf_handle, portMAX_DELAY);
-	else if (uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_BT]))
-		ret = xQueueReceive(spi_tx_queue[PRIO_Q_BT], &buf_handle, portMAX_DELAY);
-	else if (uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_OTHERS]))
-		ret = xQueueReceive(spi_tx_queue[PRIO_Q_OTHERS], &buf_handle, portMAX_DELAY);
-	else
-		ret = pdFALSE;
+	/* Get buffer from SPI Tx queue, in priority order. Frame longer than
+	 * host clocks this time waits for next transaction, which is announced
+	 * long enough for it */
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (xQueuePeek(spi_tx_queue[prio_q_idx], buf_handle, 0) != pdTRUE)
+			continue;
+
+		pending = true;
+		if (buf_handle->payload_len > max_len)
+			continue;
 
-	if (ret == pdTRUE && buf_handle.payload) {
-		if (len)
-			*len = buf_handle.payload_len;
+		ret = xQueueReceive(spi_tx_queue[prio_q_idx], buf_handle, portMAX_DELAY);
+		break;
+	}
+
+	if (ret == pdTRUE && buf_handle->payload) {
 		/* Return real data buffer from queue */
-		return buf_handle.payload;
+		return ESP_OK;
 	}
 
 	/* No real data pending, clear ready line and indicate host an idle state */
-	reset_dataready_gpio();
+	if (!pending)
+		reset_dataready_gpio();
 
 	/* Create empty dummy buffer */
+	memset(buf_handle, 0, sizeof(interface_buffer_handle_t));
 	sendbuf = spi_buffer_alloc(MEMSET_REQUIRED);
 	if (!sendbuf) {
 		ESP_LOGE(TAG, "Failed to allocate memory for dummy transaction");
-		if (len)
-			*len = 0;
-		return NULL;
+		return ESP_FAIL;
 	}
 
 	/* Initialize header */
@@ -389,10 +422,11 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
 	header->if_num = 0xF;
 	header->len = 0;
 
-	if (len)
-		*len = 0;
+	buf_handle->payload = sendbuf;
+	buf_handle->priv_buffer_handle = sendbuf;
+	buf_handle->free_buf_handle = esp_spi_tx_done;
 
-	return sendbuf;
+	return ESP_OK;
 }
 
 static int process_spi_rx(interface_buffer_handle_t *buf_handle)
@@ -451,37 +485,127 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	return 0;
 }
 
+/* Host frames tell whether host clocks announced length, and how much room
+ * its next frame needs */
+static void spi_update_host_tx_len(uint8_t *rx_buffer)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) rx_buffer;
+
+	host_var_len = header->flags & SPI_HOST_VAR_LEN;
+	host_tx_len = MIN(header->reserved2 * SPI_NEXT_TX_LEN_UNIT, SPI_BUFFER_SIZE);
+}
+
+/* Length of next transaction in SPI_NEXT_TX_LEN_UNIT, 0 for full buffer.
+ * Covers next queued frame and room host asked for */
+static uint8_t get_next_tx_len_hint(void)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	uint16_t len = host_tx_len;
+	uint8_t prio_q_idx = 0;
+
+	if (!host_var_len)
+		return 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (xQueuePeek(spi_tx_queue[prio_q_idx], &buf_handle, 0) == pdTRUE) {
+			len = MAX(len, buf_handle.payload_len);
+			break;
+		}
+	}
+
+	return (len + SPI_NEXT_TX_LEN_UNIT - 1) / SPI_NEXT_TX_LEN_UNIT;
+}
+
+static void announce_next_tx_len(interface_buffer_handle_t *buf_handle)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) buf_handle->payload;
+	uint8_t hint = get_next_tx_len_hint();
+
+	header->reserved2 = hint;
+
+#if CONFIG_ESP_SPI_CHECKSUM
+	/* Checksum of real frame was computed with zero hint, add it */
+	if (header->len)
+		header->checksum = htole16(le16toh(header->checksum) + hint);
+#endif
+
+	tx_len_limit = hint ? hint * SPI_NEXT_TX_LEN_UNIT : SPI_BUFFER_SIZE;
+}
+
+/* SPI DMA reads whole transaction from header onwards. Frame built in place
+ * is copied to transport buffer, unless caller buffer covers that length.
+ * Reading less than SPI_NEXT_TX_LEN_UNIT past its end is fine, length is
+ * rounded up to that unit and host ignores bytes past frame */
+static int spi_tx_buffer_fit(interface_buffer_handle_t *buf_handle, uint16_t trans_len)
+{
+	uint8_t *buf = NULL;
+	uint32_t buf_len = buf_handle->payload_len + buf_handle->tailroom;
+
+	/* Transport buffers, dummy ones included, span SPI_BUFFER_SIZE */
+	if (buf_handle->free_buf_handle == esp_spi_tx_done)
+		return ESP_OK;
+
+	if ((buf_len + SPI_NEXT_TX_LEN_UNIT - 1 >= trans_len) &&
+	    esp_ptr_dma_capable(buf_handle->payload + trans_len - 1))
+		return ESP_OK;
+
+	buf = spi_buffer_alloc(MEMSET_NOT_REQUIRED);
+	if (!buf)
+		return ESP_FAIL;
+
+	memcpy(buf, buf_handle->payload, buf_handle->payload_len);
+	spi_tx_buffer_release(buf_handle);
+
+	buf_handle->payload = buf;
+	buf_handle->priv_buffer_handle = buf;
+	buf_handle->free_buf_handle = esp_spi_tx_done;
+	buf_handle->tailroom = SPI_BUFFER_SIZE - buf_handle->payload_len;
+
+	return ESP_OK;
+}
+
 static void queue_next_transaction(void)
 {
-	spi_slave_transaction_t *spi_trans = NULL;
+	spi_trans_ctx_t *spi_trans = NULL;
 	esp_err_t ret = ESP_OK;
-	uint32_t len = 0;
-	uint8_t *tx_buffer = get_next_tx_buffer(&len);
-	if (!tx_buffer) {
+	interface_buffer_handle_t tx_buf_handle = {0};
+	uint16_t trans_len = tx_len_limit;
+
+	if (get_next_tx_buffer(&tx_buf_handle, trans_len)) {
 		/* Queue next transaction failed */
 		ESP_LOGE(TAG , "Failed to queue new transaction\r\n");
 		return;
 	}
 
+	if (spi_tx_buffer_fit(&tx_buf_handle, trans_len)) {
+		ESP_LOGE(TAG, "Failed to allocate tx buffer\n");
+		spi_tx_buffer_release(&tx_buf_handle);
+		return;
+	}
+
+	announce_next_tx_len(&tx_buf_handle);
+
 	spi_trans = spi_trans_alloc(MEMSET_REQUIRED);
 	assert(spi_trans);
 
 	/* Attach Rx Buffer */
-	spi_trans->rx_buffer = spi_buffer_alloc(MEMSET_REQUIRED);
-	assert(spi_trans->rx_buffer);
+	spi_trans->trans.rx_buffer = spi_buffer_alloc(MEMSET_REQUIRED);
+	assert(spi_trans->trans.rx_buffer);
 
-	/* Attach Tx Buffer */
-	spi_trans->tx_buffer = tx_buffer;
+	/* Attach Tx Buffer, released to its owner once transaction completes */
+	spi_trans->trans.tx_buffer = tx_buf_handle.payload;
+	spi_trans->tx_buf_handle = tx_buf_handle;
 
-	/* Transaction len */
-	spi_trans->length = SPI_BUFFER_SIZE * SPI_BITS_PER_WORD;
+	/* Transaction len, as host clocks it. Rx buffer spans SPI_BUFFER_SIZE
+	 * anyway */
+	spi_trans->trans.length = trans_len * SPI_BITS_PER_WORD;
 
-	ret = spi_slave_queue_trans(ESP_SPI_CONTROLLER, spi_trans, portMAX_DELAY);
+	ret = spi_slave_queue_trans(ESP_SPI_CONTROLLER, &spi_trans->trans, portMAX_DELAY);
 
 	if (ret != ESP_OK) {
 		ESP_LOGI(TAG, "Failed to queue next SPI transfer\n");
-		spi_buffer_free(spi_trans->rx_buffer);
-		spi_buffer_free((void *)spi_trans->tx_buffer);
+		spi_buffer_free(spi_trans->trans.rx_buffer);
+		spi_tx_buffer_release(&spi_trans->tx_buf_handle);
 		spi_trans_free(spi_trans);
 		return;
 	}
@@ -489,7 +613,8 @@ static void queue_next_transaction(void)
 
 static void spi_transaction_post_process_task(void* pvParameters)
 {
-	spi_slave_transaction_t *spi_trans = NULL;
+	spi_slave_transaction_t *trans = NULL;
+	spi_trans_ctx_t *spi_trans = NULL;
 	esp_err_t ret = ESP_OK;
 	interface_buffer_handle_t rx_buf_handle;
 
@@ -499,9 +624,13 @@ static void spi_transaction_post_process_task(void* pvParameters)
 		/* Await transmission result, after any kind of transmission a new packet
 		 * (dummy or real) must be placed in SPI slave
 		 */
-		ret = spi_slave_get_trans_result(ESP_SPI_CONTROLLER, &spi_trans,
+		ret = spi_slave_get_trans_result(ESP_SPI_CONTROLLER, &trans,
 				portMAX_DELAY);
 
+		/* Room host needs is known before next transaction is sized */
+		if (ret == ESP_OK && trans && trans->rx_buffer)
+			spi_update_host_tx_len((uint8_t *) trans->rx_buffer);
+
 		/* Queue new transaction to get ready as soon as possible */
 		queue_next_transaction();
 
@@ -510,24 +639,26 @@ static void spi_transaction_post_process_task(void* pvParameters)
 			continue;
 		}
 
-		if (!spi_trans) {
+		if (!trans) {
 			ESP_LOGW(TAG , "spi_trans fetched NULL\n");
 			continue;
 		}
 
-		/* Free any tx buffer, data is not relevant anymore */
-		spi_buffer_free((void *)spi_trans->tx_buffer);
+		spi_trans = (spi_trans_ctx_t *) trans;
+
+		/* Release tx buffer, data is not relevant anymore */
+		spi_tx_buffer_release(&spi_trans->tx_buf_handle);
 
 		/* Process received data */
-		if (spi_trans->rx_buffer) {
-			rx_buf_handle.payload = spi_trans->rx_buffer;
+		if (trans->rx_buffer) {
+			rx_buf_handle.payload = trans->rx_buffer;
 
 			ret = process_spi_rx(&rx_buf_handle);
 
 			/* free rx_buffer if process_spi_rx returns an error
 			 * In success case it will be freed later */
 			if (ret != ESP_OK) {
-				spi_buffer_free((void *)spi_trans->rx_buffer);
+				spi_buffer_free((void *)trans->rx_buffer);
 			}
 		}
 
@@ -628,6 +759,24 @@ static interface_handle_t * esp_spi_init(void)
 	return &if_handle_g;
 }
 
+/* Header could be built in front of payload, if caller left enough DMA capable
+ * headroom. Whether buffer is long enough for SPI DMA is only known once
+ * transaction length is, see spi_tx_buffer_fit() */
+static bool can_tx_in_place(interface_buffer_handle_t *buf_handle)
+{
+	uint8_t *header = buf_handle->payload - sizeof(struct esp_payload_header);
+
+	if (buf_handle->headroom < sizeof(struct esp_payload_header))
+		return false;
+
+	/* Transport needs to own buffer until transaction completes */
+	if (!buf_handle->free_buf_handle || !buf_handle->priv_buffer_handle)
+		return false;
+
+	return IS_SPI_DMA_ALIGNED((uint32_t)header) &&
+		esp_ptr_dma_capable(header);
+}
+
 static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle_t *buf_handle)
 {
 	esp_err_t ret = ESP_OK;
@@ -664,9 +813,29 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 
 	tx_buf_handle.if_type = buf_handle->if_type;
 	tx_buf_handle.if_num = buf_handle->if_num;
-	tx_buf_handle.payload_len = total_len;
+	tx_buf_handle.payload_len = buf_handle->payload_len + sizeof(struct esp_payload_header);
+
+	if (can_tx_in_place(buf_handle)) {
+		/* Transmit from caller buffer. Ownership moves to transport and
+		 * buffer is released once SPI transaction completes */
+		tx_buf_handle.payload = buf_handle->payload - sizeof(struct esp_payload_header);
+		tx_buf_handle.priv_buffer_handle = buf_handle->priv_buffer_handle;
+		tx_buf_handle.free_buf_handle = buf_handle->free_buf_handle;
+		tx_buf_handle.tailroom = buf_handle->tailroom;
+		buf_handle->priv_buffer_handle = NULL;
+	} else {
+		tx_buf_handle.payload = spi_buffer_alloc(MEMSET_NOT_REQUIRED);
+		if (!tx_buf_handle.payload) {
+			ESP_LOGE(TAG, "Failed to allocate tx buffer\n");
+			return ESP_FAIL;
+		}
+		tx_buf_handle.priv_buffer_handle = tx_buf_handle.payload;
+		tx_buf_handle.free_buf_handle = esp_spi_tx_done;
 
-	tx_buf_handle.payload = spi_buffer_alloc(MEMSET_NOT_REQUIRED);
+		/* copy the data from caller */
+		memcpy(tx_buf_handle.payload + sizeof(struct esp_payload_header),
+				buf_handle->payload, buf_handle->payload_len);
+	}
 
 	header = (struct esp_payload_header *) tx_buf_handle.payload;
 
@@ -681,10 +850,6 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 	header->seq_num = htole16(buf_handle->seq_num);
 	header->flags = buf_handle->flag;
 
-	/* copy the data from caller */
-	memcpy(tx_buf_handle.payload + offset, buf_handle->payload, buf_handle->payload_len);
-
-
 #if CONFIG_ESP_SPI_CHECKSUM
 	header->checksum = htole16(compute_checksum(tx_buf_handle.payload,
 				offset+buf_handle->payload_len));
@@ -697,8 +862,10 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 	else
 		ret = xQueueSend(spi_tx_queue[PRIO_Q_OTHERS], &tx_buf_handle, portMAX_DELAY);
 
-	if (ret != pdTRUE)
+	if (ret != pdTRUE) {
+		spi_tx_buffer_release(&tx_buf_handle);
 		return ESP_FAIL;
+	}
 
 	/* indicate waiting data on ready pin */
 	set_dataready_gpio();
@@ -711,6 +878,11 @@ static void IRAM_ATTR esp_spi_read_done(void *handle)
 	spi_buffer_free(handle);
 }
 
+static void IRAM_ATTR esp_spi_tx_done(void *handle)
+{
+	spi_buffer_free(handle);
+}
+
 static int esp_spi_read(interface_handle_t *if_handle, interface_buffer_handle_t *buf_handle)
 {
 	esp_err_t ret = ESP_OK;
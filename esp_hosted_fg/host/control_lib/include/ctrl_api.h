@@ -156,6 +156,7 @@ typedef enum {
 		CTRL_MSG_ID__Event_StationDisconnectFromAP,
 	CTRL_EVENT_STATION_DISCONNECT_FROM_ESP_SOFTAP =
 		CTRL_MSG_ID__Event_StationDisconnectFromESPSoftAP,
+	CTRL_EVENT_SCAN_RESULT     = CTRL_MSG_ID__Event_ScanResult,
 	/*
 	 * Add new control path command notification before Event_Max
 	 * and update Event_Max
@@ -207,6 +208,15 @@ typedef enum {
 	WIFI_VND_IE_ID_1 = CTRL__VENDOR_IEID__ID_1,
 } wifi_vendor_ie_id_e;
 
+typedef enum {
+	/* Scan all channels, respond once done */
+	WIFI_SCAN_MODE_BLOCKING = 0,
+	/* Respond right away, results follow as CTRL_EVENT_SCAN_RESULT */
+	WIFI_SCAN_MODE_STREAMING = 1,
+	/* Respond from ESP BSS cache, if not older than max_age_sec */
+	WIFI_SCAN_MODE_CACHED = 2,
+} wifi_scan_mode_e;
+
 
 
 typedef struct {
@@ -276,6 +286,13 @@ typedef struct {
 	int count;
 	/* dynamic size */
 	wifi_scanlist_t *out_list;
+	/* Req */
+	wifi_scan_mode_e scan_mode;
+	/* cached scan only, 0 for ESP default */
+	uint32_t max_age_sec;
+	/* event */
+	int channel;
+	bool scan_done;
 } wifi_ap_scan_list_t;
 
 typedef struct {
@@ -472,6 +489,17 @@ ctrl_cmd_t * wifi_get_power_save_mode(ctrl_cmd_t req);
 /* Get list of available neighboring APs of ESP32 */
 ctrl_cmd_t * wifi_ap_scan_list(ctrl_cmd_t req);
 
+/* Start scan of neighboring APs on ESP32, without waiting for it to finish.
+ * Scanned APs are reported per channel with CTRL_EVENT_SCAN_RESULT,
+ * last event has `u.wifi_ap_scan.scan_done` set.
+ * Register event callback before calling this */
+ctrl_cmd_t * wifi_ap_scan_list_stream(ctrl_cmd_t req);
+
+/* Get list of neighboring APs from ESP32 scan cache.
+ * Set `u.wifi_ap_scan.max_age_sec` for oldest acceptable result.
+ * ESP32 scans afresh, if cache is older */
+ctrl_cmd_t * wifi_ap_scan_list_cached(ctrl_cmd_t req);
+
 /* Get the AP config to which ESP32 station is connected */
 ctrl_cmd_t * wifi_get_ap_config(ctrl_cmd_t req);
 
@@ -78,6 +78,20 @@ ctrl_cmd_t * wifi_ap_scan_list(ctrl_cmd_t req)
 	CTRL_DECODE_RESP_IF_NOT_ASYNC();
 }
 
+ctrl_cmd_t * wifi_ap_scan_list_stream(ctrl_cmd_t req)
+{
+	req.u.wifi_ap_scan.scan_mode = WIFI_SCAN_MODE_STREAMING;
+	CTRL_SEND_REQ(CTRL_REQ_GET_AP_SCAN_LIST);
+	CTRL_DECODE_RESP_IF_NOT_ASYNC();
+}
+
+ctrl_cmd_t * wifi_ap_scan_list_cached(ctrl_cmd_t req)
+{
+	req.u.wifi_ap_scan.scan_mode = WIFI_SCAN_MODE_CACHED;
+	CTRL_SEND_REQ(CTRL_REQ_GET_AP_SCAN_LIST);
+	CTRL_DECODE_RESP_IF_NOT_ASYNC();
+}
+
 ctrl_cmd_t * wifi_get_ap_config(ctrl_cmd_t req)
 {
 	CTRL_SEND_REQ(CTRL_REQ_GET_AP_CONFIG);
@@ -207,6 +207,38 @@ static int convert_mac_to_bytes(uint8_t *out, size_t out_size, char *s)
 
 
 
+/* Copy scanned APs into list allocated for app.
+ * Returns NULL, if no APs or on allocation failure */
+static wifi_scanlist_t *ctrl_app_copy_scan_list(ScanResult **entries, int count)
+{
+	wifi_scanlist_t *list = NULL;
+	int i = 0;
+
+	if (!count || !entries)
+		return NULL;
+
+	list = (wifi_scanlist_t *)hosted_calloc(count, sizeof(wifi_scanlist_t));
+	if (!list)
+		return NULL;
+
+	for (i=0; i<count; i++) {
+
+		if (entries[i]->ssid.len)
+			memcpy(list[i].ssid, (char *)entries[i]->ssid.data,
+				min(entries[i]->ssid.len, SSID_LENGTH));
+
+		if (entries[i]->bssid.len)
+			memcpy(list[i].bssid, (char *)entries[i]->bssid.data,
+				min(entries[i]->bssid.len, BSSID_LENGTH-1));
+
+		list[i].channel = entries[i]->chnl;
+		list[i].rssi = entries[i]->rssi;
+		list[i].encryption_mode = entries[i]->sec_prot;
+	}
+
+	return list;
+}
+
 /* This will copy control event from `CtrlMsg` into
  * application structure `ctrl_cmd_t`
  * This function is called after
@@ -255,6 +287,26 @@ static int ctrl_app_parse_event(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_ntfy)
 					app_ntfy->u.e_sta_disconnected.mac);*/
 			}
 			break;
+		} case CTRL_EVENT_SCAN_RESULT: {
+			CtrlMsgEventScanResult *ep = ctrl_msg->event_scan_result;
+			wifi_ap_scan_list_t *ap = &app_ntfy->u.wifi_ap_scan;
+
+			CHECK_CTRL_MSG_NON_NULL(event_scan_result);
+			app_ntfy->resp_event_status = ep->resp;
+
+			ap->scan_mode = WIFI_SCAN_MODE_STREAMING;
+			ap->channel = ep->chnl;
+			ap->scan_done = ep->scan_done;
+			ap->count = min(ep->count, ep->n_entries);
+			if (ap->count) {
+				ap->out_list = ctrl_app_copy_scan_list(ep->entries, ap->count);
+				CHECK_CTRL_MSG_NON_NULL_VAL(ap->out_list, "Malloc Failed");
+
+				/* Note allocation, to be freed later by app */
+				app_ntfy->free_buffer_func = hosted_free;
+				app_ntfy->free_buffer_handle = ap->out_list;
+			}
+			break;
 		} default: {
 			printf("Invalid/unsupported event[%u] received\n",ctrl_msg->msg_id);
 			goto fail_parse_ctrl_msg;
@@ -326,30 +378,12 @@ static int ctrl_app_parse_resp(CtrlMsg *ctrl_msg, ctrl_cmd_t *app_resp)
 			CHECK_CTRL_MSG_NON_NULL(resp_scan_ap_list);
 			CHECK_CTRL_MSG_FAILED(resp_scan_ap_list);
 
-			ap->count = rp->count;
-			if (rp->count) {
-
-				CHECK_CTRL_MSG_NON_NULL_VAL(ap->count,"No APs available");
-				list = (wifi_scanlist_t *)hosted_calloc(ap->count,
-						sizeof(wifi_scanlist_t));
+			ap->count = min(rp->count, rp->n_entries);
+			if (ap->count) {
+				list = ctrl_app_copy_scan_list(rp->entries, ap->count);
 				CHECK_CTRL_MSG_NON_NULL_VAL(list, "Malloc Failed");
 			}
 
-			for (i=0; i<rp->count; i++) {
-
-				if (rp->entries[i]->ssid.len)
-					memcpy(list[i].ssid, (char *)rp->entries[i]->ssid.data,
-						rp->entries[i]->ssid.len);
-
-				if (rp->entries[i]->bssid.len)
-					memcpy(list[i].bssid, (char *)rp->entries[i]->bssid.data,
-						rp->entries[i]->bssid.len);
-
-				list[i].channel = rp->entries[i]->chnl;
-				list[i].rssi = rp->entries[i]->rssi;
-				list[i].encryption_mode = rp->entries[i]->sec_prot;
-			}
-
 			ap->out_list = list;
 			/* Note allocation, to be freed later by app */
 			app_resp->free_buffer_func = hosted_free;
@@ -1150,7 +1184,22 @@ int ctrl_app_send_req(ctrl_cmd_t *app_req)
 			/* Intentional fallthrough & empty */
 			break;
 		} case CTRL_REQ_GET_AP_SCAN_LIST: {
-			if (app_req->cmd_timeout_sec < DEFAULT_CTRL_RESP_AP_SCAN_TIMEOUT)
+			wifi_ap_scan_list_t *p = &app_req->u.wifi_ap_scan;
+			CTRL_ALLOC_ASSIGN(CtrlMsgReqScanResult, req_scan_ap_list);
+
+			if ((p->scan_mode < WIFI_SCAN_MODE_BLOCKING) ||
+			    (p->scan_mode > WIFI_SCAN_MODE_CACHED)) {
+				command_log("Invalid scan mode\n");
+				failure_status = CTRL_ERR_INCORRECT_ARG;
+				goto fail_req;
+			}
+			ctrl_msg__req__scan_result__init(req_payload);
+			req_payload->scan_mode = p->scan_mode;
+			req_payload->max_age_sec = p->max_age_sec;
+
+			/* Streaming scan responds before scanning */
+			if ((p->scan_mode != WIFI_SCAN_MODE_STREAMING) &&
+			    (app_req->cmd_timeout_sec < DEFAULT_CTRL_RESP_AP_SCAN_TIMEOUT))
 				app_req->cmd_timeout_sec = DEFAULT_CTRL_RESP_AP_SCAN_TIMEOUT;
 			break;
 		} case CTRL_REQ_GET_MAC_ADDR: {
@@ -123,6 +123,20 @@ static int ctrl_app_event_callback(ctrl_cmd_t * app_event)
 					get_timestamp(ts, MIN_TIMESTAMP_STR_SIZE), p);
 			}
 			break;
+		} case CTRL_EVENT_SCAN_RESULT: {
+			wifi_ap_scan_list_t *w_scan_p = &app_event->u.wifi_ap_scan;
+			wifi_scanlist_t *list = w_scan_p->out_list;
+			int i = 0;
+
+			printf("%s App EVENT: Scan result: channel[%d] APs[%d]%s\n",
+				get_timestamp(ts, MIN_TIMESTAMP_STR_SIZE), w_scan_p->channel,
+				w_scan_p->count, w_scan_p->scan_done ? " scan done" : "");
+			for (i=0; list && i<w_scan_p->count; i++) {
+				printf("%d) ssid \"%s\" bssid \"%s\" rssi \"%d\" auth mode \"%d\" \n",
+						i, list[i].ssid, list[i].bssid, list[i].rssi,
+						list[i].encryption_mode);
+			}
+			break;
 		} default: {
 			printf("%s Invalid event[%u] to parse\n",
 				get_timestamp(ts, MIN_TIMESTAMP_STR_SIZE), app_event->msg_id);
@@ -414,6 +428,7 @@ int register_event_callbacks(void)
 		{ CTRL_EVENT_HEARTBEAT,                          ctrl_app_event_callback },
 		{ CTRL_EVENT_STATION_DISCONNECT_FROM_AP,         ctrl_app_event_callback },
 		{ CTRL_EVENT_STATION_DISCONNECT_FROM_ESP_SOFTAP, ctrl_app_event_callback },
+		{ CTRL_EVENT_SCAN_RESULT,                        ctrl_app_event_callback },
 	};
 
 	for (evt=0; evt<sizeof(events)/sizeof(event_callback_table_t); evt++) {
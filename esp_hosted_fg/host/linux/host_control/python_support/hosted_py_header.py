@@ -168,7 +168,8 @@ class CTRL_MSGID(Enum):
 	CTRL_EVENT_HEARTBEAT = 302
 	CTRL_EVENT_STATION_DISCONNECT_FROM_AP = 303
 	CTRL_EVENT_STATION_DISCONNECT_FROM_ESP_SOFTAP = 304
-	CTRL_EVENT_MAX =  305
+	CTRL_EVENT_SCAN_RESULT = 305
+	CTRL_EVENT_MAX =  306
 
 
 class STA_CONFIG(Structure):
@@ -210,7 +211,11 @@ class WIFI_SCAN_LIST(Structure):
 
 class WIFI_AP_SCAN_LIST(Structure):
 	_fields_ = [("count", c_int),
-				("out_list", POINTER(WIFI_SCAN_LIST))]
+				("out_list", POINTER(WIFI_SCAN_LIST)),
+				("scan_mode", c_int),
+				("max_age_sec", c_uint),
+				("channel", c_int),
+				("scan_done", c_bool)]
 
 
 class WIFI_STATIONS_LIST(Structure):
@@ -35,6 +35,8 @@
 #define ESP_LINK_UP             1
 
 #define ESP_MAX_INTERFACE       2
+/* Interface types carrying network frames, ESP_STA_IF and ESP_AP_IF */
+#define ESP_NW_IF_TYPES         (ESP_AP_IF + 1)
 
 #define ESP_PAYLOAD_HEADER      8
 struct esp_private;
@@ -58,6 +60,9 @@ struct esp_adapter {
 
 	/* Private for each interface */
 	struct esp_private      *priv[ESP_MAX_INTERFACE];
+	/* Rx demux, indexed by if_type and if_num of payload header.
+	 * Updated under RCU on interface add/remove */
+	struct esp_private __rcu *rx_priv[ESP_NW_IF_TYPES][ESP_MAX_INTERFACE];
 	struct hci_dev          *hcidev;
 
 	struct workqueue_struct *if_rx_workqueue;
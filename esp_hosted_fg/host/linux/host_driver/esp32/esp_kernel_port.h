@@ -85,6 +85,13 @@ static inline void *skb_put_data(struct sk_buff *skb, const void *data,
 }
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0))
+static inline void skb_free_frag(void *addr)
+{
+	put_page(virt_to_head_page(addr));
+}
+#endif
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0))
     #define NDO_TX_TIMEOUT_PROTOTYPE() \
         void esp_tx_timeout(struct net_device *ndev)
@@ -178,27 +178,16 @@ u8 esp_is_bt_supported_over_sdio(u32 cap)
 	return (cap & ESP_BT_SDIO_SUPPORT);
 }
 
+/* Caller holds rcu_read_lock() for as long as it uses returned priv */
 static struct esp_private * get_priv_from_payload_header(struct esp_payload_header *header)
 {
-	struct esp_private *priv = NULL;
-	u8 i = 0;
-
 	if (!header)
 		return NULL;
 
-	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
-		priv = adapter.priv[i];
-
-		if (!priv)
-			continue;
-
-		if (priv->if_type == header->if_type &&
-				priv->if_num == header->if_num) {
-			return priv;
-		}
-	}
+	if (header->if_type >= ESP_NW_IF_TYPES || header->if_num >= ESP_MAX_INTERFACE)
+		return NULL;
 
-	return NULL;
+	return rcu_dereference(adapter.rx_priv[header->if_type][header->if_num]);
 }
 
 void esp_process_new_packet_intr(struct esp_adapter *adapter)
@@ -428,10 +417,13 @@ static void process_rx_packet(struct sk_buff *skb)
 		/* chop off the header from skb */
 		skb_pull(skb, offset);
 
+		rcu_read_lock();
+
 		/* retrieve priv based on payload header contents */
 		priv = get_priv_from_payload_header(payload_header);
 
 		if (!priv) {
+			rcu_read_unlock();
 			printk (KERN_ERR "%s: empty priv\n", __func__);
 			dev_kfree_skb_any(skb);
 			return;
@@ -441,11 +433,13 @@ static void process_rx_packet(struct sk_buff *skb)
 		skb->protocol = eth_type_trans(skb, priv->ndev);
 		skb->ip_summed = CHECKSUM_NONE;
 
+		priv->stats.rx_bytes += skb->len;
+		priv->stats.rx_packets++;
+
 		/* Forward skb to kernel */
 		netif_rx_ni(skb);
 
-		priv->stats.rx_bytes += skb->len;
-		priv->stats.rx_packets++;
+		rcu_read_unlock();
 	} else if (payload_header->if_type == ESP_HCI_IF) {
 		if (hdev) {
 			/* chop off the header from skb */
@@ -662,6 +656,8 @@ static int esp_add_interface(struct esp_adapter *adapter, u8 if_type, u8 if_num,
 		goto error_exit;
 	}
 
+	rcu_assign_pointer(adapter->rx_priv[if_type][if_num], priv);
+
 	return ret;
 
 error_exit:
@@ -671,6 +667,17 @@ error_exit:
 
 static void esp_remove_network_interfaces(struct esp_adapter *adapter)
 {
+	u8 i = 0;
+
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		if (adapter->priv[i] && adapter->priv[i]->if_type < ESP_NW_IF_TYPES)
+			RCU_INIT_POINTER(adapter->rx_priv[adapter->priv[i]->if_type]
+					[adapter->priv[i]->if_num], NULL);
+	}
+
+	/* Rx path may still hold priv, which goes away with netdev */
+	synchronize_rcu();
+
 	if (adapter->priv[0]->ndev) {
 		netif_stop_queue(adapter->priv[0]->ndev);
 		unregister_netdev(adapter->priv[0]->ndev);
@@ -213,17 +213,12 @@ int process_init_event(u8 *evt_buf, u8 len)
 }
 
 
-static int process_rx_buf(struct sk_buff *skb)
+/* Length of valid packet in rx buffer, negative error otherwise */
+static int validate_rx_buf(struct esp_payload_header *header)
 {
-	struct esp_payload_header *header;
 	u16 len = 0;
 	u16 offset = 0;
 
-	if (!skb)
-		return -EINVAL;
-
-	header = (struct esp_payload_header *) skb->data;
-
 	if (header->if_type >= ESP_MAX_IF) {
 		return -EINVAL;
 	}
@@ -246,6 +241,23 @@ static int process_rx_buf(struct sk_buff *skb)
 		return -EINVAL;
 	}
 
+	return len;
+}
+
+static int process_rx_buf(struct sk_buff *skb)
+{
+	struct esp_payload_header *header;
+	int len = 0;
+
+	if (!skb)
+		return -EINVAL;
+
+	header = (struct esp_payload_header *) skb->data;
+
+	len = validate_rx_buf(header);
+	if (len < 0)
+		return len;
+
 	/* Trim SKB to actual size */
 	skb_trim(skb, len);
 
@@ -267,12 +279,143 @@ static int process_rx_buf(struct sk_buff *skb)
 	return 0;
 }
 
+/* Rx buffers are only written by SPI controller and parsed within
+ * SPI_BUF_SIZE, so recycled ones need no zeroing */
+static u8 *spi_rx_buf_get(void)
+{
+	if (spi_context.rx_pool_count) {
+		spi_context.pool_stats.hits++;
+		return spi_context.rx_pool[--spi_context.rx_pool_count];
+	}
+
+	spi_context.pool_stats.misses++;
+
+	return netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+}
+
+static void spi_rx_buf_put(u8 *buf)
+{
+	if (spi_context.rx_pool_count < SPI_RX_POOL_SIZE) {
+		spi_context.rx_pool[spi_context.rx_pool_count++] = buf;
+		spi_context.pool_stats.recycled++;
+	} else {
+		skb_free_frag(buf);
+	}
+}
+
+/* skb takes over the buffer, pool refills on later miss */
+static struct sk_buff *spi_rx_buf_to_skb(u8 *buf)
+{
+	struct sk_buff *skb = build_skb(buf, SPI_RX_BUF_TRUESIZE);
+
+	if (!skb)
+		return NULL;
+
+	skb_reserve(skb, SPI_RX_BUF_HEADROOM);
+	skb_put(skb, SPI_BUF_SIZE);
+	spi_context.pool_stats.skb_built++;
+
+	return skb;
+}
+
+static void spi_rx_pool_fill(void)
+{
+	u8 *buf = NULL;
+
+	while (spi_context.rx_pool_count < SPI_RX_POOL_SIZE) {
+		buf = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+		if (!buf)
+			break;
+
+		spi_context.rx_pool[spi_context.rx_pool_count++] = buf;
+	}
+}
+
+static void spi_rx_pool_drain(void)
+{
+	struct esp_spi_pool_stats *stats = &spi_context.pool_stats;
+
+	printk(KERN_INFO "%s: SPI rx pool: hits[%llu] misses[%llu] recycled[%llu] skb built[%llu]\n",
+			__func__, stats->hits, stats->misses, stats->recycled, stats->skb_built);
+
+	while (spi_context.rx_pool_count)
+		skb_free_frag(spi_context.rx_pool[--spi_context.rx_pool_count]);
+}
+
+/* Next frame in priority order, which fits this transaction. Longer one
+ * waits until ESP announces room for it */
+static struct sk_buff *spi_tx_dequeue(u16 max_len)
+{
+	struct sk_buff *skb = NULL;
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb = skb_peek(&spi_context.tx_q[prio_q_idx]);
+		if (skb && skb->len <= max_len)
+			return skb_dequeue(&spi_context.tx_q[prio_q_idx]);
+	}
+
+	return NULL;
+}
+
+/* Room next frame needs, in SPI_NEXT_TX_LEN_UNIT */
+static u8 spi_tx_len_hint(void)
+{
+	struct sk_buff *skb = NULL;
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		skb = skb_peek(&spi_context.tx_q[prio_q_idx]);
+		if (skb)
+			return DIV_ROUND_UP(skb->len, SPI_NEXT_TX_LEN_UNIT);
+	}
+
+	return 0;
+}
+
+/* Let ESP size its transactions to what host clocks, see SPI_HOST_VAR_LEN */
+static void spi_tx_announce(u8 *tx_buf, bool csum)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) tx_buf;
+	u8 hint = spi_tx_len_hint();
+
+	/* Checksum of real frame was computed with flag clear and zero hint */
+	if (csum)
+		header->checksum = cpu_to_le16(le16_to_cpu(header->checksum) +
+				SPI_HOST_VAR_LEN + hint);
+
+	header->flags |= SPI_HOST_VAR_LEN;
+	header->reserved2 = hint;
+}
+
+/* ESP announces length of its next transaction in each frame, dummy ones
+ * included. If frame is garbled, clock full buffer and keep host frame back,
+ * as it could be longer than ESP expects */
+static void spi_update_trans_len(struct esp_payload_header *header)
+{
+	bool dummy = (header->if_type == 0xF) && !header->len;
+
+	if (!dummy && validate_rx_buf(header) < 0) {
+		spi_context.trans_len = SPI_BUF_SIZE;
+		spi_context.tx_len_limit = 0;
+		return;
+	}
+
+	if (header->reserved2)
+		spi_context.trans_len = min_t(u16, header->reserved2 * SPI_NEXT_TX_LEN_UNIT,
+				SPI_BUF_SIZE);
+	else
+		spi_context.trans_len = SPI_BUF_SIZE;
+
+	spi_context.tx_len_limit = spi_context.trans_len;
+}
+
 static void esp_spi_work(struct work_struct *work)
 {
 	struct spi_transfer trans;
 	struct sk_buff *tx_skb = NULL, *rx_skb = NULL;
-	u8 *rx_buf;
-	int ret = 0;
+	u8 *rx_buf = NULL, *rx_data = NULL;
+	int ret = 0, rx_len = 0;
 	volatile int trans_ready, rx_pending;
 
 	mutex_lock(&spi_lock);
@@ -282,11 +425,7 @@ static void esp_spi_work(struct work_struct *work)
 
 	if (trans_ready) {
 		if (data_path) {
-			tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_SERIAL]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_BT]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_OTHERS]);
+			tx_skb = spi_tx_dequeue(spi_context.tx_len_limit);
 			if (tx_skb) {
 				if (atomic_read(&tx_pending))
 					atomic_dec(&tx_pending);
@@ -300,6 +439,10 @@ static void esp_spi_work(struct work_struct *work)
 			}
 		}
 
+		/* Frame that did not fit still needs transaction, to ask for room */
+		if (data_path && !tx_skb && spi_tx_len_hint())
+			rx_pending = 1;
+
 		if (rx_pending || tx_skb) {
 			memset(&trans, 0, sizeof(trans));
 
@@ -307,29 +450,34 @@ static void esp_spi_work(struct work_struct *work)
 			 * 	Tx_buf: Check if tx_q has valid buffer for transmission,
 			 * 		else keep it blank
 			 *
-			 * 	Rx_buf: Allocate memory for incoming data. This will be freed
-			 *		immediately if received buffer is invalid.
-			 *		If it is a valid buffer, upper layer will free it.
+			 * 	Rx_buf: Taken from rx_pool. Goes back to pool if received
+			 *		data is not valid, else skb is built around it and
+			 *		upper layer will free it.
 			 * */
 
 			/* Configure TX buffer if available */
 
 			if (tx_skb) {
 				trans.tx_buf = tx_skb->data;
+				spi_tx_announce(tx_skb->data, spi_context.adapter->capabilities &
+						ESP_CHECKSUM_ENABLED);
 			} else {
-				tx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-				trans.tx_buf = skb_put(tx_skb, SPI_BUF_SIZE);
-				memset((void*)trans.tx_buf, 0, SPI_BUF_SIZE);
+				trans.tx_buf = spi_context.tx_dummy_buf;
+				spi_tx_announce(spi_context.tx_dummy_buf, false);
 			}
 
 			/* Configure RX buffer */
-			rx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-			rx_buf = skb_put(rx_skb, SPI_BUF_SIZE);
-
-			memset(rx_buf, 0, SPI_BUF_SIZE);
+			rx_buf = spi_rx_buf_get();
+			if (!rx_buf) {
+				if (tx_skb)
+					dev_kfree_skb(tx_skb);
+				mutex_unlock(&spi_lock);
+				return;
+			}
+			rx_data = rx_buf + SPI_RX_BUF_HEADROOM;
 
-			trans.rx_buf = rx_buf;
-			trans.len = SPI_BUF_SIZE;
+			trans.rx_buf = rx_data;
+			trans.len = spi_context.trans_len;
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
 			if (hardware_type == ESP_PRIV_FIRMWARE_CHIP_ESP32) {
@@ -340,14 +488,22 @@ static void esp_spi_work(struct work_struct *work)
 			ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
 			if (ret) {
 				printk(KERN_ERR "SPI Transaction failed: %d", ret);
-				dev_kfree_skb(rx_skb);
-				dev_kfree_skb(tx_skb);
+				spi_rx_buf_put(rx_buf);
+				if (tx_skb)
+					dev_kfree_skb(tx_skb);
 			} else {
+				spi_update_trans_len((struct esp_payload_header *) rx_data);
+
+				/* skb only for valid data, dummy or invalid Rx recycles buffer.
+				 * Bytes past transaction length are stale */
+				rx_len = validate_rx_buf((struct esp_payload_header *) rx_data);
+				if (data_path && rx_len >= 0 && rx_len <= trans.len)
+					rx_skb = spi_rx_buf_to_skb(rx_buf);
 
-				/* Free rx_skb if received data is not valid */
-				if (process_rx_buf(rx_skb)) {
+				if (!rx_skb)
+					spi_rx_buf_put(rx_buf);
+				else if (process_rx_buf(rx_skb))
 					dev_kfree_skb(rx_skb);
-				}
 
 				if (tx_skb)
 					dev_kfree_skb(tx_skb);
@@ -481,6 +637,19 @@ static int spi_init(void)
 		skb_queue_head_init(&spi_context.rx_q[prio_q_idx]);
 	}
 
+	spi_context.tx_dummy_buf = kzalloc(SPI_BUF_SIZE, GFP_KERNEL);
+	if (!spi_context.tx_dummy_buf) {
+		printk(KERN_ERR "Failed to allocate SPI dummy buffer\n");
+		spi_exit();
+		return -ENOMEM;
+	}
+
+	/* Until ESP announces otherwise */
+	spi_context.trans_len = SPI_BUF_SIZE;
+	spi_context.tx_len_limit = SPI_BUF_SIZE;
+
+	/* Pool misses later, if not filled up here */
+	spi_rx_pool_fill();
 
 	status = spi_dev_init(SPI_INITIAL_CLK_MHZ);
 	if (status) {
@@ -530,6 +699,11 @@ static void spi_exit(void)
 		spi_context.spi_workqueue = NULL;
 	}
 
+	/* spi work, user of rx_pool, is gone now */
+	spi_rx_pool_drain();
+	kfree(spi_context.tx_dummy_buf);
+	spi_context.tx_dummy_buf = NULL;
+
 	esp_serial_cleanup();
 	esp_remove_card(spi_context.adapter);
 
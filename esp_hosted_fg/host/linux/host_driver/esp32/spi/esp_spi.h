@@ -25,6 +25,20 @@
 #define SPI_DATA_READY_IRQ      gpio_to_irq(SPI_DATA_READY_PIN)
 #define SPI_BUF_SIZE            1600
 
+/* Rx buffers recycled across transactions. Each has room for skb to be
+ * built around it, once it carries valid data */
+#define SPI_RX_POOL_SIZE        8
+#define SPI_RX_BUF_HEADROOM     NET_SKB_PAD
+#define SPI_RX_BUF_TRUESIZE     (SKB_DATA_ALIGN(SPI_RX_BUF_HEADROOM + SPI_BUF_SIZE) + \
+				 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+struct esp_spi_pool_stats {
+	u64                         hits;       /* Rx buffer taken from pool */
+	u64                         misses;     /* Pool empty, Rx buffer allocated */
+	u64                         recycled;   /* Dummy or invalid Rx, buffer back to pool */
+	u64                         skb_built;  /* Valid Rx, buffer handed up as skb */
+};
+
 struct esp_spi_context {
 	struct esp_adapter          *adapter;
 	struct spi_device           *esp_spi_dev;
@@ -32,6 +46,16 @@ struct esp_spi_context {
 	struct sk_buff_head         rx_q[MAX_PRIORITY_QUEUES];
 	struct workqueue_struct     *spi_workqueue;
 	struct work_struct          spi_work;
+	/* Used under spi_lock */
+	void                        *rx_pool[SPI_RX_POOL_SIZE];
+	uint8_t                     rx_pool_count;
+	/* Zeroes, clocked out when there is nothing to send */
+	u8                          *tx_dummy_buf;
+	/* Length ESP announced for next transaction, and longest frame
+	 * that may go out in it. Used under spi_lock */
+	u16                         trans_len;
+	u16                         tx_len_limit;
+	struct esp_spi_pool_stats   pool_stats;
 };
 
 enum {
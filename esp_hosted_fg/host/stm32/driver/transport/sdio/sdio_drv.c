@@ -48,6 +48,8 @@ static stm_ret_t sdio_rx_esp32(void);
 static stm_ret_t generate_slave_intr(uint8_t intr_no);
 
 static struct esp_private * esp_priv[MAX_NETWORK_INTERFACES];
+/* Rx demux, indexed by if_type and if_num of received frame */
+static struct esp_private *rx_priv[ESP_AP_IF + 1][MAX_NETWORK_INTERFACES];
 static struct esp_private * get_priv(uint8_t if_type, uint8_t if_num);
 
 static struct netdev_ops esp_net_ops = {
@@ -99,14 +101,10 @@ static void (*sdio_drv_evt_handler_fp) (uint8_t);
  */
 static struct esp_private * get_priv(uint8_t if_type, uint8_t if_num)
 {
-	for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
-		if((esp_priv[i]) &&
-		   (esp_priv[i]->if_type == if_type) &&
-		   (esp_priv[i]->if_num == if_num))
-			return esp_priv[i];
-	}
+	if ((if_type > ESP_AP_IF) || (if_num >= MAX_NETWORK_INTERFACES))
+		return NULL;
 
-	return NULL;
+	return rx_priv[if_type][if_num];
 }
 
 
@@ -147,6 +145,7 @@ static int init_netdev(void)
 		}
 
 		esp_priv[i] = priv;
+		rx_priv[priv->if_type][priv->if_num] = priv;
 	}
 
 	return STM_OK;
@@ -161,6 +160,7 @@ static void deinit_netdev(void)
 {
 	for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
 		if (esp_priv[i]) {
+			rx_priv[esp_priv[i]->if_type][esp_priv[i]->if_num] = NULL;
 			if (esp_priv[i]->netdev) {
 				netdev_unregister(esp_priv[i]->netdev);
 				netdev_free(esp_priv[i]->netdev);
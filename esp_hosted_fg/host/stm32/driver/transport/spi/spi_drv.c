@@ -56,6 +56,8 @@ static stm_ret_t (*spi_trans_func[])(uint8_t * txbuff) = {
 };
 
 static struct esp_private *esp_priv[MAX_NETWORK_INTERFACES];
+/* Rx demux, indexed by if_type and if_num of received frame */
+static struct esp_private *rx_priv[ESP_AP_IF + 1][MAX_NETWORK_INTERFACES];
 static uint8_t hardware_type = HARDWARE_TYPE_INVALID;
 
 static struct netdev_ops esp_net_ops = {
@@ -95,16 +97,10 @@ static void deinit_netdev(void);
   */
 static struct esp_private * get_priv(uint8_t if_type, uint8_t if_num)
 {
-	int i = 0;
-
-	for (i = 0; i < MAX_NETWORK_INTERFACES; i++) {
-		if((esp_priv[i]) &&
-			(esp_priv[i]->if_type == if_type) &&
-			(esp_priv[i]->if_num == if_num))
-			return esp_priv[i];
-	}
+	if ((if_type > ESP_AP_IF) || (if_num >= MAX_NETWORK_INTERFACES))
+		return NULL;
 
-	return NULL;
+	return rx_priv[if_type][if_num];
 }
 
 /**
@@ -147,6 +143,7 @@ static int init_netdev(void)
 		if_type = ESP_AP_IF;
 
 		esp_priv[i] = priv;
+		rx_priv[priv->if_type][priv->if_num] = priv;
 	}
 
 	return STM_OK;
@@ -161,6 +158,7 @@ static void deinit_netdev(void)
 {
 	for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
 		if (esp_priv[i]) {
+			rx_priv[esp_priv[i]->if_type][esp_priv[i]->if_num] = NULL;
 			if (esp_priv[i]->netdev) {
 				netdev_unregister(esp_priv[i]->netdev);
 				netdev_free(esp_priv[i]->netdev);
@@ -200,6 +200,116 @@ uint8_t is_wakeup_needed(interface_buffer_handle_t *buf_handle)
 }
 #endif
 
+#if CONFIG_ESP_WLAN_RX_CSUM_VERIFY || CONFIG_ESP_WLAN_TX_CSUM_FILL
+/* One's complement sum of big endian 16 bit words */
+static uint32_t csum_add(uint32_t sum, const uint8_t *data, uint16_t len)
+{
+	while (len > 1) {
+		sum += (data[0] << 8) | data[1];
+		data += 2;
+		len -= 2;
+	}
+
+	if (len)
+		sum += data[0] << 8;
+
+	return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return sum;
+}
+#endif
+
+#if CONFIG_ESP_WLAN_TX_CSUM_FILL
+/* Store checksum of frame from csum_start onwards at csum_start + csum_offset.
+ * Host seeded that field with pseudo header sum, see CSUM_FILL */
+static void wlan_tx_csum_fill(uint8_t *frame, uint16_t len,
+		uint8_t csum_start, uint8_t csum_offset)
+{
+	uint8_t *field = frame + csum_start + csum_offset;
+	uint16_t csum = 0;
+
+	if (csum_start + csum_offset + 2 > len)
+		return;
+
+	csum = ~csum_fold(csum_add(0, frame + csum_start, len - csum_start));
+
+	/* Zero means no checksum for UDP, send all ones instead */
+	if (!csum)
+		csum = 0xFFFF;
+
+	field[0] = csum >> 8;
+	field[1] = csum & 0xFF;
+}
+#endif
+
+#if CONFIG_ESP_WLAN_RX_CSUM_VERIFY
+#define ETH_HDR_LEN         14
+#define ETH_TYPE_IPV4       0x0800
+#define IP_PROTO_TCP        6
+#define IP_PROTO_UDP        17
+
+/* Returns CSUM_VERIFIED, if frame is unfragmented IPv4 TCP/UDP and both IP
+ * header and L4 checksums are valid. Anything else is left to host stack */
+static uint8_t wlan_rx_csum_flags(const uint8_t *frame, uint16_t len)
+{
+	const uint8_t *ip = frame + ETH_HDR_LEN;
+	const uint8_t *l4 = NULL;
+	uint16_t ihl = 0, tot_len = 0, l4_len = 0;
+	uint32_t sum = 0;
+
+	if (len < ETH_HDR_LEN + 20)
+		return 0;
+
+	if (((frame[12] << 8) | frame[13]) != ETH_TYPE_IPV4)
+		return 0;
+
+	ihl = (ip[0] & 0x0F) * 4;
+	tot_len = (ip[2] << 8) | ip[3];
+
+	if (((ip[0] >> 4) != 4) || (ihl < 20) || (tot_len < ihl) ||
+	    (ETH_HDR_LEN + tot_len > len))
+		return 0;
+
+	/* More fragments or non zero fragment offset */
+	if (((ip[6] << 8) | ip[7]) & 0x3FFF)
+		return 0;
+
+	if (csum_fold(csum_add(0, ip, ihl)) != 0xFFFF)
+		return 0;
+
+	l4 = ip + ihl;
+	l4_len = tot_len - ihl;
+
+	if (ip[9] == IP_PROTO_TCP) {
+		if (l4_len < 20)
+			return 0;
+	} else if (ip[9] == IP_PROTO_UDP) {
+		/* Zero UDP checksum means not computed by sender */
+		if ((l4_len < 8) || (!l4[6] && !l4[7]))
+			return 0;
+	} else {
+		return 0;
+	}
+
+	/* Pseudo header: addresses, protocol and L4 length */
+	sum = csum_add(0, ip + 12, 8);
+	sum += ip[9];
+	sum += l4_len;
+	sum = csum_add(sum, l4, l4_len);
+
+	if (csum_fold(sum) != 0xFFFF)
+		return 0;
+
+	return CSUM_VERIFIED;
+}
+#endif
+
 void esp_update_ap_mac(void)
 {
 	esp_err_t ret = ESP_OK;
@@ -237,6 +347,9 @@ esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb)
 	buf_handle.wlan_buf_handle = eb;
 	buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
 	buf_handle.pkt_type = PACKET_TYPE_DATA;
+#if CONFIG_ESP_WLAN_RX_CSUM_VERIFY
+	buf_handle.hdr_flags = wlan_rx_csum_flags(buffer, len);
+#endif
 
 	ret = xQueueSend(to_host_queue[PRIO_Q_LOW], &buf_handle, portMAX_DELAY);
 
@@ -275,6 +388,9 @@ esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb)
 	buf_handle.wlan_buf_handle = eb;
 	buf_handle.free_buf_handle = esp_wifi_internal_free_rx_buffer;
 	buf_handle.pkt_type = PACKET_TYPE_DATA;
+#if CONFIG_ESP_WLAN_RX_CSUM_VERIFY
+	buf_handle.hdr_flags = wlan_rx_csum_flags(buffer, len);
+#endif
 
 	ret = xQueueSend(to_host_queue[PRIO_Q_LOW], &buf_handle, portMAX_DELAY);
 
@@ -367,6 +483,9 @@ void process_priv_commamd(uint8_t if_type, uint8_t *payload, uint16_t payload_le
 {
 	struct command_header *header = (struct command_header *) payload;
 
+	/* Commands are processed one at a time, in order of arrival */
+	cmd_seq_num = header->seq_num;
+
 	switch (header->cmd_code) {
 
 		case CMD_INIT_INTERFACE:
@@ -445,6 +564,16 @@ void process_priv_commamd(uint8_t if_type, uint8_t *payload, uint16_t payload_le
 			process_tx_power(if_type, payload, payload_len, header->cmd_code);
 			break;
 
+		case CMD_AP_CONFIG:
+			ESP_LOGI(TAG, "SoftAP config command\n");
+			process_ap_config(if_type, payload, payload_len);
+			break;
+
+		case CMD_AP_STOP:
+			ESP_LOGI(TAG, "SoftAP stop command\n");
+			process_ap_stop(if_type, payload, payload_len);
+			break;
+
 		default:
 			ESP_LOGI(TAG, "Unsupported cmd[0x%x] received\n", header->cmd_code);
 			break;
@@ -473,6 +602,12 @@ void process_rx_pkt(interface_buffer_handle_t *buf_handle)
 
 	} else if (header->packet_type == PACKET_TYPE_DATA) {
 
+#if CONFIG_ESP_WLAN_TX_CSUM_FILL
+		if (header->flags & CSUM_FILL)
+			wlan_tx_csum_fill(payload, payload_len,
+					header->reserved1, header->reserved2);
+#endif
+
 		/*ESP_LOGI(TAG, "Data packet\n");*/
 		/* Data Path */
 		if (buf_handle->if_type == ESP_STA_IF) {
@@ -57,6 +57,8 @@ extern volatile uint8_t station_connected;
 extern volatile uint8_t association_ongoing;
 
 volatile uint8_t sta_init_flag;
+/* seq_num of command being processed, echoed in its response */
+uint16_t cmd_seq_num;
 
 static struct wpa_funcs wpa_cb;
 static esp_event_handler_instance_t instance_any_id;
@@ -68,6 +70,9 @@ esp_err_t esp_wifi_register_mgmt_frame_internal(uint32_t type, uint32_t subtype)
 int esp_wifi_register_wpa_cb_internal(struct wpa_funcs *cb);
 int esp_wifi_unregister_wpa_cb_internal(void);
 extern esp_err_t wlan_sta_rx_callback(void *buffer, uint16_t len, void *eb);
+extern esp_err_t wlan_ap_rx_callback(void *buffer, uint16_t len, void *eb);
+extern void esp_update_ap_mac(void);
+extern volatile uint8_t softap_started;
 
 extern int wpa_parse_wpa_ie(const u8 *wpa_ie, size_t wpa_ie_len, wifi_wpa_ie_t *data);
 static inline void WPA_PUT_LE16(u8 *a, u16 val)
@@ -1269,6 +1274,20 @@ DONE:
 	return ret;
 }
 
+/* Drop AP role, station role (if any) stays as is */
+static esp_err_t stop_softap(void)
+{
+	wifi_mode_t mode = WIFI_MODE_NULL;
+
+	softap_started = 0;
+	esp_wifi_internal_reg_rxcb(ESP_IF_WIFI_AP, NULL);
+
+	if (esp_wifi_get_mode(&mode) || !(mode & WIFI_MODE_AP))
+		return ESP_OK;
+
+	return esp_wifi_set_mode(mode & ~WIFI_MODE_AP);
+}
+
 int process_deinit_interface(uint8_t if_type, uint8_t *payload, uint16_t payload_len)
 {
 	struct command_header *header;
@@ -1276,13 +1295,16 @@ int process_deinit_interface(uint8_t if_type, uint8_t *payload, uint16_t payload
 	interface_buffer_handle_t buf_handle = {0};
 	wifi_mode_t wifi_mode = {0};
 
-	if (if_type == ESP_STA_IF) {
+	if (if_type == ESP_AP_IF) {
+		/* Station keeps running */
+		stop_softap();
+	} else {
 		if (sta_init_flag && esp_wifi_get_mode(&wifi_mode)==0)
 			esp_wifi_deauthenticate_internal(WIFI_REASON_AUTH_LEAVE);
 		esp_wifi_disconnect();
+		esp_wifi_scan_stop();
+		esp_wifi_stop();
 	}
-	esp_wifi_scan_stop();
-	esp_wifi_stop();
 
 	buf_handle.if_type = if_type;
 	buf_handle.if_num = 0;
@@ -1327,7 +1349,9 @@ int process_init_interface(uint8_t if_type, uint8_t *payload, uint16_t payload_l
 	esp_err_t ret = ESP_OK;
 	wifi_mode_t mode = 0;
 
-	if (!sta_init_flag) {
+	/* AP interface is added over running station. AP role itself is
+	 * enabled only by CMD_AP_CONFIG, not to beacon with default config */
+	if (!sta_init_flag && (if_type == ESP_STA_IF)) {
 
 		/* Register to get events from wifi driver */
 		ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -1343,11 +1367,7 @@ int process_init_interface(uint8_t if_type, uint8_t *payload, uint16_t payload_l
 			goto DONE;
 		}
 
-		if (if_type == ESP_STA_IF) {
-			mode |= WIFI_MODE_STA;
-		} else {
-			mode |= WIFI_MODE_AP;
-		}
+		mode |= WIFI_MODE_STA;
 
 		ret = esp_wifi_set_mode(mode);
 		if (ret) {
@@ -1400,6 +1420,107 @@ DONE:
 
 }
 
+static int send_ap_cmd_response(uint8_t if_type, uint8_t cmd_code, uint8_t cmd_status)
+{
+	struct command_header *header;
+	interface_buffer_handle_t buf_handle = {0};
+	esp_err_t ret = ESP_OK;
+
+	buf_handle.if_type = if_type;
+	buf_handle.if_num = 0;
+	buf_handle.payload_len = sizeof(struct command_header);
+	buf_handle.pkt_type = PACKET_TYPE_COMMAND_RESPONSE;
+
+	buf_handle.payload = heap_caps_malloc(buf_handle.payload_len, MALLOC_CAP_DMA);
+	assert(buf_handle.payload);
+	memset(buf_handle.payload, 0, buf_handle.payload_len);
+
+	header = (struct command_header *) buf_handle.payload;
+
+	header->cmd_code = cmd_code;
+	header->len = 0;
+	header->cmd_status = cmd_status;
+
+	buf_handle.priv_buffer_handle = buf_handle.payload;
+	buf_handle.free_buf_handle = free;
+
+	ret = send_command_response(&buf_handle);
+	if (ret != pdTRUE) {
+		ESP_LOGE(TAG, "Slave -> Host: Failed to send command response\n");
+		free(buf_handle.payload);
+		return ret;
+	}
+
+	return ESP_OK;
+}
+
+int process_ap_config(uint8_t if_type, uint8_t *payload, uint16_t payload_len)
+{
+	struct cmd_ap_config *cmd = (struct cmd_ap_config *) payload;
+	wifi_config_t wifi_config = {0};
+	wifi_mode_t mode = WIFI_MODE_NULL;
+	uint8_t cmd_status = CMD_RESPONSE_SUCCESS;
+	esp_err_t ret = ESP_OK;
+
+	if ((payload_len < sizeof(struct cmd_ap_config)) || !cmd->ssid_len ||
+	    (cmd->ssid_len > MAX_SSID_LEN)) {
+		ESP_LOGE(TAG, "Invalid AP config\n");
+		cmd_status = CMD_RESPONSE_INVALID;
+		goto SEND_RESP;
+	}
+
+	memcpy(wifi_config.ap.ssid, cmd->ssid, cmd->ssid_len);
+	wifi_config.ap.ssid_len = cmd->ssid_len;
+	wifi_config.ap.channel = cmd->channel;
+	wifi_config.ap.ssid_hidden = cmd->hidden_ssid;
+	wifi_config.ap.max_connection = cmd->max_connections;
+	wifi_config.ap.beacon_interval = le16toh(cmd->beacon_interval);
+
+	if (cmd->authmode == ESP_AP_AUTH_WPA2_PSK) {
+		wifi_config.ap.authmode = WIFI_AUTH_WPA2_PSK;
+		memcpy(wifi_config.ap.password, cmd->passphrase,
+				strnlen(cmd->passphrase, sizeof(wifi_config.ap.password)));
+	} else {
+		wifi_config.ap.authmode = WIFI_AUTH_OPEN;
+	}
+
+	ret = esp_wifi_get_mode(&mode);
+	if (!ret && !(mode & WIFI_MODE_AP))
+		ret = esp_wifi_set_mode(mode | WIFI_MODE_AP);
+
+	if (!ret)
+		ret = esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
+
+	if (!ret)
+		ret = esp_wifi_internal_reg_rxcb(ESP_IF_WIFI_AP, (wifi_rxcb_t) wlan_ap_rx_callback);
+
+	if (ret) {
+		ESP_LOGE(TAG, "Failed to start softAP: 0x%x\n", ret);
+		stop_softap();
+		cmd_status = CMD_RESPONSE_FAIL;
+		goto SEND_RESP;
+	}
+
+	esp_update_ap_mac();
+	softap_started = 1;
+	ESP_LOGI(TAG, "SoftAP started on channel %u\n", cmd->channel);
+
+SEND_RESP:
+	return send_ap_cmd_response(if_type, CMD_AP_CONFIG, cmd_status);
+}
+
+int process_ap_stop(uint8_t if_type, uint8_t *payload, uint16_t payload_len)
+{
+	uint8_t cmd_status = CMD_RESPONSE_SUCCESS;
+
+	if (stop_softap()) {
+		ESP_LOGE(TAG, "Failed to stop softAP\n");
+		cmd_status = CMD_RESPONSE_FAIL;
+	}
+
+	return send_ap_cmd_response(if_type, CMD_AP_STOP, cmd_status);
+}
+
 int process_get_mac(uint8_t if_type)
 {
 	esp_err_t ret = ESP_OK;
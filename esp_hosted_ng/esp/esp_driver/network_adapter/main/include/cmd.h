@@ -47,10 +47,19 @@ int process_assoc_request(uint8_t if_type, uint8_t *payload, uint16_t payload_le
 int process_set_ip(uint8_t if_type, uint8_t *payload, uint16_t payload_len);
 int process_set_mcast_mac_list(uint8_t if_type, uint8_t *payload, uint16_t payload_len);
 int process_tx_power(uint8_t if_type, uint8_t *payload, uint16_t payload_len, uint8_t cmd_code);
+int process_ap_config(uint8_t if_type, uint8_t *payload, uint16_t payload_len);
+int process_ap_stop(uint8_t if_type, uint8_t *payload, uint16_t payload_len);
 esp_err_t initialise_wifi(void);
 
+extern uint16_t cmd_seq_num;
+
 inline esp_err_t send_command_response(interface_buffer_handle_t *buf_handle)
 {
+	struct command_header *header = (struct command_header *) buf_handle->payload;
+
+	/* Host matches response with its request by seq_num */
+	header->seq_num = cmd_seq_num;
+
 	return send_to_host(PRIO_Q_HIGH, buf_handle);
 }
 
@@ -62,6 +62,7 @@ typedef struct {
 	uint8_t if_num;
 	uint8_t *payload;
 	uint8_t flag;
+	uint8_t hdr_flags;
 	uint16_t payload_len;
 	uint16_t seq_num;
 	uint8_t  pkt_type;
@@ -20,6 +20,7 @@
 #include "freertos/event_groups.h"
 #include "driver/gpio.h"
 #include <rom/rtc.h>
+#include <rom/crc.h>
 #include "esp_log.h"
 #include "interface.h"
 #include "esp.h"
@@ -72,8 +73,42 @@ int interface_remove_driver()
 	return 0;
 }
 
+/* Gives once host has read a Tx buffer. Serializes Tx to host which reads
+ * one packet at a time, see sdio_tx_queue_buf() */
+static SemaphoreHandle_t tx_done_sem;
+static SemaphoreHandle_t tx_lock;
+
+/* Host awaits ESP_CREDIT_UPDATE interrupt, on next Rx buffer reload */
+static volatile bool host_credit_wait;
+/* ESP_EXT_CAPABILITIES accepted by host */
+static uint8_t host_ext_capabilities;
+
+/* Host aggregated Rx buffer, records of which are handed out one at a time.
+ * Buffer is reloaded only with its last record */
+static struct {
+	sdio_slave_buf_handle_t handle;
+	uint8_t *next;
+	uint16_t left;
+} rx_aggr;
+
+/* Checksum type is fixed by bootup event, see is_bootup_event() */
+static uint16_t compute_frame_checksum(uint8_t *buf, uint16_t len)
+{
+#if CONFIG_ESP_CHECKSUM_CRC32
+	if (!is_bootup_event(buf, len))
+		return fold_crc32(crc32_le(0, buf, len));
+#endif
+
+	return compute_checksum(buf, len);
+}
+
 IRAM_ATTR static void event_cb(uint8_t val)
 {
+	if (val == ESP_CREDIT_REQUEST) {
+		host_credit_wait = true;
+		return;
+	}
+
 	if (val == ESP_RESET) {
 		sdio_reset(&if_handle_g);
 		return;
@@ -96,6 +131,54 @@ IRAM_ATTR static void event_cb(uint8_t val)
 static void sdio_read_done(void *handle)
 {
 	sdio_slave_recv_load_buf((sdio_slave_buf_handle_t) handle);
+
+	if (host_credit_wait) {
+		host_credit_wait = false;
+		sdio_slave_send_host_int(ESP_CREDIT_UPDATE);
+	}
+}
+
+static void sdio_tx_done_task(void* pvParameters)
+{
+	void *sendbuf = NULL;
+
+	for (;;) {
+		if (sdio_slave_send_get_finished(&sendbuf, portMAX_DELAY) != ESP_OK)
+			continue;
+
+		free(sendbuf);
+		xSemaphoreGive(tx_done_sem);
+	}
+}
+
+/* Queue sendbuf to SDIO driver, which frees it once host has read it.
+ * In stream mode, buffers queued meanwhile are read by host in one go */
+static esp_err_t sdio_tx_queue_buf(uint8_t *sendbuf, uint32_t len)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (host_ext_capabilities & ESP_SDIO_TX_STREAM_SUPPORT) {
+		/* Blocks only if SDIO_SLAVE_QUEUE_SIZE buffers are in flight */
+		ret = sdio_slave_send_queue(sendbuf, len, sendbuf, portMAX_DELAY);
+		if (ret != ESP_OK)
+			free(sendbuf);
+
+		return ret;
+	}
+
+	/* Host takes each read for single packet, so keep one in flight */
+	xSemaphoreTake(tx_lock, portMAX_DELAY);
+	xSemaphoreTake(tx_done_sem, 0);
+
+	ret = sdio_slave_send_queue(sendbuf, len, sendbuf, portMAX_DELAY);
+	if (ret == ESP_OK)
+		xSemaphoreTake(tx_done_sem, portMAX_DELAY);
+	else
+		free(sendbuf);
+
+	xSemaphoreGive(tx_lock);
+
+	return ret;
 }
 
 static interface_handle_t * sdio_init(void)
@@ -131,6 +214,10 @@ static interface_handle_t * sdio_init(void)
 
 	xSemaphoreGive(wakeup_sem);
 
+	tx_done_sem = xSemaphoreCreateBinary();
+	tx_lock = xSemaphoreCreateMutex();
+	assert(tx_done_sem && tx_lock);
+
 	ret = sdio_slave_initialize(&config);
 	if (ret != ESP_OK) {
 		return NULL;
@@ -165,6 +252,9 @@ static interface_handle_t * sdio_init(void)
 		return NULL;
 	}
 
+	assert(xTaskCreate(sdio_tx_done_task, "sdio_tx_done_task",
+			TASK_DEFAULT_STACK_SIZE, NULL, TASK_DEFAULT_PRIO, NULL) == pdTRUE);
+
 	memset(&if_handle_g, 0, sizeof(if_handle_g));
 	if_handle_g.state = INIT;
 
@@ -254,6 +344,7 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 	header->if_num = buf_handle->if_num;
 	header->len = htole16(buf_handle->payload_len);
 	header->reserved2 = buf_handle->flag;
+	header->flags = buf_handle->hdr_flags;
 	offset = sizeof(struct esp_payload_header);
 	header->offset = htole16(offset);
 	header->packet_type = buf_handle->pkt_type;
@@ -261,14 +352,14 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 	memcpy(sendbuf + offset, buf_handle->payload, buf_handle->payload_len);
 
 #if CONFIG_ESP_SDIO_CHECKSUM
-	header->checksum = htole16(compute_checksum(sendbuf,
+	header->checksum = htole16(compute_frame_checksum(sendbuf,
 				offset+buf_handle->payload_len));
 #endif
 
-	ret = sdio_slave_transmit(sendbuf, total_len);
+	/* Buffer is freed by sdio_tx_done_task(), once host reads it */
+	ret = sdio_tx_queue_buf(sendbuf, total_len);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG , "sdio slave transmit error, ret : 0x%x\r\n", ret);
-		free(sendbuf);
 		return ESP_FAIL;
 	}
 #if 0
@@ -276,11 +367,32 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 	ESP_LOG_BUFFER_HEXDUMP("s->h", buf_handle->payload,
 	  buf_handle->payload_len, ESP_LOG_INFO);
 #endif
-	free(sendbuf);
 
 	return buf_handle->payload_len;
 }
 
+static uint8_t get_ext_capabilities(void)
+{
+	uint8_t ext_cap = 0;
+
+#if CONFIG_ESP_SDIO_AGGREGATION
+	ext_cap |= ESP_SDIO_AGGREGATION_SUPPORT;
+#endif
+#if CONFIG_ESP_CHECKSUM_CRC32
+	ext_cap |= ESP_CHECKSUM_CRC32_SUPPORT;
+#endif
+#if CONFIG_ESP_WLAN_RX_CSUM_VERIFY
+	ext_cap |= ESP_RX_CSUM_OFFLOAD_SUPPORT;
+#endif
+#if CONFIG_ESP_WLAN_TX_CSUM_FILL
+	ext_cap |= ESP_TX_CSUM_OFFLOAD_SUPPORT;
+#endif
+	ext_cap |= ESP_CMD_SEQ_NUM_SUPPORT;
+	ext_cap |= ESP_SDIO_TX_STREAM_SUPPORT;
+
+	return ext_cap;
+}
+
 esp_err_t send_bootup_event_to_host(uint8_t cap)
 {
 	struct esp_payload_header *header = NULL;
@@ -328,6 +440,11 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
 	*pos = LENGTH_1_BYTE;                 pos++;len++;
 	*pos = raw_tp_cap;                    pos++;len++;
 
+	/* TLV - Extended capability */
+	*pos = ESP_BOOTUP_EXT_CAPABILITY;     pos++;len++;
+	*pos = LENGTH_1_BYTE;                 pos++;len++;
+	*pos = get_ext_capabilities();        pos++;len++;
+
 	/* TLV - FW data */
 	*pos = ESP_BOOTUP_FW_DATA;            pos++; len++;
 	*pos = sizeof(struct fw_data);        pos++; len++;
@@ -352,29 +469,37 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
 	header->len = htole16(buf_handle.payload_len - sizeof(struct esp_payload_header));
 
 #if CONFIG_ESP_SDIO_CHECKSUM
-	header->checksum = htole16(compute_checksum(buf_handle.payload, buf_handle.payload_len));
+	header->checksum = htole16(compute_frame_checksum(buf_handle.payload, buf_handle.payload_len));
 #endif
 
-	ret = sdio_slave_transmit(buf_handle.payload, buf_handle.payload_len);
+	ret = sdio_tx_queue_buf(buf_handle.payload, buf_handle.payload_len);
 	if (ret != ESP_OK) {
 		ESP_LOGE(TAG , "sdio slave tx error, ret : 0x%x\r\n", ret);
-		free(buf_handle.payload);
 		return ESP_FAIL;
 	}
 
-	free(buf_handle.payload);
 	return ESP_OK;
 }
 
 
+static void process_host_capability(struct esp_internal_host_capability *cap)
+{
+	if (cap->header.event_code != ESP_INTERNAL_HOST_CAPABILITY)
+		return;
+
+	host_ext_capabilities = cap->ext_capabilities & get_ext_capabilities();
+	ESP_LOGI(TAG, "Host accepted ext capabilities: 0x%x", host_ext_capabilities);
+}
+
 static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *buf_handle)
 {
 	struct esp_payload_header *header = NULL;
 #if CONFIG_ESP_SDIO_CHECKSUM
 	uint16_t rx_checksum = 0, checksum = 0;
 #endif
-	uint16_t len = 0;
+	uint16_t len = 0, stride = 0;
 	size_t sdio_read_len = 0;
+	sdio_slave_buf_handle_t sdio_buf_handle = NULL;
 
 
 	if (!if_handle) {
@@ -386,26 +511,61 @@ static int sdio_read(interface_handle_t *if_handle, interface_buffer_handle_t *b
 		return ESP_FAIL;
 	}
 
-	sdio_slave_recv(&(buf_handle->sdio_buf_handle), &(buf_handle->payload),
-			&(sdio_read_len), portMAX_DELAY);
+	if (rx_aggr.left) {
+		/* Next record of host aggregated buffer */
+		sdio_buf_handle = rx_aggr.handle;
+		buf_handle->payload = rx_aggr.next;
+		sdio_read_len = rx_aggr.left;
+		memset(&rx_aggr, 0, sizeof(rx_aggr));
+	} else {
+		sdio_slave_recv(&sdio_buf_handle, &(buf_handle->payload),
+				&(sdio_read_len), portMAX_DELAY);
+	}
 	buf_handle->payload_len = sdio_read_len & 0xFFFF;
 
 	header = (struct esp_payload_header *) buf_handle->payload;
 
 	len = le16toh(header->len) + le16toh(header->offset);
 
+	if (len > sdio_read_len) {
+		sdio_read_done(sdio_buf_handle);
+		return ESP_FAIL;
+	}
+
 #if CONFIG_ESP_SDIO_CHECKSUM
 	rx_checksum = le16toh(header->checksum);
 	header->checksum = 0;
 
-	checksum = compute_checksum(buf_handle->payload, len);
+	checksum = compute_frame_checksum(buf_handle->payload, len);
 
 	if (checksum != rx_checksum) {
-		sdio_read_done(buf_handle->sdio_buf_handle);
+		/* Records behind this one can't be located either */
+		sdio_read_done(sdio_buf_handle);
 		return ESP_FAIL;
 	}
 #endif
 
+	if ((header->flags & MORE_AGGR_RECORDS) &&
+	    (host_ext_capabilities & ESP_SDIO_AGGREGATION_SUPPORT)) {
+		stride = (len + 3) & ~3;
+
+		if (stride + sizeof(struct esp_payload_header) <= sdio_read_len) {
+			rx_aggr.handle = sdio_buf_handle;
+			rx_aggr.next = buf_handle->payload + stride;
+			rx_aggr.left = sdio_read_len - stride;
+			sdio_buf_handle = NULL;
+		}
+	}
+
+	if (header->if_type == ESP_INTERNAL_IF) {
+		process_host_capability((struct esp_internal_host_capability *)
+				(buf_handle->payload + le16toh(header->offset)));
+		if (sdio_buf_handle)
+			sdio_read_done(sdio_buf_handle);
+		return ESP_FAIL;
+	}
+
+	buf_handle->sdio_buf_handle = sdio_buf_handle;
 	buf_handle->if_type = header->if_type;
 	buf_handle->if_num = header->if_num;
 	buf_handle->free_buf_handle = sdio_read_done;
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <rom/rtc.h>
+#include <rom/crc.h>
 #include "esp.h"
 #include "esp_log.h"
 #include "interface.h"
@@ -109,6 +110,11 @@ static uint8_t gpio_handshake = CONFIG_ESP_SPI_GPIO_HANDSHAKE;
 static uint8_t gpio_data_ready = CONFIG_ESP_SPI_GPIO_DATA_READY;
 static QueueHandle_t spi_rx_queue[MAX_PRIORITY_QUEUES] = {NULL};
 static QueueHandle_t spi_tx_queue[MAX_PRIORITY_QUEUES] = {NULL};
+/* ESP_EXT_CAPABILITIES accepted by host */
+static uint8_t host_ext_capabilities;
+/* Max length host clocks for transaction being queued, as announced in
+ * previous transaction */
+static uint32_t tx_len_limit = RX_BUF_SIZE;
 
 static interface_handle_t * esp_spi_init(void);
 static int32_t esp_spi_write(interface_handle_t *handle,
@@ -147,6 +153,41 @@ int interface_remove_driver()
 	return 0;
 }
 
+static uint8_t get_ext_capabilities(void)
+{
+	uint8_t ext_cap = 0;
+
+#if CONFIG_ESP_SPI_AGGREGATION
+	ext_cap |= ESP_SPI_AGGREGATION_SUPPORT;
+#endif
+#if CONFIG_ESP_SPI_VARIABLE_LEN
+	ext_cap |= ESP_SPI_VARIABLE_LEN_SUPPORT;
+#endif
+#if CONFIG_ESP_CHECKSUM_CRC32
+	ext_cap |= ESP_CHECKSUM_CRC32_SUPPORT;
+#endif
+#if CONFIG_ESP_WLAN_RX_CSUM_VERIFY
+	ext_cap |= ESP_RX_CSUM_OFFLOAD_SUPPORT;
+#endif
+#if CONFIG_ESP_WLAN_TX_CSUM_FILL
+	ext_cap |= ESP_TX_CSUM_OFFLOAD_SUPPORT;
+#endif
+	ext_cap |= ESP_CMD_SEQ_NUM_SUPPORT;
+
+	return ext_cap;
+}
+
+/* Checksum type is fixed by bootup event, see is_bootup_event() */
+static uint16_t compute_frame_checksum(uint8_t *buf, uint16_t len)
+{
+#if CONFIG_ESP_CHECKSUM_CRC32
+	if (!is_bootup_event(buf, len))
+		return fold_crc32(crc32_le(0, buf, len));
+#endif
+
+	return compute_checksum(buf, len);
+}
+
 esp_err_t send_bootup_event_to_host(uint8_t cap)
 {
 	struct esp_payload_header *header = NULL;
@@ -204,6 +245,11 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
 	*pos = LENGTH_1_BYTE;                 pos++;len++;
 	*pos = raw_tp_cap;                    pos++;len++;
 
+	/* TLV - Extended capability */
+	*pos = ESP_BOOTUP_EXT_CAPABILITY;     pos++;len++;
+	*pos = LENGTH_1_BYTE;                 pos++;len++;
+	*pos = get_ext_capabilities();        pos++;len++;
+
 	/* TLV - FW data */
 	*pos = ESP_BOOTUP_FW_DATA;            pos++; len++;
 	*pos = sizeof(struct fw_data);        pos++; len++;
@@ -228,13 +274,13 @@ esp_err_t send_bootup_event_to_host(uint8_t cap)
 	header->len = htole16(buf_handle.payload_len - sizeof(struct esp_payload_header));
 
 #if CONFIG_ESP_SPI_CHECKSUM
-	header->checksum = htole16(compute_checksum(buf_handle.payload, buf_handle.payload_len));
+	header->checksum = htole16(compute_frame_checksum(buf_handle.payload, buf_handle.payload_len));
 #endif
 
+	/* indicate waiting data on ready pin, before packet can be loaded */
+	WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1 << gpio_data_ready));
 	xQueueSend(spi_tx_queue[PRIO_Q_HIGH], &buf_handle, portMAX_DELAY);
 
-	/* indicate waiting data on ready pin */
-	WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1 << gpio_data_ready));
 	/* process first data packet here to start transactions */
 	queue_next_transaction();
 
@@ -257,7 +303,108 @@ static void IRAM_ATTR spi_post_trans_cb(spi_slave_transaction_t *trans)
 	WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1 << gpio_handshake));
 }
 
-static uint8_t * get_next_tx_buffer(uint32_t *len)
+static uint32_t get_tx_queued_count(void)
+{
+	return uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_HIGH]) +
+		uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_MID]) +
+		uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_LOW]);
+}
+
+/* Dequeue head of highest priority non-empty Tx queue, only if it fits max_len */
+static int get_next_tx_buf_handle(interface_buffer_handle_t *buf_handle, uint32_t max_len)
+{
+	uint8_t prio_q_idx = 0;
+
+	/* This is the only consumer of spi_tx_queue, so peeked buffer is
+	 * the one received below */
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (xQueuePeek(spi_tx_queue[prio_q_idx], buf_handle, 0) != pdTRUE)
+			continue;
+
+		if (buf_handle->payload_len > max_len)
+			return pdFALSE;
+
+		return xQueueReceive(spi_tx_queue[prio_q_idx], buf_handle, 0);
+	}
+
+	return pdFALSE;
+}
+
+#if CONFIG_ESP_SPI_AGGREGATION
+static void mark_more_records(struct esp_payload_header *header)
+{
+	header->flags |= MORE_AGGR_RECORDS;
+
+#if CONFIG_ESP_SPI_CHECKSUM
+	/* Flag is covered by checksum, so recompute it */
+	header->checksum = 0;
+	header->checksum = htole16(compute_frame_checksum((uint8_t *) header,
+				le16toh(header->offset) + le16toh(header->len)));
+#endif
+}
+
+/* Pack as many queued buffers as fit in RX_BUF_SIZE behind first one */
+static uint8_t * aggregate_tx_buffers(interface_buffer_handle_t *first, uint32_t *len,
+		uint32_t max_len)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	struct esp_payload_header *header = NULL;
+	uint8_t *aggr_buf = NULL;
+	uint32_t used = 0;
+
+	if (!(host_ext_capabilities & ESP_SPI_AGGREGATION_SUPPORT))
+		return first->payload;
+
+	if (first->payload_len + sizeof(struct esp_payload_header) >= max_len)
+		return first->payload;
+
+	/* Nothing more to pack */
+	if (!get_tx_queued_count())
+		return first->payload;
+
+	aggr_buf = heap_caps_malloc(RX_BUF_SIZE, MALLOC_CAP_DMA);
+	if (!aggr_buf)
+		return first->payload;
+
+	if (get_next_tx_buf_handle(&buf_handle, max_len - first->payload_len) != pdTRUE) {
+		free(aggr_buf);
+		return first->payload;
+	}
+
+	memset(aggr_buf, 0, RX_BUF_SIZE);
+
+	header = (struct esp_payload_header *) aggr_buf;
+	memcpy(aggr_buf, first->payload, first->payload_len);
+	used = first->payload_len;
+	free(first->payload);
+
+	/* Records start DMA aligned */
+	if (!IS_SPI_DMA_ALIGNED(used))
+		MAKE_SPI_DMA_ALIGNED(used);
+
+	do {
+		mark_more_records(header);
+
+		header = (struct esp_payload_header *) (aggr_buf + used);
+		memcpy(header, buf_handle.payload, buf_handle.payload_len);
+		used += buf_handle.payload_len;
+		free(buf_handle.payload);
+
+		if (!IS_SPI_DMA_ALIGNED(used))
+			MAKE_SPI_DMA_ALIGNED(used);
+
+		if (used + sizeof(struct esp_payload_header) >= max_len)
+			break;
+	} while (get_next_tx_buf_handle(&buf_handle, max_len - used) == pdTRUE);
+
+	if (len)
+		*len = used;
+
+	return aggr_buf;
+}
+#endif
+
+static uint8_t * get_next_tx_buffer(uint32_t *len, uint32_t max_len)
 {
 	interface_buffer_handle_t buf_handle = {0};
 	esp_err_t ret = ESP_OK;
@@ -269,24 +416,26 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
 	 *	2. Create a new empty tx buffer and return */
 
 	/* Get buffer from SPI Tx queue */
-	if(uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_HIGH]))
-		ret = xQueueReceive(spi_tx_queue[PRIO_Q_HIGH], &buf_handle, portMAX_DELAY);
-	else if(uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_MID]))
-		ret = xQueueReceive(spi_tx_queue[PRIO_Q_MID], &buf_handle, portMAX_DELAY);
-	else if(uxQueueMessagesWaiting(spi_tx_queue[PRIO_Q_LOW]))
-		ret = xQueueReceive(spi_tx_queue[PRIO_Q_LOW], &buf_handle, portMAX_DELAY);
-	else
-		ret = pdFALSE;
+	ret = get_next_tx_buf_handle(&buf_handle, max_len);
 
 	if (ret == pdTRUE && buf_handle.payload) {
+		/* Host sizes transaction by data ready, sampled once handshake
+		 * of this one is up. Writer may not have raised it yet */
+		WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1 << gpio_data_ready));
 		if (len)
 			*len = buf_handle.payload_len;
+#if CONFIG_ESP_SPI_AGGREGATION
+		return aggregate_tx_buffers(&buf_handle, len, max_len);
+#else
 		/* Return real data buffer from queue */
 		return buf_handle.payload;
+#endif
 	}
 
-	/* No real data pending, clear ready line and indicate host an idle state */
-	WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1 << gpio_data_ready));
+	/* No real data pending, clear ready line and indicate host an idle state.
+	 * Pending data not fitting in announced length goes in next transaction */
+	if (!get_tx_queued_count())
+		WRITE_PERI_REG(GPIO_OUT_W1TC_REG, (1 << gpio_data_ready));
 
 	/* Create empty dummy buffer */
 	sendbuf = heap_caps_malloc(RX_BUF_SIZE, MALLOC_CAP_DMA);
@@ -313,7 +462,17 @@ static uint8_t * get_next_tx_buffer(uint32_t *len)
 	return sendbuf;
 }
 
-static int process_spi_rx(interface_buffer_handle_t *buf_handle)
+static void process_host_capability(struct esp_internal_host_capability *cap)
+{
+	if (cap->header.event_code != ESP_INTERNAL_HOST_CAPABILITY)
+		return;
+
+	host_ext_capabilities = cap->ext_capabilities & get_ext_capabilities();
+	ESP_LOGI(TAG, "Host accepted ext capabilities: 0x%x", host_ext_capabilities);
+}
+
+/* Validate and queue single record. On success, buffer is owned by rx queue */
+static int process_spi_rx_record(interface_buffer_handle_t *buf_handle, uint16_t buf_len)
 {
 	int ret = 0;
 	struct esp_payload_header *header = NULL;
@@ -322,18 +481,11 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	uint16_t rx_checksum = 0, checksum = 0;
 #endif
 
-	/* Validate received buffer. Drop invalid buffer. */
-
-	if (!buf_handle || !buf_handle->payload) {
-		ESP_LOGE(TAG, "%s: Invalid params", __func__);
-		return -1;
-	}
-
 	header = (struct esp_payload_header *) buf_handle->payload;
 	len = le16toh(header->len);
 	offset = le16toh(header->offset);
 
-	if (!len || (len > RX_BUF_SIZE)) {
+	if (!len || (len > RX_BUF_SIZE) || (len + offset > buf_len)) {
 		return -1;
 	}
 
@@ -341,23 +493,27 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	rx_checksum = le16toh(header->checksum);
 	header->checksum = 0;
 
-	checksum = compute_checksum(buf_handle->payload, len+offset);
+	checksum = compute_frame_checksum(buf_handle->payload, len+offset);
 
 	if (checksum != rx_checksum) {
 		return -1;
 	}
 #endif
 
+	if (header->if_type == ESP_INTERNAL_IF) {
+		/* Internal messages from host are consumed by transport */
+		process_host_capability((struct esp_internal_host_capability *)
+				(buf_handle->payload + offset));
+		return -1;
+	}
+
 	/* Buffer is valid */
 	buf_handle->if_type = header->if_type;
 	buf_handle->if_num = header->if_num;
 	buf_handle->free_buf_handle = esp_spi_read_done;
 	buf_handle->payload_len = le16toh(header->len) + offset;
-	buf_handle->priv_buffer_handle = buf_handle->payload;
 
-	if (header->if_type == ESP_INTERNAL_IF)
-		ret = xQueueSend(spi_rx_queue[PRIO_Q_HIGH], buf_handle, portMAX_DELAY);
-	else if (header->if_type == ESP_HCI_IF)
+	if (header->if_type == ESP_HCI_IF)
 		ret = xQueueSend(spi_rx_queue[PRIO_Q_MID], buf_handle, portMAX_DELAY);
 	else
 		ret = xQueueSend(spi_rx_queue[PRIO_Q_LOW], buf_handle, portMAX_DELAY);
@@ -368,6 +524,109 @@ static int process_spi_rx(interface_buffer_handle_t *buf_handle)
 	return 0;
 }
 
+static int process_spi_rx(interface_buffer_handle_t *buf_handle)
+{
+	uint8_t *rx_buffer = NULL;
+	uint16_t left = RX_BUF_SIZE;
+#if CONFIG_ESP_SPI_AGGREGATION
+	interface_buffer_handle_t record_handle = {0};
+	struct esp_payload_header *header = NULL;
+	uint16_t record_len = 0;
+	uint8_t *record = NULL;
+#endif
+
+	/* Validate received buffer. Drop invalid buffer. */
+
+	if (!buf_handle || !buf_handle->payload) {
+		ESP_LOGE(TAG, "%s: Invalid params", __func__);
+		return -1;
+	}
+
+	rx_buffer = buf_handle->payload;
+
+#if CONFIG_ESP_SPI_AGGREGATION
+	/* Aggregated transaction carries back to back records, all but
+	 * last marked with MORE_AGGR_RECORDS. Copy out all but last one,
+	 * last one is handed over in place */
+	header = (struct esp_payload_header *) buf_handle->payload;
+
+	while (header->flags & MORE_AGGR_RECORDS) {
+		record_len = le16toh(header->offset) + le16toh(header->len);
+		if (!IS_SPI_DMA_ALIGNED(record_len))
+			MAKE_SPI_DMA_ALIGNED(record_len);
+
+		if (record_len >= left)
+			break;
+
+		record = malloc(record_len);
+		if (record) {
+			memcpy(record, header, record_len);
+
+			memset(&record_handle, 0, sizeof(record_handle));
+			record_handle.payload = record;
+			record_handle.priv_buffer_handle = record;
+
+			if (process_spi_rx_record(&record_handle, record_len))
+				free(record);
+		}
+
+		buf_handle->payload += record_len;
+		left -= record_len;
+		header = (struct esp_payload_header *) buf_handle->payload;
+	}
+#endif
+
+	/* Last record is freed through rx_buffer, once processed */
+	buf_handle->priv_buffer_handle = rx_buffer;
+
+	return process_spi_rx_record(buf_handle, left);
+}
+
+/* Length of next transaction, in SPI_NEXT_TX_LEN_UNIT, 0 if not known */
+static uint8_t get_next_tx_len_hint(void)
+{
+	interface_buffer_handle_t buf_handle = {0};
+	uint8_t prio_q_idx = 0;
+
+	if (!(host_ext_capabilities & ESP_SPI_VARIABLE_LEN_SUPPORT))
+		return 0;
+
+#if CONFIG_ESP_SPI_AGGREGATION
+	/* Let host clock full buffer, if multiple could be packed */
+	if ((host_ext_capabilities & ESP_SPI_AGGREGATION_SUPPORT) &&
+	    (get_tx_queued_count() > 1))
+		return RX_BUF_SIZE / SPI_NEXT_TX_LEN_UNIT;
+#endif
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		if (xQueuePeek(spi_tx_queue[prio_q_idx], &buf_handle, 0) == pdTRUE)
+			return (buf_handle.payload_len + SPI_NEXT_TX_LEN_UNIT - 1) /
+				SPI_NEXT_TX_LEN_UNIT;
+	}
+
+	return 0;
+}
+
+static void announce_next_tx_len(uint8_t *tx_buffer, uint32_t len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) tx_buffer;
+	uint8_t hint = get_next_tx_len_hint();
+
+	header->reserved1 = hint;
+
+	/* When not known, host clocks full buffer if data ready is raised */
+	tx_len_limit = hint ? hint * SPI_NEXT_TX_LEN_UNIT : RX_BUF_SIZE;
+
+#if CONFIG_ESP_SPI_CHECKSUM
+	/* Hint is covered by checksum of real packets, so recompute it */
+	if (len) {
+		header->checksum = 0;
+		header->checksum = htole16(compute_frame_checksum(tx_buffer,
+					le16toh(header->offset) + le16toh(header->len)));
+	}
+#endif
+}
+
 static void queue_next_transaction(void)
 {
 	spi_slave_transaction_t *spi_trans = NULL;
@@ -375,13 +634,15 @@ static void queue_next_transaction(void)
 	uint32_t len = 0;
 	uint8_t *tx_buffer = NULL;
 
-	tx_buffer = get_next_tx_buffer(&len);
+	tx_buffer = get_next_tx_buffer(&len, tx_len_limit);
 	if (!tx_buffer) {
 		/* Queue next transaction failed */
 		ESP_LOGE(TAG , "Failed to queue new transaction\r\n");
 		return;
 	}
 
+	announce_next_tx_len(tx_buffer, len);
+
 	spi_trans = malloc(sizeof(spi_slave_transaction_t));
 	assert(spi_trans);
 
@@ -599,7 +860,7 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 	header->len = htole16(buf_handle->payload_len);
 	offset = sizeof(struct esp_payload_header);
 	header->offset = htole16(offset);
-	header->flags = buf_handle->flag;
+	header->flags = buf_handle->flag | buf_handle->hdr_flags;
 	header->packet_type = buf_handle->pkt_type;
 
 	/* copy the data from caller */
@@ -607,10 +868,13 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 
 
 #if CONFIG_ESP_SPI_CHECKSUM
-	header->checksum = htole16(compute_checksum(tx_buf_handle.payload,
+	header->checksum = htole16(compute_frame_checksum(tx_buf_handle.payload,
 				offset+buf_handle->payload_len));
 #endif
 
+	/* indicate waiting data on ready pin, before packet can be loaded */
+	WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1 << gpio_data_ready));
+
 	if (header->if_type == ESP_INTERNAL_IF)
 		ret = xQueueSend(spi_tx_queue[PRIO_Q_HIGH], &tx_buf_handle, portMAX_DELAY);
 	else if (header->if_type == ESP_HCI_IF)
@@ -621,7 +885,7 @@ static int32_t esp_spi_write(interface_handle_t *handle, interface_buffer_handle
 	if (ret != pdTRUE)
 		return ESP_FAIL;
 
-	/* indicate waiting data on ready pin */
+	/* Again, in case idle post process task cleared it meanwhile */
 	WRITE_PERI_REG(GPIO_OUT_W1TS_REG, (1 << gpio_data_ready));
 
 	return buf_handle->payload_len;
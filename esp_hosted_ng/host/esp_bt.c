@@ -67,7 +67,7 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 #endif
 	struct esp_adapter *adapter = hci_get_drvdata(hdev);
 	struct sk_buff *new_skb;
-	u8 pad_len = 0, realloc_skb = 0;
+	u8 pad_len = 0;
 	u8 *pos = NULL;
 	u8 pkt_type;
 
@@ -86,12 +86,7 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 
 	pkt_type = hci_skb_pkt_type(skb);
 
-	if (skb_headroom(skb) < pad_len) {
-		/* Headroom is not sufficient */
-		realloc_skb = 1;
-	}
-
-	if (realloc_skb || !IS_ALIGNED((unsigned long) skb->data, SKB_DATA_ADDR_ALIGNMENT)) {
+	if (!IS_ALIGNED((unsigned long) skb->data, SKB_DATA_ADDR_ALIGNMENT)) {
 		/* Realloc SKB */
 		if (skb_linearize(skb)) {
 			hdev->stat.err_tx++;
@@ -118,7 +113,13 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 		dev_kfree_skb_any(skb);
 		skb = new_skb;
 	} else {
-		/* Realloc is not needed, Make space for interface header */
+		/* Reallocate only head, if headroom is short or shared with clone */
+		if (skb_cow_head(skb, pad_len)) {
+			hdev->stat.err_tx++;
+			return -ENOMEM;
+		}
+
+		/* Make space for interface header */
 		skb_push(skb, pad_len);
 	}
 
@@ -126,6 +127,9 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 
 	memset(hdr, 0, sizeof(struct esp_payload_header));
 
+	/* cb still holds bt_skb_cb, which transport would take for esp_skb_cb */
+	memset(skb->cb, 0, sizeof(struct esp_skb_cb));
+
 	hdr->if_type = ESP_HCI_IF;
 	hdr->if_num = 0;
 	hdr->len = cpu_to_le16(len);
@@ -136,7 +140,7 @@ static ESP_BT_SEND_FRAME_PROTOTYPE()
 	*(pos + pad_len - 1) = pkt_type;
 
 	if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
-		hdr->checksum = cpu_to_le16(compute_checksum(skb->data, (len + pad_len)));
+		hdr->checksum = cpu_to_le16(esp_compute_checksum(adapter, skb->data, (len + pad_len)));
 
 	ret = esp_send_packet(adapter, skb);
 
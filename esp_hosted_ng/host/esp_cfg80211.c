@@ -113,6 +113,27 @@ static const struct wiphy_wowlan_support esp_wowlan_support = {
 	.max_pkt_offset = 0,
 };
 
+/* One station and one SoftAP, sharing the single radio channel */
+static const struct ieee80211_iface_limit esp_iface_limits[] = {
+	{
+		.max = 1,
+		.types = BIT(NL80211_IFTYPE_STATION),
+	},
+	{
+		.max = 1,
+		.types = BIT(NL80211_IFTYPE_AP),
+	},
+};
+
+static const struct ieee80211_iface_combination esp_iface_combinations[] = {
+	{
+		.limits = esp_iface_limits,
+		.n_limits = ARRAY_SIZE(esp_iface_limits),
+		.max_interfaces = ESP_MAX_INTERFACE,
+		.num_different_channels = 1,
+	},
+};
+
 static int esp_inetaddr_event(struct notifier_block *nb,
 	unsigned long event, void *data)
 {
@@ -157,6 +178,7 @@ struct wireless_dev *esp_cfg80211_add_iface(struct wiphy *wiphy,
 	struct net_device *ndev;
 	struct esp_wifi_device *esp_wdev;
 	uint8_t esp_nw_if_num = 0;
+	uint8_t esp_if_type = ESP_STA_IF;
 
 	if (!wiphy || !name) {
 		esp_info("%u invalid input\n", __LINE__);
@@ -172,16 +194,18 @@ struct wireless_dev *esp_cfg80211_add_iface(struct wiphy *wiphy,
 
 	if (type == NL80211_IFTYPE_STATION) {
 		esp_nw_if_num = ESP_STA_NW_IF;
+		esp_if_type = ESP_STA_IF;
 	} else if (type == NL80211_IFTYPE_AP) {
 		esp_nw_if_num = ESP_AP_NW_IF;
+		esp_if_type = ESP_AP_IF;
 	} else {
 		esp_info("%u network type[%u] is not supported\n",
 				 __LINE__, type);
 		return NULL;
 	}
 
-	ndev = ALLOC_NETDEV(sizeof(struct esp_wifi_device), name, name_assign_type,
-			ether_setup);
+	ndev = ALLOC_NETDEV_MQS(sizeof(struct esp_wifi_device), name, name_assign_type,
+			ether_setup, ESP_NET_TX_QUEUES, 1);
 
 	if (!ndev)
 		return ERR_PTR(-ENOMEM);
@@ -194,6 +218,8 @@ struct wireless_dev *esp_cfg80211_add_iface(struct wiphy *wiphy,
 	esp_wdev->esp_dev = esp_dev;
 	esp_wdev->ndev = ndev;
 	esp_wdev->adapter = esp_dev->adapter;
+	esp_wdev->if_type = esp_if_type;
+	esp_wdev->if_num = 0;
 	esp_wdev->adapter->priv[esp_nw_if_num] = esp_wdev;
 	/*esp_info("Updated priv[%u] to %px\n",
 	 * esp_nw_if_num, esp_wdev->adapter->priv[esp_nw_if_num]);*/
@@ -219,22 +245,26 @@ struct wireless_dev *esp_cfg80211_add_iface(struct wiphy *wiphy,
 	if (register_netdevice(ndev))
 		goto free_and_return;
 
+	esp_publish_rx_priv(esp_wdev);
 
 	set_bit(ESP_NETWORK_UP, &esp_wdev->priv_flags);
 	clear_bit(ESP_CLEANUP_IN_PROGRESS, &esp_dev->adapter->state_flags);
 
-	esp_wdev->nb.notifier_call = esp_inetaddr_event;
-	register_inetaddr_notifier(&esp_wdev->nb);
+	/* IP address is of interest to firmware only for station */
+	if (esp_if_type == ESP_STA_IF) {
+		esp_wdev->nb.notifier_call = esp_inetaddr_event;
+		register_inetaddr_notifier(&esp_wdev->nb);
+	}
 
 	return &esp_wdev->wdev;
 
 free_and_return:
-	clear_bit(ESP_DRIVER_ACTIVE, &esp_wdev->adapter->state_flags);
+	/* Other interface may still be up, keep driver active for it */
+	esp_dev->adapter->priv[esp_nw_if_num] = NULL;
+	if (!esp_dev->adapter->priv[ESP_STA_NW_IF] && !esp_dev->adapter->priv[ESP_AP_NW_IF])
+		clear_bit(ESP_DRIVER_ACTIVE, &esp_dev->adapter->state_flags);
 	dev_net_set(ndev, NULL);
 	free_netdev(ndev);
-	esp_wdev->ndev = NULL;
-	esp_wdev->wdev.netdev = NULL;
-	ndev = NULL;
 	return NULL;
 }
 
@@ -554,6 +584,65 @@ static int esp_cfg80211_set_tx_power(struct wiphy *wiphy,
 	return cmd_set_tx_power(priv, priv->tx_pwr);
 }
 
+static int esp_cfg80211_start_ap(struct wiphy *wiphy, struct net_device *dev,
+		struct cfg80211_ap_settings *settings)
+{
+	struct esp_wifi_device *priv = NULL;
+	int ret = 0;
+
+	if (!wiphy || !dev || !settings) {
+		esp_info("%u invalid input\n", __LINE__);
+		return -EINVAL;
+	}
+
+	priv = netdev_priv(dev);
+
+	if (!priv || priv->if_type != ESP_AP_IF) {
+		esp_err("Not an AP interface\n");
+		return -EINVAL;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	if (settings->privacy && !settings->crypto.psk) {
+#else
+	if (settings->privacy) {
+#endif
+		/* Firmware runs the 4-way handshake, only PSK can be offloaded */
+		esp_err("SoftAP security supported only with PSK offload\n");
+		return -EOPNOTSUPP;
+	}
+
+	ret = cmd_ap_config(priv, settings);
+	if (ret)
+		return ret;
+
+	esp_port_open(priv);
+
+	return 0;
+}
+
+static int esp_cfg80211_stop_ap(struct wiphy *wiphy, struct net_device *dev
+		STOP_AP_LINK_ID)
+{
+	struct esp_wifi_device *priv = NULL;
+
+	if (!wiphy || !dev) {
+		esp_info("%u invalid input\n", __LINE__);
+		return -EINVAL;
+	}
+
+	priv = netdev_priv(dev);
+
+	if (!priv || priv->if_type != ESP_AP_IF) {
+		esp_err("Not an AP interface\n");
+		return -EINVAL;
+	}
+
+	esp_port_close(priv);
+
+	return cmd_ap_stop(priv);
+}
+
 static int esp_cfg80211_get_tx_power(struct wiphy *wiphy,
 				     struct wireless_dev *wdev,
 				     int *dbm)
@@ -600,6 +689,8 @@ static struct cfg80211_ops esp_cfg80211_ops = {
 	.set_wakeup = esp_cfg80211_set_wakeup,
 	.set_tx_power = esp_cfg80211_set_tx_power,
 	.get_tx_power = esp_cfg80211_get_tx_power,
+	.start_ap = esp_cfg80211_start_ap,
+	.stop_ap = esp_cfg80211_stop_ap,
 };
 
 int esp_cfg80211_register(struct esp_adapter *adapter)
@@ -625,7 +716,16 @@ int esp_cfg80211_register(struct esp_adapter *adapter)
 
 	set_wiphy_dev(wiphy, esp_dev->dev);
 
-	wiphy->interface_modes = BIT(NL80211_IFTYPE_STATION);
+	wiphy->interface_modes = BIT(NL80211_IFTYPE_STATION) | BIT(NL80211_IFTYPE_AP);
+	wiphy->iface_combinations = esp_iface_combinations;
+	wiphy->n_iface_combinations = ARRAY_SIZE(esp_iface_combinations);
+
+	/* SoftAP association and key handshake are done by firmware */
+	wiphy->flags |= WIPHY_FLAG_HAVE_AP_SME;
+	wiphy->max_ap_assoc_sta = ESP_AP_MAX_STATIONS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	wiphy_ext_feature_set(wiphy, NL80211_EXT_FEATURE_4WAY_HANDSHAKE_AP_PSK);
+#endif
 	wiphy->bands[NL80211_BAND_2GHZ] = &esp_wifi_bands;
 
 	/* Initialize cipher suits */
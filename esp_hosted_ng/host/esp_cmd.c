@@ -13,10 +13,14 @@
 #include "esp_cfg80211.h"
 #include "esp_kernel_port.h"
 
+#define CREATE_TRACE_POINTS
+#include "esp_trace.h"
+
 #define PRINT_HEXDUMP(STR, ARG, ARG_LEN, level) \
 	print_hex_dump(KERN_INFO, STR, DUMP_PREFIX_ADDRESS, 16, 1, ARG, ARG_LEN, 1);
 
 #define COMMAND_RESPONSE_TIMEOUT (5 * HZ)
+#define COMMAND_RESPONSE_SHORT_TIMEOUT (2 * HZ)
 u8 ap_bssid[MAC_ADDR_LEN];
 
 int internal_scan_request(struct esp_wifi_device *priv, char *ssid,
@@ -67,12 +71,18 @@ static inline void reset_cmd_node(struct esp_adapter *adapter, struct command_no
 static void queue_cmd_node(struct esp_adapter *adapter,
 		struct command_node *cmd_node, u8 flag_high_prio)
 {
+	trace_esp_cmd_queued(cmd_node->cmd_code, flag_high_prio);
+
+	/* Plain list, only ever accessed under cmd_pending_queue_lock */
 	spin_lock_bh(&adapter->cmd_pending_queue_lock);
 
+	cmd_node->state = ESP_CMD_QUEUED;
+	cmd_node->queued_time = ktime_get();
+
 	if (flag_high_prio)
-		list_add_rcu(&cmd_node->list, &adapter->cmd_pending_queue);
+		list_add(&cmd_node->list, &adapter->cmd_pending_queue);
 	else
-		list_add_tail_rcu(&cmd_node->list, &adapter->cmd_pending_queue);
+		list_add_tail(&cmd_node->list, &adapter->cmd_pending_queue);
 
 	spin_unlock_bh(&adapter->cmd_pending_queue_lock);
 }
@@ -174,6 +184,50 @@ static void recycle_cmd_node(struct esp_adapter *adapter,
 }
 
 
+/* Take cmd_node back from whichever queue it is in. Returns true if
+ * response for it was received */
+static bool reclaim_cmd_node(struct esp_adapter *adapter,
+		struct command_node *cmd_node)
+{
+	bool done = false;
+
+	spin_lock_bh(&adapter->cmd_lock);
+
+	if (cmd_node->state != ESP_CMD_DONE)
+		trace_esp_cmd_timeout(cmd_node->cmd_code, cmd_node->seq_num, cmd_node->state);
+
+	switch (cmd_node->state) {
+	case ESP_CMD_QUEUED:
+		spin_lock_bh(&adapter->cmd_pending_queue_lock);
+		list_del(&cmd_node->list);
+		spin_unlock_bh(&adapter->cmd_pending_queue_lock);
+
+		/* Never sent */
+		dev_kfree_skb_any(cmd_node->cmd_skb);
+		cmd_node->cmd_skb = NULL;
+		break;
+
+	case ESP_CMD_INFLIGHT:
+		/* Late response, if any, is dropped as unexpected */
+		list_del(&cmd_node->list);
+		adapter->cmd_inflight--;
+		break;
+
+	case ESP_CMD_DONE:
+		done = true;
+		break;
+	}
+
+	cmd_node->state = ESP_CMD_IDLE;
+	spin_unlock_bh(&adapter->cmd_lock);
+
+	/* Window slot freed, let next command go */
+	if (!done)
+		queue_work(adapter->cmd_wq, &adapter->cmd_work);
+
+	return done;
+}
+
 static int wait_and_decode_cmd_resp(struct esp_wifi_device *priv,
 		struct command_node *cmd_node)
 {
@@ -193,25 +247,20 @@ static int wait_and_decode_cmd_resp(struct esp_wifi_device *priv,
 	adapter = priv->adapter;
 
 	/* wait for command response */
-	ret = wait_event_interruptible_timeout(adapter->wait_for_cmd_resp,
-			adapter->cmd_resp == cmd_node->cmd_code, COMMAND_RESPONSE_TIMEOUT);
+	wait_event_interruptible_timeout(adapter->wait_for_cmd_resp,
+			READ_ONCE(cmd_node->state) == ESP_CMD_DONE, cmd_node->timeout);
 
 	if (!test_bit(ESP_DRIVER_ACTIVE, &adapter->state_flags))
 		return 0;
 
-	if (ret == 0) {
-		esp_err("Command[%u] timed out\n", cmd_node->cmd_code);
+	if (!reclaim_cmd_node(adapter, cmd_node)) {
+		esp_err("Command[%u] seq %u timed out\n", cmd_node->cmd_code, cmd_node->seq_num);
 		ret = -EINVAL;
 	} else {
 		/*esp_dbg("Resp for command [%u]\n", cmd_node->cmd_code);*/
 		ret = 0;
 	}
 
-	spin_lock_bh(&adapter->cmd_lock);
-	adapter->cur_cmd = NULL;
-	adapter->cmd_resp = 0;
-	spin_unlock_bh(&adapter->cmd_lock);
-
 	switch (cmd_node->cmd_code) {
 
 	case CMD_SCAN_REQUEST:
@@ -233,6 +282,8 @@ static int wait_and_decode_cmd_resp(struct esp_wifi_device *priv,
 	case CMD_SET_DEFAULT_KEY:
 	case CMD_SET_IP_ADDR:
 	case CMD_SET_MCAST_MAC_ADDR:
+	case CMD_AP_CONFIG:
+	case CMD_AP_STOP:
 		/* intentional fallthrough */
 		if (ret == 0)
 			ret = decode_common_resp(cmd_node);
@@ -309,9 +360,12 @@ static int alloc_esp_cmd_pool(struct esp_adapter *adapter)
 static void esp_cmd_work(struct work_struct *work)
 {
 	int ret;
+	u8 window = 1;
+	bool wake = false;
 	struct command_node *cmd_node = NULL;
 	struct esp_adapter *adapter = NULL;
 	struct esp_payload_header *payload_header = NULL;
+	struct command_header *cmd = NULL;
 
 	adapter = esp_get_adapter();
 
@@ -321,72 +375,66 @@ static void esp_cmd_work(struct work_struct *work)
 	if (!test_bit(ESP_DRIVER_ACTIVE, &adapter->state_flags))
 		return;
 
-	synchronize_rcu();
-	spin_lock_bh(&adapter->cmd_lock);
-	if (adapter->cur_cmd) {
-		/* Busy in another command */
-		/*esp_dbg("Busy in another cmd execution\n");*/
-		spin_unlock_bh(&adapter->cmd_lock);
-		return;
-	}
+	/* Without seq_num echo, response matches only with single outstanding command */
+	if (adapter->ext_capabilities & ESP_CMD_SEQ_NUM_SUPPORT)
+		window = adapter->cmd_window;
 
+	spin_lock_bh(&adapter->cmd_lock);
 	spin_lock_bh(&adapter->cmd_pending_queue_lock);
 
-	if (list_empty(&adapter->cmd_pending_queue)) {
-		/* No command to process */
-		/*esp_dbg("No more command in queue.\n");*/
-		spin_unlock_bh(&adapter->cmd_pending_queue_lock);
-		spin_unlock_bh(&adapter->cmd_lock);
-		return;
-	}
+	while (adapter->cmd_inflight < window &&
+	       !list_empty(&adapter->cmd_pending_queue)) {
 
-	cmd_node = list_first_entry(&adapter->cmd_pending_queue,
-				    struct command_node, list);
-	if (!cmd_node) {
-		esp_dbg("cmd node NULL\n");
-		spin_unlock_bh(&adapter->cmd_pending_queue_lock);
-		spin_unlock_bh(&adapter->cmd_lock);
-		return;
-	}
-	/*esp_dbg("Processing Command [0x%X]\n", cmd_node->cmd_code);*/
+		cmd_node = list_first_entry(&adapter->cmd_pending_queue,
+					    struct command_node, list);
+		/*esp_dbg("Processing Command [0x%X]\n", cmd_node->cmd_code);*/
 
-	list_del(&cmd_node->list);
+		list_del(&cmd_node->list);
 
-	if (!cmd_node->cmd_skb) {
-		esp_dbg("cmd_node->cmd_skb NULL\n");
-		spin_unlock_bh(&adapter->cmd_pending_queue_lock);
-		spin_unlock_bh(&adapter->cmd_lock);
-		return;
-	}
+		if (!cmd_node->cmd_skb) {
+			esp_dbg("cmd_node->cmd_skb NULL\n");
+			cmd_node->state = ESP_CMD_DONE;
+			wake = true;
+			continue;
+		}
 
-	/* Set as current cmd */
-	adapter->cur_cmd = cmd_node;
+		payload_header = (struct esp_payload_header *)cmd_node->cmd_skb->data;
+		cmd = (struct command_header *) (cmd_node->cmd_skb->data +
+				le16_to_cpu(payload_header->offset));
 
-	adapter->cmd_resp = 0;
+		cmd_node->seq_num = ++adapter->cmd_seq_num;
+		cmd->seq_num = cpu_to_le16(cmd_node->seq_num);
 
-	payload_header = (struct esp_payload_header *)cmd_node->cmd_skb->data;
-	if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
-		payload_header->checksum = cpu_to_le16(compute_checksum(cmd_node->cmd_skb->data,
-					payload_header->len+payload_header->offset));
+		if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
+			payload_header->checksum = cpu_to_le16(esp_compute_checksum(adapter, cmd_node->cmd_skb->data,
+						payload_header->len+payload_header->offset));
 
-	ret = esp_send_packet(adapter, cmd_node->cmd_skb);
-	spin_unlock_bh(&adapter->cmd_lock);
+		/* Response could arrive even before send returns */
+		list_add_tail(&cmd_node->list, &adapter->cmd_inflight_queue);
+		cmd_node->state = ESP_CMD_INFLIGHT;
+		adapter->cmd_inflight++;
 
-	if (ret) {
-		esp_err("Failed to send command [0x%X]\n", cmd_node->cmd_code);
-		adapter->cur_cmd = NULL;
-		spin_unlock_bh(&adapter->cmd_pending_queue_lock);
-		recycle_cmd_node(adapter, cmd_node);
-		return;
-	}
+		trace_esp_cmd_sent(cmd_node->cmd_code, cmd_node->seq_num,
+				cmd_node->queued_time, adapter->cmd_inflight);
+		cmd_node->sent_time = ktime_get();
 
-	if (!list_empty(&adapter->cmd_pending_queue)) {
-		/*esp_dbg("Ym2: Pending cmds, queue work again\n");*/
-		spin_unlock_bh(&adapter->cmd_pending_queue_lock);
-		queue_work(adapter->cmd_wq, &adapter->cmd_work);
-		return;
+		ret = esp_send_packet(adapter, cmd_node->cmd_skb);
+
+		if (ret) {
+			esp_err("Failed to send command [0x%X]\n", cmd_node->cmd_code);
+			list_del(&cmd_node->list);
+			adapter->cmd_inflight--;
+			cmd_node->state = ESP_CMD_DONE;
+			wake = true;
+		}
 	}
+
 	spin_unlock_bh(&adapter->cmd_pending_queue_lock);
+	spin_unlock_bh(&adapter->cmd_lock);
+
+	/* Waiter finds no resp_skb and fails the command */
+	if (wake)
+		wake_up_interruptible(&adapter->wait_for_cmd_resp);
 }
 
 static int create_cmd_wq(struct esp_adapter *adapter)
@@ -409,6 +457,27 @@ static void destroy_cmd_wq(struct esp_adapter *adapter)
 	}
 }
 
+static unsigned long cmd_resp_timeout(u8 cmd_code)
+{
+	switch (cmd_code) {
+
+	case CMD_ADD_KEY:
+	case CMD_DEL_KEY:
+	case CMD_SET_DEFAULT_KEY:
+	case CMD_SET_IP_ADDR:
+	case CMD_SET_MCAST_MAC_ADDR:
+	case CMD_GET_MAC:
+	case CMD_SET_MAC:
+	case CMD_GET_TXPOWER:
+	case CMD_SET_TXPOWER:
+		/* Served locally by ESP, nothing goes over the air */
+		return COMMAND_RESPONSE_SHORT_TIMEOUT;
+
+	default:
+		return COMMAND_RESPONSE_TIMEOUT;
+	}
+}
+
 struct command_node *prepare_command_request(struct esp_adapter *adapter, u8 cmd_code, u16 len)
 {
 	struct command_header *cmd;
@@ -433,6 +502,7 @@ struct command_node *prepare_command_request(struct esp_adapter *adapter, u8 cmd
 	}
 
 	node->cmd_code = cmd_code;
+	node->timeout = cmd_resp_timeout(cmd_code);
 
 	len += sizeof(struct esp_payload_header);
 
@@ -452,8 +522,22 @@ struct command_node *prepare_command_request(struct esp_adapter *adapter, u8 cmd
 	return node;
 }
 
+/* Commands default to station, retarget the ones meant for interface of priv */
+static void set_cmd_iface(struct esp_wifi_device *priv, struct command_node *cmd_node)
+{
+	struct esp_payload_header *payload_header =
+		(struct esp_payload_header *) cmd_node->cmd_skb->data;
+
+	payload_header->if_type = priv->if_type;
+	payload_header->if_num = priv->if_num;
+}
+
 int process_cmd_resp(struct esp_adapter *adapter, struct sk_buff *skb)
 {
+	struct command_node *cmd_node = NULL, *node = NULL;
+	struct command_header *header = NULL;
+	u16 seq_num;
+
 	if (!skb || !adapter) {
 		esp_err("CMD resp: invalid!\n");
 
@@ -463,15 +547,39 @@ int process_cmd_resp(struct esp_adapter *adapter, struct sk_buff *skb)
 		return -1;
 	}
 
-	if (!adapter->cur_cmd) {
-		esp_err("Command response not expected\n");
+	header = (struct command_header *) skb->data;
+	seq_num = le16_to_cpu(header->seq_num);
+
+	spin_lock_bh(&adapter->cmd_lock);
+
+	list_for_each_entry(node, &adapter->cmd_inflight_queue, list) {
+		if (node->cmd_code != header->cmd_code)
+			continue;
+
+		/* ESP without seq_num echo has only one command outstanding */
+		if (node->seq_num == seq_num ||
+		    !(adapter->ext_capabilities & ESP_CMD_SEQ_NUM_SUPPORT)) {
+			cmd_node = node;
+			break;
+		}
+	}
+
+	if (!cmd_node) {
+		spin_unlock_bh(&adapter->cmd_lock);
+		esp_err("Command response [0x%x] seq %u not expected\n",
+				header->cmd_code, seq_num);
 		dev_kfree_skb_any(skb);
 		return -1;
 	}
 
-	spin_lock_bh(&adapter->cmd_lock);
-	adapter->cur_cmd->resp_skb = skb;
-	adapter->cmd_resp = adapter->cur_cmd->cmd_code;
+	list_del(&cmd_node->list);
+	adapter->cmd_inflight--;
+	cmd_node->resp_skb = skb;
+	cmd_node->state = ESP_CMD_DONE;
+
+	trace_esp_cmd_resp(cmd_node->cmd_code, seq_num, header->cmd_status,
+			cmd_node->sent_time);
+
 	spin_unlock_bh(&adapter->cmd_lock);
 
 
@@ -1193,6 +1301,8 @@ int cmd_init_interface(struct esp_wifi_device *priv)
 		return -ENOMEM;
 	}
 
+	set_cmd_iface(priv, cmd_node);
+
 	queue_cmd_node(priv->adapter, cmd_node, ESP_CMD_DFLT_PRIO);
 	queue_work(priv->adapter->cmd_wq, &priv->adapter->cmd_work);
 
@@ -1223,6 +1333,8 @@ int cmd_deinit_interface(struct esp_wifi_device *priv)
 		return -ENOMEM;
 	}
 
+	set_cmd_iface(priv, cmd_node);
+
 	queue_cmd_node(priv->adapter, cmd_node, ESP_CMD_DFLT_PRIO);
 	queue_work(priv->adapter->cmd_wq, &priv->adapter->cmd_work);
 
@@ -1375,6 +1487,8 @@ int cmd_get_mac(struct esp_wifi_device *priv)
 		return -ENOMEM;
 	}
 
+	set_cmd_iface(priv, cmd_node);
+
 	queue_cmd_node(priv->adapter, cmd_node, ESP_CMD_DFLT_PRIO);
 	queue_work(priv->adapter->cmd_wq, &priv->adapter->cmd_work);
 
@@ -1407,6 +1521,91 @@ int cmd_set_mac(struct esp_wifi_device *priv, uint8_t *mac_addr)
 				sizeof(struct esp_payload_header));
 
 	memcpy(cmd->mac_addr, mac_addr, MAC_ADDR_LEN);
+	set_cmd_iface(priv, cmd_node);
+	queue_cmd_node(priv->adapter, cmd_node, ESP_CMD_DFLT_PRIO);
+	queue_work(priv->adapter->cmd_wq, &priv->adapter->cmd_work);
+
+	RET_ON_FAIL(wait_and_decode_cmd_resp(priv, cmd_node));
+
+	return 0;
+}
+
+int cmd_ap_config(struct esp_wifi_device *priv,
+		struct cfg80211_ap_settings *settings)
+{
+	u16 cmd_len;
+	struct command_node *cmd_node = NULL;
+	struct cmd_ap_config *cmd;
+
+	if (!priv || !priv->adapter || !settings || !settings->chandef.chan) {
+		esp_err("Invalid argument\n");
+		return -EINVAL;
+	}
+
+	if (!settings->ssid_len || settings->ssid_len > MAX_SSID_LEN) {
+		esp_err("Invalid SSID len %zu\n", settings->ssid_len);
+		return -EINVAL;
+	}
+
+	cmd_len = sizeof(struct cmd_ap_config);
+
+	cmd_node = prepare_command_request(priv->adapter, CMD_AP_CONFIG, cmd_len);
+
+	if (!cmd_node) {
+		esp_err("Failed to get command node\n");
+		return -ENOMEM;
+	}
+
+	set_cmd_iface(priv, cmd_node);
+
+	cmd = (struct cmd_ap_config *) (cmd_node->cmd_skb->data +
+				sizeof(struct esp_payload_header));
+
+	memcpy(cmd->ssid, settings->ssid, settings->ssid_len);
+	cmd->ssid_len = settings->ssid_len;
+	cmd->channel = settings->chandef.chan->hw_value;
+	cmd->beacon_interval = cpu_to_le16(settings->beacon_interval);
+	cmd->hidden_ssid = (settings->hidden_ssid != NL80211_HIDDEN_SSID_NOT_IN_USE);
+	cmd->max_connections = ESP_AP_MAX_STATIONS;
+	cmd->authmode = ESP_AP_AUTH_OPEN;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+	/* 4-way handshake runs in firmware, hand it the PSK */
+	if (settings->privacy && settings->crypto.psk) {
+		cmd->authmode = ESP_AP_AUTH_WPA2_PSK;
+		bin2hex(cmd->passphrase, settings->crypto.psk, WLAN_PMK_LEN);
+	}
+#endif
+
+	queue_cmd_node(priv->adapter, cmd_node, ESP_CMD_DFLT_PRIO);
+	queue_work(priv->adapter->cmd_wq, &priv->adapter->cmd_work);
+
+	RET_ON_FAIL(wait_and_decode_cmd_resp(priv, cmd_node));
+
+	return 0;
+}
+
+int cmd_ap_stop(struct esp_wifi_device *priv)
+{
+	u16 cmd_len;
+	struct command_node *cmd_node = NULL;
+
+	if (!priv || !priv->adapter) {
+		esp_err("Invalid argument\n");
+		return -EINVAL;
+	}
+
+	cmd_len = sizeof(struct command_header);
+
+	cmd_node = prepare_command_request(priv->adapter, CMD_AP_STOP, cmd_len);
+
+	if (!cmd_node) {
+		esp_err("Failed to get command node\n");
+		return -ENOMEM;
+	}
+
+	set_cmd_iface(priv, cmd_node);
+
 	queue_cmd_node(priv->adapter, cmd_node, ESP_CMD_DFLT_PRIO);
 	queue_work(priv->adapter->cmd_wq, &priv->adapter->cmd_work);
 
@@ -1461,6 +1660,7 @@ int esp_commands_setup(struct esp_adapter *adapter)
 	spin_lock_init(&adapter->cmd_lock);
 
 	INIT_LIST_HEAD(&adapter->cmd_pending_queue);
+	INIT_LIST_HEAD(&adapter->cmd_inflight_queue);
 	INIT_LIST_HEAD(&adapter->cmd_free_queue);
 
 	spin_lock_init(&adapter->cmd_pending_queue_lock);
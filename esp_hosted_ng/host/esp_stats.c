@@ -7,6 +7,9 @@
  */
 
 #include "utils.h"
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
 #include "esp_stats.h"
 
 #if TEST_RAW_TP
@@ -82,7 +85,7 @@ static int raw_tp_tx_process(void *data)
 
 			if (adapter->capabilities & ESP_CHECKSUM_ENABLED) {
 				payload_header->checksum =
-					cpu_to_le16(compute_checksum(tx_skb->data,
+					cpu_to_le16(esp_compute_checksum(adapter, tx_skb->data,
 								(TEST_RAW_TP__BUF_SIZE + pad_len)));
 			}
 			ret = esp_send_packet(esp_get_adapter(), tx_skb);
@@ -198,3 +201,108 @@ void process_test_capabilities(u8 cap)
 	process_raw_tp_flags();
 #endif
 }
+
+void esp_update_rx_napi_stats(struct esp_adapter *adapter, int work_done, int budget)
+{
+	struct esp_rx_napi_stats *stats = &adapter->rx_napi_stats;
+	u8 bucket = 0;
+
+	if (work_done)
+		bucket = min_t(int, fls(work_done), ESP_NAPI_BATCH_BUCKETS - 1);
+
+	stats->polls++;
+	stats->packets += work_done;
+	stats->batch_hist[bucket]++;
+
+	if (work_done >= budget)
+		stats->budget_exhausted++;
+}
+
+static int esp_rx_napi_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const bucket_str[ESP_NAPI_BATCH_BUCKETS] = {
+		"0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64+"
+	};
+	struct esp_adapter *adapter = s->private;
+	struct esp_rx_napi_stats *stats = &adapter->rx_napi_stats;
+	u8 i = 0;
+
+	seq_printf(s, "polls:            %llu\n", stats->polls);
+	seq_printf(s, "packets:          %llu\n", stats->packets);
+	seq_printf(s, "budget exhausted: %llu\n", stats->budget_exhausted);
+	seq_puts(s, "batch size histogram:\n");
+
+	for (i = 0; i < ESP_NAPI_BATCH_BUCKETS; i++)
+		seq_printf(s, "  %-6s %llu\n", bucket_str[i], stats->batch_hist[i]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(esp_rx_napi_stats);
+
+void esp_update_tx_latency_stats(struct esp_adapter *adapter, ktime_t enqueue_time)
+{
+	struct esp_tx_latency_stats *stats = &adapter->tx_latency_stats;
+	u64 latency_us = ktime_us_delta(ktime_get(), enqueue_time);
+	u8 bucket = 0;
+
+	if (latency_us)
+		bucket = min_t(int, fls64(latency_us), ESP_TX_LATENCY_BUCKETS - 1);
+
+	stats->packets++;
+	stats->total_us += latency_us;
+	stats->latency_hist[bucket]++;
+
+	if (latency_us > stats->max_us)
+		stats->max_us = latency_us;
+}
+
+static int esp_tx_latency_stats_show(struct seq_file *s, void *unused)
+{
+	struct esp_adapter *adapter = s->private;
+	struct esp_tx_latency_stats *stats = &adapter->tx_latency_stats;
+	u64 low = 0, high = 0;
+	u8 i = 0;
+
+	seq_printf(s, "packets:  %llu\n", stats->packets);
+	seq_printf(s, "avg (us): %llu\n",
+			stats->packets ? div64_u64(stats->total_us, stats->packets) : 0);
+	seq_printf(s, "max (us): %llu\n", stats->max_us);
+	seq_puts(s, "latency histogram (us):\n");
+
+	for (i = 0; i < ESP_TX_LATENCY_BUCKETS; i++) {
+		low = i ? 1ULL << (i - 1) : 0;
+		high = (1ULL << i) - 1;
+
+		if (i < ESP_TX_LATENCY_BUCKETS - 1)
+			seq_printf(s, "  %6llu-%-6llu %llu\n", low, high, stats->latency_hist[i]);
+		else
+			seq_printf(s, "  %6llu+       %llu\n", low, stats->latency_hist[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(esp_tx_latency_stats);
+
+void esp_debugfs_init(struct esp_adapter *adapter)
+{
+	adapter->debugfs_dir = debugfs_create_dir("esp32", NULL);
+
+	if (IS_ERR_OR_NULL(adapter->debugfs_dir)) {
+		adapter->debugfs_dir = NULL;
+		return;
+	}
+
+	debugfs_create_file("rx_napi_stats", 0444, adapter->debugfs_dir,
+			adapter, &esp_rx_napi_stats_fops);
+	debugfs_create_file("tx_latency", 0444, adapter->debugfs_dir,
+			adapter, &esp_tx_latency_stats_fops);
+
+	esp_tx_selftest_init(adapter);
+}
+
+void esp_debugfs_deinit(struct esp_adapter *adapter)
+{
+	esp_tx_selftest_deinit();
+	debugfs_remove_recursive(adapter->debugfs_dir);
+	adapter->debugfs_dir = NULL;
+}
@@ -0,0 +1,292 @@
+/*
+ * Espressif Systems Wireless LAN device driver
+ *
+ * SPDX-FileCopyrightText: 2015-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/* Stress of esp_tx_queue, off transport. Writing packet count to debugfs
+ * tx_queue_selftest starts kthread per online CPU, each pushing that many
+ * skbs to one shared queue, while single consumer drains it. Producers
+ * wake consumer the way transports do, only on first staged skb and only
+ * if consumer sleeps. Reading file shows counters of last run */
+
+#include "utils.h"
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include "esp_stats.h"
+
+#define ESP_TX_SELFTEST_MAX_PKTS     10000000
+#define ESP_TX_SELFTEST_WAIT_MS      1000
+
+struct esp_tx_selftest_pkt {
+	u32 producer;
+	u32 seq;
+};
+
+struct esp_tx_selftest {
+	struct esp_tx_queue    q;
+	wait_queue_head_t      wq;
+	struct mutex           lock;
+	struct completion      done;
+	bool                   running;
+	u32                    pkts_per_cpu;
+	atomic_t               producers_left;
+	/* Next expected seq of each producer, consumer only */
+	u32                    *next_seq;
+	ktime_t                start;
+	ktime_t                end;
+	/* Producers */
+	atomic64_t             pushed;
+	atomic64_t             kicks;
+	atomic64_t             kicks_skipped;
+	atomic64_t             alloc_fails;
+	/* Consumer */
+	u64                    consumed;
+	u64                    order_errors;
+	/* Wait timed out with skbs staged, i.e. wakeup was lost */
+	u64                    stalls;
+};
+
+static struct esp_tx_selftest selftest;
+
+static int esp_tx_selftest_producer(void *data)
+{
+	struct esp_tx_selftest_pkt *pkt = NULL;
+	struct sk_buff *skb = NULL;
+	u32 producer = (uintptr_t)data;
+	u32 seq = 0;
+
+	for (seq = 0; seq < selftest.pkts_per_cpu; seq++) {
+		skb = alloc_skb(sizeof(*pkt), GFP_KERNEL);
+		if (!skb) {
+			atomic64_inc(&selftest.alloc_fails);
+			continue;
+		}
+
+		pkt = skb_put(skb, sizeof(*pkt));
+		pkt->producer = producer;
+		pkt->seq = seq;
+
+		atomic64_inc(&selftest.pushed);
+
+		if (esp_tx_queue_push(&selftest.q, skb) && wq_has_sleeper(&selftest.wq)) {
+			atomic64_inc(&selftest.kicks);
+			wake_up(&selftest.wq);
+		} else {
+			atomic64_inc(&selftest.kicks_skipped);
+		}
+
+		cond_resched();
+	}
+
+	/* Last one out makes sure consumer sees it */
+	if (atomic_dec_and_test(&selftest.producers_left))
+		wake_up(&selftest.wq);
+
+	return 0;
+}
+
+static void esp_tx_selftest_consume(struct sk_buff *skb)
+{
+	struct esp_tx_selftest_pkt *pkt = (struct esp_tx_selftest_pkt *)skb->data;
+
+	/* Seqs lost to alloc failure leave gaps, so only order is checked */
+	if (pkt->seq < selftest.next_seq[pkt->producer])
+		selftest.order_errors++;
+
+	selftest.next_seq[pkt->producer] = pkt->seq + 1;
+	selftest.consumed++;
+
+	kfree_skb(skb);
+}
+
+static int esp_tx_selftest_consumer(void *data)
+{
+	struct sk_buff *skb = NULL;
+	long ret = 0;
+
+	for (;;) {
+		while ((skb = esp_tx_queue_dequeue(&selftest.q)))
+			esp_tx_selftest_consume(skb);
+
+		if (!atomic_read(&selftest.producers_left) &&
+		    esp_tx_queue_empty(&selftest.q))
+			break;
+
+		ret = wait_event_timeout(selftest.wq,
+				!esp_tx_queue_empty(&selftest.q) ||
+				!atomic_read(&selftest.producers_left),
+				msecs_to_jiffies(ESP_TX_SELFTEST_WAIT_MS));
+
+		/* Condition only found true once timeout expired */
+		if (ret == 1 && !esp_tx_queue_empty(&selftest.q))
+			selftest.stalls++;
+	}
+
+	selftest.end = ktime_get();
+	esp_info("Tx queue selftest: consumed %llu of %lld, order errors %llu, stalls %llu\n",
+			selftest.consumed, atomic64_read(&selftest.pushed),
+			selftest.order_errors, selftest.stalls);
+
+	kfree(selftest.next_seq);
+	selftest.next_seq = NULL;
+
+	mutex_lock(&selftest.lock);
+	selftest.running = false;
+	mutex_unlock(&selftest.lock);
+	complete(&selftest.done);
+
+	return 0;
+}
+
+static int esp_tx_selftest_start(u32 pkts_per_cpu)
+{
+	struct task_struct *task = NULL;
+	unsigned int cpu = 0;
+
+	selftest.next_seq = kcalloc(nr_cpu_ids, sizeof(u32), GFP_KERNEL);
+	if (!selftest.next_seq)
+		return -ENOMEM;
+
+	esp_tx_queue_init(&selftest.q);
+	selftest.pkts_per_cpu = pkts_per_cpu;
+	atomic64_set(&selftest.pushed, 0);
+	atomic64_set(&selftest.kicks, 0);
+	atomic64_set(&selftest.kicks_skipped, 0);
+	atomic64_set(&selftest.alloc_fails, 0);
+	selftest.consumed = 0;
+	selftest.order_errors = 0;
+	selftest.stalls = 0;
+	selftest.end = 0;
+	reinit_completion(&selftest.done);
+
+	/* Held back, so that queue can't drain before all producers exist */
+	atomic_set(&selftest.producers_left, 1);
+
+	selftest.start = ktime_get();
+
+	task = kthread_run(esp_tx_selftest_consumer, NULL, "esp_txq_consumer");
+	if (IS_ERR(task)) {
+		kfree(selftest.next_seq);
+		selftest.next_seq = NULL;
+		return PTR_ERR(task);
+	}
+
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		task = kthread_create(esp_tx_selftest_producer,
+				(void *)(uintptr_t)cpu, "esp_txq_prod/%u", cpu);
+		if (IS_ERR(task)) {
+			esp_err("Tx queue selftest: no producer on CPU %u\n", cpu);
+			continue;
+		}
+
+		kthread_bind(task, cpu);
+		atomic_inc(&selftest.producers_left);
+		wake_up_process(task);
+	}
+	cpus_read_unlock();
+
+	if (atomic_dec_and_test(&selftest.producers_left))
+		wake_up(&selftest.wq);
+
+	return 0;
+}
+
+static ssize_t esp_tx_selftest_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	u32 pkts_per_cpu = 0;
+	int ret = 0;
+
+	ret = kstrtou32_from_user(buf, count, 0, &pkts_per_cpu);
+	if (ret)
+		return ret;
+
+	if (!pkts_per_cpu || pkts_per_cpu > ESP_TX_SELFTEST_MAX_PKTS)
+		return -EINVAL;
+
+	mutex_lock(&selftest.lock);
+
+	if (selftest.running) {
+		mutex_unlock(&selftest.lock);
+		return -EBUSY;
+	}
+
+	ret = esp_tx_selftest_start(pkts_per_cpu);
+	if (!ret)
+		selftest.running = true;
+
+	mutex_unlock(&selftest.lock);
+
+	return ret ? ret : count;
+}
+
+static int esp_tx_selftest_show(struct seq_file *s, void *unused)
+{
+	ktime_t end = 0;
+
+	mutex_lock(&selftest.lock);
+	end = selftest.end;
+
+	seq_printf(s, "state:          %s\n", selftest.running ? "running" : "idle");
+	seq_printf(s, "pkts per cpu:   %u\n", selftest.pkts_per_cpu);
+	seq_printf(s, "pushed:         %lld\n", atomic64_read(&selftest.pushed));
+	seq_printf(s, "kicks:          %lld\n", atomic64_read(&selftest.kicks));
+	seq_printf(s, "kicks skipped:  %lld\n", atomic64_read(&selftest.kicks_skipped));
+	seq_printf(s, "alloc fails:    %lld\n", atomic64_read(&selftest.alloc_fails));
+
+	if (!selftest.running) {
+		seq_printf(s, "consumed:       %llu\n", selftest.consumed);
+		seq_printf(s, "order errors:   %llu\n", selftest.order_errors);
+		seq_printf(s, "stalls:         %llu\n", selftest.stalls);
+		seq_printf(s, "duration (us):  %lld\n",
+				end ? ktime_us_delta(end, selftest.start) : 0);
+	}
+
+	mutex_unlock(&selftest.lock);
+
+	return 0;
+}
+
+static int esp_tx_selftest_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, esp_tx_selftest_show, inode->i_private);
+}
+
+static const struct file_operations esp_tx_selftest_fops = {
+	.owner = THIS_MODULE,
+	.open = esp_tx_selftest_open,
+	.read = seq_read,
+	.write = esp_tx_selftest_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void esp_tx_selftest_init(struct esp_adapter *adapter)
+{
+	mutex_init(&selftest.lock);
+	init_waitqueue_head(&selftest.wq);
+	init_completion(&selftest.done);
+
+	debugfs_create_file("tx_queue_selftest", 0644, adapter->debugfs_dir,
+			adapter, &esp_tx_selftest_fops);
+}
+
+/* Run can't be stopped midway, producers are bounded */
+void esp_tx_selftest_deinit(void)
+{
+	bool running = false;
+
+	mutex_lock(&selftest.lock);
+	running = selftest.running;
+	mutex_unlock(&selftest.lock);
+
+	if (running)
+		wait_for_completion(&selftest.done);
+}
@@ -15,7 +15,14 @@
 
 /* ESP Payload Header Flags */
 #define MORE_FRAGMENT                   (1 << 0)
+/* Another esp_payload_header record follows in same SPI transaction */
+#define MORE_AGGR_RECORDS               (1 << 1)
+/* ESP found IPv4 header and TCP/UDP checksums of Rx frame valid */
+#define CSUM_VERIFIED                   (1 << 2)
+/* ESP to fill in TCP/UDP checksum of Tx frame, see ESP_TX_CSUM_OFFLOAD_SUPPORT */
+#define CSUM_FILL                       (1 << 3)
 #define MAX_SSID_LEN                    32
+#define MAX_PASSPHRASE_LEN              64
 
 #define MAX_MULTICAST_ADDR_COUNT        8
 
@@ -71,6 +78,13 @@ enum ESP_HOST_INTERRUPT {
 	ESP_RESET,
 	ESP_POWER_SAVE_ON,
 	ESP_POWER_SAVE_OFF,
+	/* Host is out of SDIO Tx buffers, interrupt on reload */
+	ESP_CREDIT_REQUEST,
+};
+
+/* ESP to host SDIO interrupt bits */
+enum ESP_SLAVE_INTERRUPT {
+	ESP_CREDIT_UPDATE,
 };
 
 enum ESP_CAPABILITIES {
@@ -89,8 +103,40 @@ typedef enum {
 	ESP_TEST_RAW_TP__ESP_TO_HOST = (1 << 1)
 } ESP_RAW_TP_MEASUREMENT;
 
+/* Carried in ESP_BOOTUP_EXT_CAPABILITY tag, as all bits of
+ * ESP_BOOTUP_CAPABILITY are in use. Host echoes accepted ones back
+ * with ESP_INTERNAL_HOST_CAPABILITY message */
+enum ESP_EXT_CAPABILITIES {
+	ESP_SPI_AGGREGATION_SUPPORT = (1 << 0),
+	ESP_SPI_VARIABLE_LEN_SUPPORT = (1 << 1),
+	ESP_SDIO_AGGREGATION_SUPPORT = (1 << 2),
+	ESP_CHECKSUM_CRC32_SUPPORT = (1 << 3),
+	ESP_RX_CSUM_OFFLOAD_SUPPORT = (1 << 4),
+	ESP_CMD_SEQ_NUM_SUPPORT = (1 << 5),
+	ESP_TX_CSUM_OFFLOAD_SUPPORT = (1 << 6),
+	ESP_SDIO_TX_STREAM_SUPPORT = (1 << 7),
+};
+
+/* With ESP_SDIO_TX_STREAM_SUPPORT, ESP queues packets without waiting for
+ * host to read previous one. Single host read then carries all of them,
+ * back to back, each behind its own payload header */
+
+/* With ESP_TX_CSUM_OFFLOAD_SUPPORT, host may set CSUM_FILL on data frames.
+ * reserved1 then carries start of checksummed region from start of packet,
+ * and reserved2 offset of checksum field within that region. Host seeds
+ * that field with pseudo header sum, like for CHECKSUM_PARTIAL skbs */
+
+/* With ESP_CMD_SEQ_NUM_SUPPORT, ESP echoes seq_num of command_header in
+ * command response, so host could have multiple commands outstanding */
+
+/* With ESP_SPI_VARIABLE_LEN_SUPPORT, reserved1 of first header in each
+ * SPI transaction from ESP announces max length of ESP's next
+ * transaction, in units of below. 0 means not known yet */
+#define SPI_NEXT_TX_LEN_UNIT            8
+
 enum ESP_INTERNAL_MSG {
 	ESP_INTERNAL_BOOTUP_EVENT = 1,
+	ESP_INTERNAL_HOST_CAPABILITY,
 };
 
 enum ESP_BOOTUP_TAG_TYPE {
@@ -99,6 +145,7 @@ enum ESP_BOOTUP_TAG_TYPE {
 	ESP_BOOTUP_SPI_CLK_MHZ,
 	ESP_BOOTUP_FIRMWARE_CHIP_ID,
 	ESP_BOOTUP_TEST_RAW_TP,
+	ESP_BOOTUP_EXT_CAPABILITY,
 };
 
 enum COMMAND_CODE {
@@ -118,6 +165,8 @@ enum COMMAND_CODE {
 	CMD_SET_MCAST_MAC_ADDR,
 	CMD_GET_TXPOWER,
 	CMD_SET_TXPOWER,
+	CMD_AP_CONFIG,
+	CMD_AP_STOP,
 	CMD_MAX,
 };
 
@@ -197,6 +246,25 @@ struct cmd_sta_disconnect {
 	uint8_t    pad[2];
 } __packed;
 
+enum ESP_AP_AUTH_MODE {
+	ESP_AP_AUTH_OPEN,
+	ESP_AP_AUTH_WPA2_PSK,
+};
+
+struct cmd_ap_config {
+	struct     command_header header;
+	char       ssid[MAX_SSID_LEN+1];
+	uint8_t    ssid_len;
+	uint8_t    channel;
+	uint8_t    authmode;
+	uint8_t    hidden_ssid;
+	uint8_t    max_connections;
+	uint16_t   beacon_interval;
+	/* 8 to 63 char passphrase, or PSK as 64 hex digits */
+	char       passphrase[MAX_PASSPHRASE_LEN+1];
+	uint8_t    pad[3];
+} __packed;
+
 struct cmd_set_ip_addr {
 	struct command_header header;
 	uint32_t ip;
@@ -288,6 +356,12 @@ struct esp_internal_bootup_event {
 	uint8_t    data[0];
 } __packed;
 
+struct esp_internal_host_capability {
+	struct     event_header header;
+	uint8_t    ext_capabilities;
+	uint8_t    pad[3];
+} __packed;
+
 struct fw_version {
 	uint8_t    major1;
 	uint8_t    major2;
@@ -314,4 +388,27 @@ static inline uint16_t compute_checksum(uint8_t *buf, uint16_t len)
 	return checksum;
 }
 
+/* If ESP advertises ESP_CHECKSUM_CRC32_SUPPORT in its bootup event, checksum
+ * field of every other frame, in both directions, carries CRC-32 (as of zlib
+ * crc32()) of frame, folded to 16 bits. Host can't decline it */
+static inline uint16_t fold_crc32(uint32_t crc)
+{
+	return (uint16_t) ((crc >> 16) ^ (crc & 0xFFFF));
+}
+
+/* Bootup event announces checksum type, so it always carries byte sum.
+ * Its event header directly follows payload header */
+static inline int is_bootup_event(uint8_t *buf, uint16_t len)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) buf;
+	struct event_header *evt = (struct event_header *)
+		(buf + sizeof(struct esp_payload_header));
+
+	if (len < sizeof(struct esp_payload_header) + sizeof(struct event_header))
+		return 0;
+
+	return header->if_type == ESP_INTERNAL_IF &&
+		evt->event_code == ESP_INTERNAL_BOOTUP_EVENT;
+}
+
 #endif
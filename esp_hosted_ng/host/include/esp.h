@@ -15,6 +15,8 @@
 #include <linux/inetdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/spinlock.h>
+#include <linux/llist.h>
+#include <linux/skbuff.h>
 #include <net/cfg80211.h>
 #include <net/bluetooth/bluetooth.h>
 #include <net/bluetooth/hci_core.h>
@@ -27,10 +29,12 @@
 #define ESP_LINK_DOWN           0
 #define ESP_LINK_UP             1
 
-#define ESP_MAX_INTERFACE       1
-//#define ESP_MAX_INTERFACE       2
+#define ESP_MAX_INTERFACE       2
 #define ESP_STA_NW_IF           0
 #define ESP_AP_NW_IF            1
+#define ESP_AP_MAX_STATIONS     4
+/* Interface types carrying network frames, ESP_STA_IF and ESP_AP_IF */
+#define ESP_NW_IF_TYPES         (ESP_AP_IF + 1)
 
 /* ESP in sdkconfig has CONFIG_IDF_FIRMWARE_CHIP_ID entry.
  * supported values of CONFIG_IDF_FIRMWARE_CHIP_ID are - */
@@ -52,6 +56,24 @@ struct esp_adapter;
 #define SKB_DATA_ADDR_ALIGNMENT 4
 #define INTERFACE_HEADER_PADDING (SKB_DATA_ADDR_ALIGNMENT*3)
 
+/* Netdev Tx queues, picked by esp_select_queue() */
+#define ESP_NET_TXQ_BE          0   /* Best effort and background */
+#define ESP_NET_TXQ_VI_VO       1   /* Video and voice */
+#define ESP_NET_TX_QUEUES       2
+
+/* Back to back PRIO_Q_MID packets sent while PRIO_Q_LOW waits */
+#define ESP_TX_MID_PRIO_WEIGHT  4
+
+/* RX NAPI batch size histogram buckets: 0, 1, 2-3, 4-7, ... 64+ */
+#define ESP_NAPI_BATCH_BUCKETS  8
+
+/* TX latency histogram buckets, in usec: 0, 1, 2-3, 4-7, ... 16384+ */
+#define ESP_TX_LATENCY_BUCKETS  16
+
+/* Commands sent to ESP, still awaiting response */
+#define ESP_CMD_DFLT_WINDOW     4
+#define ESP_CMD_MAX_WINDOW      8
+
 enum adapter_flags_e {
 	ESP_CLEANUP_IN_PROGRESS,    /* Driver unloading or ESP reseted */
 	ESP_CMD_INIT_DONE,          /* Cmd component is initialized with esp_commands_setup() */
@@ -62,19 +84,49 @@ enum priv_flags_e {
 	ESP_NETWORK_UP,
 };
 
+enum command_state_e {
+	ESP_CMD_IDLE,
+	ESP_CMD_QUEUED,             /* In cmd_pending_queue */
+	ESP_CMD_INFLIGHT,           /* Sent, in cmd_inflight_queue */
+	ESP_CMD_DONE,               /* Response received or send failed */
+};
+
 struct command_node {
 	struct list_head list;
 	uint8_t cmd_code;
+	uint8_t state;
+	uint16_t seq_num;
+	unsigned long timeout;
+	ktime_t queued_time;
+	ktime_t sent_time;
 	struct sk_buff *cmd_skb;
 	struct sk_buff *resp_skb;
 };
 
+struct esp_rx_napi_stats {
+	u64                     polls;
+	u64                     packets;
+	u64                     budget_exhausted;
+	u64                     batch_hist[ESP_NAPI_BATCH_BUCKETS];
+};
+
+struct esp_tx_latency_stats {
+	u64                     packets;
+	u64                     total_us;
+	u64                     max_us;
+	u64                     latency_hist[ESP_TX_LATENCY_BUCKETS];
+};
+
 struct esp_adapter {
 	struct device           *dev;
 	struct wiphy            *wiphy;
 
 	uint8_t                 if_type;
 	uint32_t                capabilities;
+	/* ESP_EXT_CAPABILITIES advertised by ESP and accepted by host */
+	uint32_t                ext_capabilities;
+	/* CRC-32 frame checksum, as announced in ESP bootup event */
+	bool                    checksum_crc32;
 
 	/* Possible types:
 	 * struct esp_sdio_context */
@@ -84,13 +136,25 @@ struct esp_adapter {
 
 	/* Private for each interface */
 	struct esp_wifi_device  *priv[ESP_MAX_INTERFACE];
+	/* Rx demux, indexed by if_type and if_num of payload header.
+	 * Updated under RCU on interface add/remove */
+	struct esp_wifi_device __rcu *rx_priv[ESP_NW_IF_TYPES][ESP_MAX_INTERFACE];
 	struct hci_dev          *hcidev;
 
-	struct workqueue_struct *if_rx_workqueue;
-	struct work_struct      if_rx_work;
+	/* RX NAPI context, shared by all interfaces as they are
+	 * multiplexed over single transport */
+	struct net_device       *napi_dev;
+	struct napi_struct      napi;
+	struct esp_rx_napi_stats rx_napi_stats;
+
+	/* Time from write to transport till written over bus */
+	struct esp_tx_latency_stats tx_latency_stats;
+
+	/* Rx frames dropped on checksum mismatch. Transport may take these
+	 * as sign of unreliable link */
+	atomic_t                rx_checksum_errors;
 
 	wait_queue_head_t       wait_for_cmd_resp;
-	uint8_t                 cmd_resp;
 
 	/* wpa supplicant commands structures */
 	struct command_node     *cmd_pool;
@@ -99,7 +163,11 @@ struct esp_adapter {
 	struct list_head        cmd_pending_queue;
 	spinlock_t              cmd_pending_queue_lock;
 
-	struct command_node     *cur_cmd;
+	/* Sent commands, matched with response by seq_num */
+	struct list_head        cmd_inflight_queue;
+	u8                      cmd_inflight;
+	u8                      cmd_window;
+	u16                     cmd_seq_num;
 	spinlock_t              cmd_lock;
 
 	struct workqueue_struct *mac_filter_wq;
@@ -111,8 +179,12 @@ struct esp_adapter {
 	struct sk_buff_head     events_skb_q;
 	struct workqueue_struct *events_wq;
 	struct work_struct      events_work;
+	/* Set while esp_events_work() runs, to skip self flush on removal */
+	struct task_struct      *events_task;
 
 	unsigned long           state_flags;
+
+	struct dentry           *debugfs_dir;
 };
 
 struct esp_device {
@@ -160,5 +232,179 @@ struct esp_wifi_device {
 
 struct esp_skb_cb {
 	struct esp_wifi_device      *priv;
+	ktime_t                     enqueue_time;
+	/* Link in esp_tx_queue, till transport thread picks skb */
+	struct llist_node           tx_node;
+	/* Bytes charged to BQL of netdev Tx queue, 0 if none */
+	unsigned int                bql_bytes;
+	/* Segment of TSO super-packet, queued even past Tx pending limit */
+	u8                          gso_seg;
+	/* Interface of deferred Rx event, priv is looked up again in worker */
+	u8                          if_type;
+	u8                          if_num;
+};
+
+/* Tx queue with many producers and single consumer (transport Tx thread).
+ * Producers push on staged list with single cmpxchg, no lock. Consumer
+ * moves whole staged list, in arrival order, to ready list that only it
+ * touches. Both are kept in separate cache lines, so producers on other
+ * CPUs do not bounce consumer's line */
+struct esp_tx_queue {
+	struct llist_head           staged ____cacheline_aligned_in_smp;
+	struct sk_buff_head         ready ____cacheline_aligned_in_smp;
 };
+
+static inline struct sk_buff *esp_tx_queue_node_to_skb(struct llist_node *node)
+{
+	struct esp_skb_cb *cb = container_of(node, struct esp_skb_cb, tx_node);
+
+	return (struct sk_buff *)((char *)cb - offsetof(struct sk_buff, cb));
+}
+
+static inline void esp_tx_queue_init(struct esp_tx_queue *q)
+{
+	init_llist_head(&q->staged);
+	__skb_queue_head_init(&q->ready);
+}
+
+/* Any context, any CPU. True if nothing was staged before, so consumer
+ * needs kick. Otherwise kick of first staged skb is still to be served */
+static inline bool esp_tx_queue_push(struct esp_tx_queue *q, struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *)skb->cb;
+
+	return llist_add(&cb->tx_node, &q->staged);
+}
+
+/* Lockless hint for producers, exact for consumer */
+static inline bool esp_tx_queue_empty(struct esp_tx_queue *q)
+{
+	return skb_queue_empty(&q->ready) && llist_empty(&q->staged);
+}
+
+/* Consumer only: llist is LIFO, so reverse to restore arrival order */
+static inline void esp_tx_queue_splice(struct esp_tx_queue *q)
+{
+	struct llist_node *node = llist_reverse_order(llist_del_all(&q->staged));
+	struct llist_node *next;
+
+	llist_for_each_safe(node, next, node)
+		__skb_queue_tail(&q->ready, esp_tx_queue_node_to_skb(node));
+}
+
+/* Consumer only */
+static inline struct sk_buff *esp_tx_queue_peek(struct esp_tx_queue *q)
+{
+	if (skb_queue_empty(&q->ready))
+		esp_tx_queue_splice(q);
+
+	return skb_peek(&q->ready);
+}
+
+/* Consumer only */
+static inline struct sk_buff *esp_tx_queue_dequeue(struct esp_tx_queue *q)
+{
+	if (skb_queue_empty(&q->ready))
+		esp_tx_queue_splice(q);
+
+	return __skb_dequeue(&q->ready);
+}
+
+/* Consumer only. HIGH (control) is served strictly first. MID (HCI, video
+ * and voice) is served ahead of LOW (bulk data) but only for
+ * ESP_TX_MID_PRIO_WEIGHT packets in a row, so bulk data keeps moving.
+ * Returns MAX_PRIORITY_QUEUES if all queues are empty */
+static inline u8 esp_tx_queue_select(struct esp_tx_queue *tx_q, u8 mid_burst)
+{
+	bool mid = !esp_tx_queue_empty(&tx_q[PRIO_Q_MID]);
+	bool low = !esp_tx_queue_empty(&tx_q[PRIO_Q_LOW]);
+
+	if (!esp_tx_queue_empty(&tx_q[PRIO_Q_HIGH]))
+		return PRIO_Q_HIGH;
+
+	if (mid && (!low || mid_burst < ESP_TX_MID_PRIO_WEIGHT))
+		return PRIO_Q_MID;
+
+	return low ? PRIO_Q_LOW : MAX_PRIORITY_QUEUES;
+}
+
+/* Consumer only, once packet of prio is dequeued */
+static inline void esp_tx_queue_served(u8 *mid_burst, u8 prio)
+{
+	if (prio == PRIO_Q_MID && *mid_burst < ESP_TX_MID_PRIO_WEIGHT)
+		(*mid_burst)++;
+	else if (prio == PRIO_Q_LOW)
+		*mid_burst = 0;
+}
+
+/* Netdev Tx queue skb was sent on. Driver's own skbs count as best effort */
+static inline u16 esp_skb_net_txq(struct sk_buff *skb)
+{
+	u16 txq = skb_get_queue_mapping(skb);
+
+	return (txq < ESP_NET_TX_QUEUES) ? txq : ESP_NET_TXQ_BE;
+}
+
+/* Tx backlog is accounted per interface and netdev Tx queue, so that
+ * SoftAP clients do not stall station uplink and vice versa */
+#define ESP_TX_SLOTS            (ESP_MAX_INTERFACE * ESP_NET_TX_QUEUES)
+
+static inline u16 esp_tx_slot(struct esp_wifi_device *priv, u16 txq)
+{
+	u16 iface = (priv && priv->if_type == ESP_AP_IF) ? ESP_AP_NW_IF : ESP_STA_NW_IF;
+
+	return iface * ESP_NET_TX_QUEUES + txq;
+}
+
+static inline u16 esp_skb_tx_slot(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *)skb->cb;
+
+	return esp_tx_slot(cb->priv, esp_skb_net_txq(skb));
+}
+
+/* Transport queue for network data of netdev Tx queue */
+static inline u8 esp_net_txq_to_prio(u16 txq)
+{
+	return (txq == ESP_NET_TXQ_VI_VO) ? PRIO_Q_MID : PRIO_Q_LOW;
+}
+
+/* BQL: network data skb is about to enter transport tx_q. Kernel stops
+ * netdev Tx queue once bytes in flight exceed limit it derives from
+ * completion rate */
+static inline void esp_tx_bql_sent(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *)skb->cb;
+
+	if (!cb->priv || !cb->priv->ndev)
+		return;
+
+	cb->bql_bytes = skb->len;
+	netdev_tx_sent_queue(netdev_get_tx_queue(cb->priv->ndev,
+				esp_skb_net_txq(skb)), cb->bql_bytes);
+}
+
+/* BQL: skb is handed over to bus, or dropped, after esp_tx_bql_sent() */
+static inline void esp_tx_bql_completed(struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *)skb->cb;
+
+	if (!cb->bql_bytes)
+		return;
+
+	netdev_tx_completed_queue(netdev_get_tx_queue(cb->priv->ndev,
+				esp_skb_net_txq(skb)), 1, cb->bql_bytes);
+	cb->bql_bytes = 0;
+}
+
+/* Consumer only, or once consumer is stopped */
+static inline void esp_tx_queue_purge(struct esp_tx_queue *q)
+{
+	struct sk_buff *skb = NULL;
+
+	while ((skb = esp_tx_queue_dequeue(q))) {
+		esp_tx_bql_completed(skb);
+		dev_kfree_skb_any(skb);
+	}
+}
 #endif
@@ -24,11 +24,15 @@ int esp_remove_card(struct esp_adapter *adapter);
 void esp_process_new_packet_intr(struct esp_adapter *adapter);
 struct esp_adapter *esp_get_adapter(void);
 struct esp_wifi_device *get_priv_from_payload_header(struct esp_payload_header *header);
+void esp_publish_rx_priv(struct esp_wifi_device *priv);
+void esp_unpublish_rx_priv(struct esp_wifi_device *priv);
 struct sk_buff *esp_alloc_skb(u32 len);
 int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb);
 u8 esp_is_bt_supported_over_sdio(u32 cap);
 void esp_tx_pause(struct esp_wifi_device *priv);
 void esp_tx_resume(struct esp_wifi_device *priv);
+void esp_tx_pause_queue(struct esp_wifi_device *priv, u16 txq);
+void esp_tx_resume_queue(struct esp_wifi_device *priv, u16 txq);
 void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len);
 int process_fw_data(struct fw_data *fw_p);
 void esp_init_priv(struct net_device *ndev);
@@ -39,4 +43,8 @@ void print_capabilities(u32 cap);
 void process_capabilities(struct esp_adapter *adapter);
 void process_test_capabilities(u8 cap);
 int esp_is_tx_queue_paused(struct esp_wifi_device *priv);
+int esp_send_host_capability(struct esp_adapter *adapter);
+u32 esp_get_host_ext_capabilities(void);
+u16 esp_compute_checksum(struct esp_adapter *adapter, u8 *buf, u16 len);
+u16 esp_compute_skb_checksum(struct esp_adapter *adapter, struct sk_buff *skb, u16 len);
 #endif
@@ -49,4 +49,7 @@ int cmd_set_ip_address(struct esp_wifi_device *priv, u32 ip);
 int cmd_set_mcast_mac_list(struct esp_wifi_device *priv, struct multicast_list *list);
 int cmd_set_tx_power(struct esp_wifi_device *priv, int power);
 int cmd_get_tx_power(struct esp_wifi_device *priv);
+int cmd_ap_config(struct esp_wifi_device *priv,
+		struct cfg80211_ap_settings *settings);
+int cmd_ap_stop(struct esp_wifi_device *priv);
 #endif
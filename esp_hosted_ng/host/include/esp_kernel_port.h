@@ -49,9 +49,42 @@ static inline void ether_addr_copy(u8 *dst, const u8 *src)
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 17, 0)
   #define ALLOC_NETDEV(size, name, type, setup) \
     alloc_netdev(size, name, setup)
+  #define ALLOC_NETDEV_MQS(size, name, type, setup, txqs, rxqs) \
+    alloc_netdev_mqs(size, name, setup, txqs, rxqs)
 #else
   #define ALLOC_NETDEV(size, name, type, setup) \
     alloc_netdev(size, name, type, setup)
+  #define ALLOC_NETDEV_MQS(size, name, type, setup, txqs, rxqs) \
+    alloc_netdev_mqs(size, name, type, setup, txqs, rxqs)
+#endif
+
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0)
+  #define ESP_SELECT_QUEUE_PROTOTYPE() \
+    u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb)
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 0)
+  #define ESP_SELECT_QUEUE_PROTOTYPE() \
+    u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+	    void *accel_priv)
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 0)
+  #define ESP_SELECT_QUEUE_PROTOTYPE() \
+    u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+	    void *accel_priv, select_queue_fallback_t fallback)
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
+  #define ESP_SELECT_QUEUE_PROTOTYPE() \
+    u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+	    struct net_device *sb_dev, select_queue_fallback_t fallback)
+#else
+  #define ESP_SELECT_QUEUE_PROTOTYPE() \
+    u16 esp_select_queue(struct net_device *ndev, struct sk_buff *skb, \
+	    struct net_device *sb_dev)
+#endif
+
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 14, 0)
+  #define CFG80211_CLASSIFY8021D(skb) cfg80211_classify8021d(skb)
+#else
+  #define CFG80211_CLASSIFY8021D(skb) cfg80211_classify8021d(skb, NULL)
 #endif
 
 
@@ -160,6 +193,13 @@ static inline void *skb_put_data(struct sk_buff *skb, const void *data,
 }
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0))
+static inline void skb_free_frag(void *addr)
+{
+	put_page(virt_to_head_page(addr));
+}
+#endif
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0))
 #define do_exit(code)	kthread_complete_and_exit(NULL, code)
 #endif
@@ -170,6 +210,41 @@ static inline void *skb_put_data(struct sk_buff *skb, const void *data,
 #define NETIF_RX_NI(skb)	netif_rx_ni(skb)
 #endif
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0))
+#define NETIF_NAPI_ADD(ndev, napi, poll, weight) \
+	netif_napi_add_weight(ndev, napi, poll, weight)
+#else
+#define NETIF_NAPI_ADD(ndev, napi, poll, weight) \
+	netif_napi_add(ndev, napi, poll, weight)
+#endif
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0))
+static inline struct net_device *esp_alloc_dummy_netdev(void)
+{
+	return alloc_netdev_dummy(0);
+}
+
+static inline void esp_free_dummy_netdev(struct net_device *ndev)
+{
+	free_netdev(ndev);
+}
+#else
+static inline struct net_device *esp_alloc_dummy_netdev(void)
+{
+	struct net_device *ndev = kzalloc(sizeof(*ndev), GFP_KERNEL);
+
+	if (ndev)
+		init_dummy_netdev(ndev);
+
+	return ndev;
+}
+
+static inline void esp_free_dummy_netdev(struct net_device *ndev)
+{
+	kfree(ndev);
+}
+#endif
+
 static inline
 void CFG80211_RX_ASSOC_RESP(struct net_device *dev,
 			    struct cfg80211_bss *bss,
@@ -218,6 +293,12 @@ static inline bool wireless_dev_current_bss_exists(struct wireless_dev *wdev)
 #define ZERO_LINK_ID
 #endif
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0))
+#define STOP_AP_LINK_ID , unsigned int link_id
+#else
+#define STOP_AP_LINK_ID
+#endif
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0))
 static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
 {
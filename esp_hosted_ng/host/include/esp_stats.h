@@ -29,4 +29,17 @@ inline void esp_raw_tp_queue_resume(void);
 void test_raw_tp_cleanup(void);
 void update_test_raw_tp_rx_stats(u16 len);
 
+void esp_update_rx_napi_stats(struct esp_adapter *adapter, int work_done, int budget);
+void esp_update_tx_latency_stats(struct esp_adapter *adapter, ktime_t enqueue_time);
+void esp_debugfs_init(struct esp_adapter *adapter);
+void esp_debugfs_deinit(struct esp_adapter *adapter);
+
+#ifdef CONFIG_TX_QUEUE_SELFTEST
+void esp_tx_selftest_init(struct esp_adapter *adapter);
+void esp_tx_selftest_deinit(void);
+#else
+static inline void esp_tx_selftest_init(struct esp_adapter *adapter) {}
+static inline void esp_tx_selftest_deinit(void) {}
+#endif
+
 #endif
@@ -0,0 +1,108 @@
+/*
+ * Espressif Systems Wireless LAN device driver
+ *
+ * SPDX-FileCopyrightText: 2015-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM esp_hosted
+
+#if !defined(__ESP_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __ESP_TRACE_H__
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+/* Command life cycle: queued -> sent -> response (or timeout) */
+TRACE_EVENT(esp_cmd_queued,
+	TP_PROTO(u8 cmd_code, u8 high_prio),
+	TP_ARGS(cmd_code, high_prio),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd_code)
+		__field(u8, high_prio)
+	),
+
+	TP_fast_assign(
+		__entry->cmd_code = cmd_code;
+		__entry->high_prio = high_prio;
+	),
+
+	TP_printk("cmd=0x%x high_prio=%u", __entry->cmd_code, __entry->high_prio)
+);
+
+TRACE_EVENT(esp_cmd_sent,
+	TP_PROTO(u8 cmd_code, u16 seq_num, ktime_t queued_time, u8 inflight),
+	TP_ARGS(cmd_code, seq_num, queued_time, inflight),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd_code)
+		__field(u16, seq_num)
+		__field(s64, queue_us)
+		__field(u8, inflight)
+	),
+
+	TP_fast_assign(
+		__entry->cmd_code = cmd_code;
+		__entry->seq_num = seq_num;
+		__entry->queue_us = ktime_us_delta(ktime_get(), queued_time);
+		__entry->inflight = inflight;
+	),
+
+	TP_printk("cmd=0x%x seq=%u queue_us=%lld inflight=%u",
+		__entry->cmd_code, __entry->seq_num,
+		__entry->queue_us, __entry->inflight)
+);
+
+TRACE_EVENT(esp_cmd_resp,
+	TP_PROTO(u8 cmd_code, u16 seq_num, u8 status, ktime_t sent_time),
+	TP_ARGS(cmd_code, seq_num, status, sent_time),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd_code)
+		__field(u16, seq_num)
+		__field(u8, status)
+		__field(s64, resp_us)
+	),
+
+	TP_fast_assign(
+		__entry->cmd_code = cmd_code;
+		__entry->seq_num = seq_num;
+		__entry->status = status;
+		__entry->resp_us = ktime_us_delta(ktime_get(), sent_time);
+	),
+
+	TP_printk("cmd=0x%x seq=%u status=%u resp_us=%lld",
+		__entry->cmd_code, __entry->seq_num,
+		__entry->status, __entry->resp_us)
+);
+
+TRACE_EVENT(esp_cmd_timeout,
+	TP_PROTO(u8 cmd_code, u16 seq_num, u8 state),
+	TP_ARGS(cmd_code, seq_num, state),
+
+	TP_STRUCT__entry(
+		__field(u8, cmd_code)
+		__field(u16, seq_num)
+		__field(u8, state)
+	),
+
+	TP_fast_assign(
+		__entry->cmd_code = cmd_code;
+		__entry->seq_num = seq_num;
+		__entry->state = state;
+	),
+
+	TP_printk("cmd=0x%x seq=%u state=%u",
+		__entry->cmd_code, __entry->seq_num, __entry->state)
+);
+
+#endif /* __ESP_TRACE_H__ */
+
+/* Found through include path of the module */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE esp_trace
+#include <trace/define_trace.h>
@@ -11,6 +11,7 @@
 #include <linux/kernel.h>
 #include <linux/gpio.h>
 #include <linux/igmp.h>
+#include <linux/crc32.h>
 
 #include "esp.h"
 #include "esp_if.h"
@@ -24,12 +25,20 @@
 
 #define HOST_GPIO_PIN_INVALID -1
 static int resetpin = HOST_GPIO_PIN_INVALID;
+static int napi_weight = NAPI_POLL_WEIGHT;
+static int cmd_window = ESP_CMD_DFLT_WINDOW;
 extern u8 ap_bssid[MAC_ADDR_LEN];
 extern volatile u8 host_sleep;
 
 module_param(resetpin, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(resetpin, "Host's GPIO pin number which is connected to ESP32's EN to reset ESP32 device");
 
+module_param(napi_weight, int, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(napi_weight, "Max packets processed per RX NAPI poll");
+
+module_param(cmd_window, int, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(cmd_window, "Max commands outstanding with ESP, if ESP supports it");
+
 static void deinit_adapter(void);
 
 
@@ -42,10 +51,62 @@ struct esp_adapter *esp_get_adapter(void)
 	return &adapter;
 }
 
+/* Transport independent ESP_EXT_CAPABILITIES, host is willing to use */
+u32 esp_get_host_ext_capabilities(void)
+{
+	return ESP_RX_CSUM_OFFLOAD_SUPPORT | ESP_CMD_SEQ_NUM_SUPPORT |
+		ESP_TX_CSUM_OFFLOAD_SUPPORT;
+}
+
+u16 esp_compute_checksum(struct esp_adapter *adapter, u8 *buf, u16 len)
+{
+	/* crc32_le() is arch accelerated, where CPU has CRC instructions */
+	if (adapter->checksum_crc32 && !is_bootup_event(buf, len))
+		return fold_crc32(~crc32_le(~0, buf, len));
+
+	return compute_checksum(buf, len);
+}
+
+/* esp_compute_checksum() over first len bytes of possibly fragmented skb */
+u16 esp_compute_skb_checksum(struct esp_adapter *adapter, struct sk_buff *skb, u16 len)
+{
+	struct skb_seq_state st;
+	const u8 *data = NULL;
+	unsigned int consumed = 0, chunk = 0;
+	u8 crc_mode = adapter->checksum_crc32;
+	u32 crc = ~0;
+	u16 sum = 0;
+
+	if (!skb_is_nonlinear(skb))
+		return esp_compute_checksum(adapter, skb->data, len);
+
+	skb_prepare_seq_read(skb, 0, len, &st);
+
+	while ((chunk = skb_seq_read(consumed, &data, &st)) != 0) {
+		chunk = min_t(unsigned int, chunk, len - consumed);
+
+		if (crc_mode)
+			crc = crc32_le(crc, data, chunk);
+		else
+			sum += compute_checksum((u8 *) data, chunk);
+
+		consumed += chunk;
+	}
+
+	return crc_mode ? fold_crc32(~crc) : sum;
+}
+
 void esp_process_new_packet_intr(struct esp_adapter *adapter)
 {
-	if (adapter)
-		queue_work(adapter->if_rx_workqueue, &adapter->if_rx_work);
+	if (!adapter || !adapter->napi_dev)
+		return;
+
+	/* Transports signal from process context (SPI work, SDIO IRQ thread).
+	 * Disabling BH lets the raised NET_RX softirq run on local_bh_enable()
+	 * instead of waiting for next interrupt exit or ksoftirqd */
+	local_bh_disable();
+	napi_schedule(&adapter->napi);
+	local_bh_enable();
 }
 
 static int process_tx_packet(struct sk_buff *skb)
@@ -53,13 +114,11 @@ static int process_tx_packet(struct sk_buff *skb)
 	struct esp_wifi_device *priv = NULL;
 	struct esp_skb_cb *cb = NULL;
 	struct esp_payload_header *payload_header = NULL;
-	struct sk_buff *new_skb = NULL;
 	int ret = 0;
-	u8 pad_len = 0, realloc_skb = 0;
+	u8 pad_len = 0;
 	u16 len = 0;
-	u16 total_len = 0;
+	int csum_start = -1;
 	static u8 c;
-	u8 *pos = NULL;
 
 	c++;
 	/* Get the priv */
@@ -72,62 +131,50 @@ static int process_tx_packet(struct sk_buff *skb)
 		return NETDEV_TX_OK;
 	}
 
-	if (netif_queue_stopped((const struct net_device *) priv->ndev)) {
-		esp_info("Netif queue stopped\n");
-		return NETDEV_TX_BUSY;
-	}
+	/* Segments of super-packet are past these checks, see esp_tx_gso_segments() */
+	if (!cb->gso_seg) {
+		if (__netif_subqueue_stopped(priv->ndev, esp_skb_net_txq(skb))) {
+			esp_info("Netif queue stopped\n");
+			return NETDEV_TX_BUSY;
+		}
 
-	if (host_sleep) {
-		return NETDEV_TX_BUSY;
+		if (host_sleep) {
+			return NETDEV_TX_BUSY;
+		}
 	}
 
-	len = skb->len;
-
-	/* Create space for payload header */
-	pad_len = sizeof(struct esp_payload_header);
+	/* ESP fills in checksum left partial by stack, see CSUM_FILL */
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		csum_start = skb_checksum_start_offset(skb);
 
-	total_len = len + pad_len;
-
-	/* Align buffer length */
-	pad_len += SKB_DATA_ADDR_ALIGNMENT - (total_len % SKB_DATA_ADDR_ALIGNMENT);
-
-	if (skb_headroom(skb) < pad_len) {
-		/* Headroom is not sufficient */
-		realloc_skb = 1;
-	}
+		if (!(adapter.ext_capabilities & ESP_TX_CSUM_OFFLOAD_SUPPORT) ||
+		    (csum_start > 0xFF) || (skb->csum_offset > 0xFF)) {
+			csum_start = -1;
 
-	if (realloc_skb || !IS_ALIGNED((unsigned long) skb->data, SKB_DATA_ADDR_ALIGNMENT)) {
-		/* Realloc SKB */
-		if (skb_linearize(skb)) {
-			priv->stats.tx_errors++;
-			dev_kfree_skb(skb);
-			esp_err("Failed to linearize SKB");
-			return NETDEV_TX_OK;
+			if (skb_checksum_help(skb)) {
+				priv->stats.tx_errors++;
+				dev_kfree_skb(skb);
+				return NETDEV_TX_OK;
+			}
 		}
+	}
 
-		new_skb = esp_alloc_skb(skb->len + pad_len);
-
-		if (!new_skb) {
-			esp_err("Failed to allocate SKB");
-			priv->stats.tx_errors++;
-			dev_kfree_skb(skb);
-			return NETDEV_TX_OK;
-		}
+	len = skb->len;
 
-		pos = new_skb->data;
-		pos += pad_len;
+	/* Header space, plus padding to start header at aligned address.
+	 * Only linear part is reallocated, if headroom is short or shared
+	 * with a clone; frags are never copied here */
+	if (skb_cow_head(skb, sizeof(struct esp_payload_header) + SKB_DATA_ADDR_ALIGNMENT)) {
+		priv->stats.tx_errors++;
+		dev_kfree_skb(skb);
+		esp_err("Failed to make headroom");
+		return NETDEV_TX_OK;
+	}
 
-		/* Populate new SKB */
-		skb_copy_from_linear_data(skb, pos, skb->len);
-		skb_put(new_skb, skb->len + pad_len);
+	pad_len = sizeof(struct esp_payload_header) +
+		((unsigned long) skb->data % SKB_DATA_ADDR_ALIGNMENT);
 
-		/* Replace old SKB */
-		dev_kfree_skb_any(skb);
-		skb = new_skb;
-	} else {
-		/* Realloc is not needed, Make space for interface header */
-		skb_push(skb, pad_len);
-	}
+	skb_push(skb, pad_len);
 
 	/* Set payload header */
 	payload_header = (struct esp_payload_header *) skb->data;
@@ -139,8 +186,14 @@ static int process_tx_packet(struct sk_buff *skb)
 	payload_header->offset = cpu_to_le16(pad_len);
 	payload_header->packet_type = PACKET_TYPE_DATA;
 
+	if (csum_start >= 0) {
+		payload_header->flags |= CSUM_FILL;
+		payload_header->reserved1 = csum_start;
+		payload_header->reserved2 = skb->csum_offset;
+	}
+
 	if (adapter.capabilities & ESP_CHECKSUM_ENABLED)
-		payload_header->checksum = cpu_to_le16(compute_checksum(skb->data, (len + pad_len)));
+		payload_header->checksum = cpu_to_le16(esp_compute_skb_checksum(&adapter, skb, (len + pad_len)));
 
 	if (!priv->stop_data) {
 		ret = esp_send_packet(priv->adapter, skb);
@@ -264,6 +317,45 @@ int process_fw_data(struct fw_data *fw_p)
 	return check_esp_version(&fw_p->version);
 }
 
+int esp_send_host_capability(struct esp_adapter *adapter)
+{
+	struct esp_payload_header *header = NULL;
+	struct esp_internal_host_capability *evt = NULL;
+	struct sk_buff *skb = NULL;
+	u16 len = sizeof(struct esp_internal_host_capability);
+	u16 offset = sizeof(struct esp_payload_header);
+
+	if (!adapter)
+		return -EINVAL;
+
+	skb = esp_alloc_skb(len + offset);
+	if (!skb) {
+		esp_err("Failed to allocate host capability skb\n");
+		return -ENOMEM;
+	}
+
+	skb_put(skb, len + offset);
+	memset(skb->data, 0, len + offset);
+
+	header = (struct esp_payload_header *) skb->data;
+	header->if_type = ESP_INTERNAL_IF;
+	header->if_num = 0;
+	header->len = cpu_to_le16(len);
+	header->offset = cpu_to_le16(offset);
+
+	evt = (struct esp_internal_host_capability *) (skb->data + offset);
+	evt->header.event_code = ESP_INTERNAL_HOST_CAPABILITY;
+	evt->header.len = cpu_to_le16(len - sizeof(struct event_header));
+	evt->ext_capabilities = adapter->ext_capabilities;
+
+	if (adapter->capabilities & ESP_CHECKSUM_ENABLED)
+		header->checksum = cpu_to_le16(esp_compute_checksum(adapter, skb->data, len + offset));
+
+	esp_info("Host accepted ext capabilities: 0x%x\n", adapter->ext_capabilities);
+
+	return esp_send_packet(adapter, skb);
+}
+
 static int esp_open(struct net_device *ndev)
 {
 	return 0;
@@ -340,6 +432,40 @@ static void esp_set_rx_mode(struct net_device *ndev)
 
 }
 
+/* Segment TSO super-packet here, right before transport tx_q, so stack
+ * walks down to driver once per super-packet. Super-packet is consumed
+ * already, so all its segments are queued, even past transport's Tx pending
+ * limit. Transport still pauses netdev queue there, bounding the overshoot
+ * to one super-packet */
+static int esp_tx_gso_segments(struct esp_wifi_device *priv, struct sk_buff *skb)
+{
+	struct sk_buff *segs = NULL, *seg = NULL;
+	struct esp_skb_cb *cb = NULL;
+
+	segs = skb_gso_segment(skb, priv->ndev->features & ~NETIF_F_GSO_MASK);
+	if (IS_ERR_OR_NULL(segs)) {
+		priv->stats.tx_dropped++;
+		dev_kfree_skb(skb);
+		return NETDEV_TX_OK;
+	}
+
+	consume_skb(skb);
+
+	while (segs) {
+		seg = segs;
+		segs = segs->next;
+		seg->next = NULL;
+
+		cb = (struct esp_skb_cb *) seg->cb;
+		cb->priv = priv;
+		cb->gso_seg = 1;
+
+		process_tx_packet(seg);
+	}
+
+	return NETDEV_TX_OK;
+}
+
 static int esp_hard_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
 	struct esp_wifi_device *priv = NULL;
@@ -361,6 +487,13 @@ static int esp_hard_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 		return NETDEV_TX_OK;
 	}
 
+	if (skb_is_gso(skb)) {
+		if (__netif_subqueue_stopped(ndev, esp_skb_net_txq(skb)) || host_sleep)
+			return NETDEV_TX_BUSY;
+
+		return esp_tx_gso_segments(priv, skb);
+	}
+
 	if (!skb->len || (skb->len > ETH_FRAME_LEN)) {
 		esp_err("Bad len %d\n", skb->len);
 		priv->stats.tx_dropped++;
@@ -370,14 +503,31 @@ static int esp_hard_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 
 	cb = (struct esp_skb_cb *) skb->cb;
 	cb->priv = priv;
+	cb->gso_seg = 0;
 
 	return process_tx_packet(skb);
 }
 
+/* Map 802.1d priority, from skb->priority or DSCP, onto netdev Tx queue.
+ * Video and voice are carried in PRIO_Q_MID, ahead of bulk data */
+static ESP_SELECT_QUEUE_PROTOTYPE()
+{
+	switch (CFG80211_CLASSIFY8021D(skb)) {
+	case 4:
+	case 5:
+	case 6:
+	case 7:
+		return ESP_NET_TXQ_VI_VO;
+	default:
+		return ESP_NET_TXQ_BE;
+	}
+}
+
 static const struct net_device_ops esp_netdev_ops = {
 	.ndo_open = esp_open,
 	.ndo_stop = esp_stop,
 	.ndo_start_xmit = esp_hard_start_xmit,
+	.ndo_select_queue = esp_select_queue,
 	.ndo_set_mac_address = esp_set_mac_address,
 	.ndo_validate_addr = eth_validate_addr,
 	.ndo_get_stats = esp_get_stats,
@@ -390,6 +540,22 @@ void esp_init_priv(struct net_device *ndev)
 	ndev->netdev_ops = &esp_netdev_ops;
 	ndev->needed_headroom = roundup(sizeof(struct esp_payload_header) +
 			INTERFACE_HEADER_PADDING, 4);
+
+	/* Frags are handed to transport as is, see process_tx_packet().
+	 * TSO super-packets are segmented in esp_tx_gso_segments().
+	 * Stack allows SG only along with checksum offload, which ESP does */
+	if (esp_get_adapter()->ext_capabilities & ESP_TX_CSUM_OFFLOAD_SUPPORT) {
+		ndev->hw_features |= NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_TSO | NETIF_F_TSO6;
+		ndev->features |= NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_TSO | NETIF_F_TSO6;
+	}
+
+	/* ESP verifies checksums of Rx frames, see CSUM_VERIFIED. Without
+	 * transport checksum, bus corruption after that check goes unnoticed */
+	if ((esp_get_adapter()->ext_capabilities & ESP_RX_CSUM_OFFLOAD_SUPPORT) &&
+	    (esp_get_adapter()->capabilities & ESP_CHECKSUM_ENABLED)) {
+		ndev->hw_features |= NETIF_F_RXCSUM;
+		ndev->features |= NETIF_F_RXCSUM;
+	}
 }
 
 static int add_network_iface(void)
@@ -411,6 +577,10 @@ static int add_network_iface(void)
 
 	rtnl_lock();
 	wdev = esp_cfg80211_add_iface(adapter->wiphy, "espsta%d", 1, NL80211_IFTYPE_STATION, NULL);
+
+	/* SoftAP is optional, station stays usable without it */
+	if (wdev && !esp_cfg80211_add_iface(adapter->wiphy, "espap%d", 1, NL80211_IFTYPE_AP, NULL))
+		esp_warn("Failed to add SoftAP interface\n");
 	rtnl_unlock();
 
 	/* Return success if network added successfully */
@@ -435,6 +605,14 @@ void esp_remove_network_interfaces(struct esp_adapter *adapter)
 	struct net_device *ndev = NULL;
 	struct esp_wifi_device *priv = NULL;
 
+	for (iface_idx = 0; iface_idx < ESP_MAX_INTERFACE; iface_idx++)
+		esp_unpublish_rx_priv(adapter->priv[iface_idx]);
+
+	/* Pending events can no longer find priv, wait for one in progress.
+	 * Bootup event removes interfaces from events worker itself. */
+	if (adapter->events_wq && adapter->events_task != current)
+		flush_work(&adapter->events_work);
+
 	for (iface_idx = 0; iface_idx < ESP_MAX_INTERFACE; iface_idx++) {
 
 		priv = adapter->priv[iface_idx];
@@ -456,7 +634,8 @@ void esp_remove_network_interfaces(struct esp_adapter *adapter)
 			netif_device_detach(ndev);
 
 			if (ndev->reg_state == NETREG_REGISTERED) {
-				unregister_inetaddr_notifier(&(adapter->priv[0]->nb));
+				if (priv->if_type == ESP_STA_IF)
+					unregister_inetaddr_notifier(&priv->nb);
 				unregister_netdev(ndev);
 				free_netdev(ndev);
 				ndev = NULL;
@@ -495,27 +674,39 @@ int esp_remove_card(struct esp_adapter *adapter)
 	return 0;
 }
 
+/* Caller holds rcu_read_lock() for as long as it uses returned priv */
 struct esp_wifi_device *get_priv_from_payload_header(
 		struct esp_payload_header *header)
 {
-	struct esp_wifi_device *priv = NULL;
-	u8 i = 0;
-
 	if (!header)
 		return NULL;
 
-	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
-		priv = adapter.priv[i];
+	if (header->if_type >= ESP_NW_IF_TYPES || header->if_num >= ESP_MAX_INTERFACE)
+		return NULL;
 
-		if (!priv)
-			continue;
+	return rcu_dereference(adapter.rx_priv[header->if_type][header->if_num]);
+}
 
-		if (priv->if_type == header->if_type &&
-				priv->if_num == header->if_num) {
-			return priv;
-		}
-	}
-	return NULL;
+/* Make priv reachable from Rx path, once its netdev is registered */
+void esp_publish_rx_priv(struct esp_wifi_device *priv)
+{
+	if (!priv || priv->if_type >= ESP_NW_IF_TYPES || priv->if_num >= ESP_MAX_INTERFACE)
+		return;
+
+	rcu_assign_pointer(priv->adapter->rx_priv[priv->if_type][priv->if_num], priv);
+}
+
+/* Hide priv from Rx path and wait out readers, before its netdev is freed */
+void esp_unpublish_rx_priv(struct esp_wifi_device *priv)
+{
+	if (!priv || priv->if_type >= ESP_NW_IF_TYPES || priv->if_num >= ESP_MAX_INTERFACE)
+		return;
+
+	if (rcu_access_pointer(priv->adapter->rx_priv[priv->if_type][priv->if_num]) != priv)
+		return;
+
+	RCU_INIT_POINTER(priv->adapter->rx_priv[priv->if_type][priv->if_num], NULL);
+	synchronize_rcu();
 }
 
 static void process_esp_bootup_event(struct esp_adapter *adapter,
@@ -563,6 +754,54 @@ static int process_internal_event(struct esp_adapter *adapter,
 	return 0;
 }
 
+/* Pick checksum type from ext capability TLV of bootup event. Done in Rx
+ * path, as bootup event itself is processed later in events work */
+static void esp_update_checksum_type(struct esp_adapter *adapter, u8 *buf, u16 len)
+{
+	struct esp_internal_bootup_event *evt = (struct esp_internal_bootup_event *) buf;
+	u8 *pos = evt->data;
+	u16 len_left = 0;
+	u8 tag_len = 0;
+
+	adapter->checksum_crc32 = false;
+
+	if (len < sizeof(*evt))
+		return;
+
+	len_left = min_t(u16, evt->len, len - sizeof(*evt));
+
+	while (len_left >= 2) {
+		tag_len = *(pos + 1);
+
+		if (tag_len + 2 > len_left)
+			break;
+
+		if (*pos == ESP_BOOTUP_EXT_CAPABILITY && tag_len)
+			adapter->checksum_crc32 = !!(*(pos + 2) & ESP_CHECKSUM_CRC32_SUPPORT);
+
+		pos += (tag_len + 2);
+		len_left -= (tag_len + 2);
+	}
+}
+
+static void esp_queue_event_skb(struct esp_adapter *adapter,
+		u8 if_type, u8 if_num, struct sk_buff *skb)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *) skb->cb;
+
+	if (!adapter->events_wq) {
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	/* priv may be gone by the time worker runs, keep only its index */
+	cb->priv = NULL;
+	cb->if_type = if_type;
+	cb->if_num = if_num;
+	skb_queue_tail(&adapter->events_skb_q, skb);
+	queue_work(adapter->events_wq, &adapter->events_work);
+}
+
 static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 {
 	struct esp_wifi_device *priv = NULL;
@@ -591,23 +830,31 @@ static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 		rx_checksum = le16_to_cpu(payload_header->checksum);
 		payload_header->checksum = 0;
 
-		checksum = compute_checksum(skb->data, (len + offset));
+		checksum = esp_compute_checksum(adapter, skb->data, (len + offset));
 
 		if (checksum != rx_checksum) {
+			atomic_inc(&adapter->rx_checksum_errors);
 			dev_kfree_skb_any(skb);
 			return;
 		}
 	}
 
+	/* Frames right behind bootup event already use announced checksum */
+	if (is_bootup_event(skb->data, len + offset))
+		esp_update_checksum_type(adapter, skb->data + offset, len);
+
 	/* chop off the header from skb */
 	skb_pull(skb, offset);
 
 	if (payload_header->if_type == ESP_STA_IF || payload_header->if_type == ESP_AP_IF) {
 
+		rcu_read_lock();
+
 		/* retrieve priv based on payload header contents */
 		priv = get_priv_from_payload_header(payload_header);
 
 		if (!priv) {
+			rcu_read_unlock();
 			esp_err("Empty priv\n");
 			dev_kfree_skb_any(skb);
 			return;
@@ -617,9 +864,11 @@ static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 			esp_info("Rx PACKET_TYPE_EAPOL!!!!\n");
 			esp_port_open(priv);
 
-			eap_skb = alloc_skb(skb->len + ETH_HLEN, GFP_KERNEL);
+			eap_skb = alloc_skb(skb->len + ETH_HLEN, GFP_ATOMIC);
 			if (!eap_skb) {
+				rcu_read_unlock();
 				esp_info("%u memory alloc failed\n", __LINE__);
+				dev_kfree_skb_any(skb);
 				return;
 			}
 			eap_skb->dev = priv->ndev;
@@ -637,24 +886,38 @@ static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 			eap_skb->protocol = eth_type_trans(eap_skb, eap_skb->dev);
 
 			netif_rx(eap_skb);
+			dev_kfree_skb_any(skb);
 
 		} else if (payload_header->packet_type == PACKET_TYPE_DATA) {
 
 			skb->dev = priv->ndev;
 			skb->protocol = eth_type_trans(skb, priv->ndev);
-			skb->ip_summed = CHECKSUM_NONE;
+
+			/* ESP's verification only holds, if transport checksum
+			 * covered the frame from there on */
+			if ((payload_header->flags & CSUM_VERIFIED) &&
+			    (adapter->capabilities & ESP_CHECKSUM_ENABLED) &&
+			    (priv->ndev->features & NETIF_F_RXCSUM))
+				skb->ip_summed = CHECKSUM_UNNECESSARY;
+			else
+				skb->ip_summed = CHECKSUM_NONE;
 
 			priv->stats.rx_bytes += skb->len;
 			/* Forward skb to kernel */
-			NETIF_RX_NI(skb);
+			napi_gro_receive(&adapter->napi, skb);
 			priv->stats.rx_packets++;
 		} else if (payload_header->packet_type == PACKET_TYPE_COMMAND_RESPONSE) {
 			process_cmd_resp(priv->adapter, skb);
 		} else if (payload_header->packet_type == PACKET_TYPE_EVENT) {
-			process_cmd_event(priv, skb);
+			/* cfg80211 event handling may sleep, defer it out of NAPI */
+			esp_queue_event_skb(adapter, payload_header->if_type,
+					payload_header->if_num, skb);
+		} else {
 			dev_kfree_skb_any(skb);
 		}
 
+		rcu_read_unlock();
+
 	} else if (payload_header->if_type == ESP_HCI_IF) {
 		if (hdev) {
 
@@ -675,12 +938,7 @@ static void process_rx_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	} else if (payload_header->if_type == ESP_INTERNAL_IF) {
 
 		/* Queue event skb for processing in events workqueue */
-		skb_queue_tail(&adapter->events_skb_q, skb);
-
-		if (adapter->events_wq)
-			queue_work(adapter->events_wq, &adapter->events_work);
-		else
-			dev_kfree_skb_any(skb);
+		esp_queue_event_skb(adapter, ESP_INTERNAL_IF, 0, skb);
 
 	} else if (payload_header->if_type == ESP_TEST_IF) {
 		#if TEST_RAW_TP
@@ -698,31 +956,47 @@ int esp_is_tx_queue_paused(struct esp_wifi_device *priv)
 		return 0;
 
 	if ((priv->ndev &&
-		    !netif_queue_stopped((const struct net_device *)priv->ndev)))
+		    !__netif_subqueue_stopped(priv->ndev, ESP_NET_TXQ_BE)))
 		return 1;
     return 0;
 }
 
-void esp_tx_pause(struct esp_wifi_device *priv)
+void esp_tx_pause_queue(struct esp_wifi_device *priv, u16 txq)
 {
 	if (!priv || !priv->ndev)
 		return;
 
-	if (!netif_queue_stopped((const struct net_device *)priv->ndev)) {
-		netif_stop_queue(priv->ndev);
+	if (!__netif_subqueue_stopped(priv->ndev, txq)) {
+		netif_stop_subqueue(priv->ndev, txq);
 	}
 }
 
-void esp_tx_resume(struct esp_wifi_device *priv)
+void esp_tx_resume_queue(struct esp_wifi_device *priv, u16 txq)
 {
 	if (!priv || !priv->ndev)
 		return;
 
-	if (netif_queue_stopped((const struct net_device *)priv->ndev)) {
-		netif_wake_queue(priv->ndev);
+	if (__netif_subqueue_stopped(priv->ndev, txq)) {
+		netif_wake_subqueue(priv->ndev, txq);
 	}
 }
 
+void esp_tx_pause(struct esp_wifi_device *priv)
+{
+	u16 txq = 0;
+
+	for (txq = 0; txq < ESP_NET_TX_QUEUES; txq++)
+		esp_tx_pause_queue(priv, txq);
+}
+
+void esp_tx_resume(struct esp_wifi_device *priv)
+{
+	u16 txq = 0;
+
+	for (txq = 0; txq < ESP_NET_TX_QUEUES; txq++)
+		esp_tx_resume_queue(priv, txq);
+}
+
 struct sk_buff *esp_alloc_skb(u32 len)
 {
 	struct sk_buff *skb = NULL;
@@ -742,22 +1016,35 @@ struct sk_buff *esp_alloc_skb(u32 len)
 	return skb;
 }
 
-
-static int esp_get_packets(struct esp_adapter *adapter)
+static int esp_rx_napi_poll(struct napi_struct *napi, int budget)
 {
+	struct esp_adapter *adapter = container_of(napi, struct esp_adapter, napi);
 	struct sk_buff *skb = NULL;
+	int work_done = 0;
 
-	if (!adapter || !adapter->if_ops || !adapter->if_ops->read)
-		return -EINVAL;
+	if (!adapter->if_ops || !adapter->if_ops->read) {
+		napi_complete(napi);
+		return 0;
+	}
 
-	skb = adapter->if_ops->read(adapter);
+	/* read inbound packets and forward them to network/serial interface */
+	while (work_done < budget) {
+		skb = adapter->if_ops->read(adapter);
 
-	if (!skb)
-		return -EFAULT;
+		if (!skb)
+			break;
 
-	process_rx_packet(adapter, skb);
+		process_rx_packet(adapter, skb);
+		work_done++;
+	}
 
-	return 0;
+	esp_update_rx_napi_stats(adapter, work_done, budget);
+
+	/* Re-armed by esp_process_new_packet_intr() on next packet */
+	if (work_done < budget)
+		napi_complete_done(napi, work_done);
+
+	return work_done;
 }
 
 int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb)
@@ -770,12 +1057,6 @@ int esp_send_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	return adapter->if_ops->write(adapter, skb);
 }
 
-static void esp_if_rx_work(struct work_struct *work)
-{
-	/* read inbound packet and forward it to network/serial interface */
-	esp_get_packets(&adapter);
-}
-
 static void update_mac_filter(struct work_struct *work)
 {
 	cmd_set_mcast_mac_list(mcast_list.priv, &mcast_list);
@@ -784,28 +1065,55 @@ static void update_mac_filter(struct work_struct *work)
 static void esp_events_work(struct work_struct *work)
 {
 	struct sk_buff *skb = NULL;
+	struct esp_skb_cb *cb = NULL;
+	struct esp_wifi_device *priv = NULL;
 
-	skb = skb_dequeue(&adapter.events_skb_q);
-	if (!skb)
-		return;
+	adapter.events_task = current;
+
+	while ((skb = skb_dequeue(&adapter.events_skb_q))) {
+		cb = (struct esp_skb_cb *) skb->cb;
 
-	process_internal_event(&adapter, skb);
-	dev_kfree_skb_any(skb);
+		if (cb->if_type == ESP_INTERNAL_IF) {
+			process_internal_event(&adapter, skb);
+			dev_kfree_skb_any(skb);
+			continue;
+		}
+
+		/* Interface removal flushes this work after unpublishing priv,
+		 * so priv found here stays valid until event is processed */
+		rcu_read_lock();
+		priv = (cb->if_type < ESP_NW_IF_TYPES && cb->if_num < ESP_MAX_INTERFACE) ?
+			rcu_dereference(adapter.rx_priv[cb->if_type][cb->if_num]) : NULL;
+		rcu_read_unlock();
+
+		if (priv)
+			process_cmd_event(priv, skb);
+
+		dev_kfree_skb_any(skb);
+	}
+
+	adapter.events_task = NULL;
 }
 
 static struct esp_adapter *init_adapter(void)
 {
 	memset(&adapter, 0, sizeof(adapter));
 
-	/* Prepare interface RX work */
-	adapter.if_rx_workqueue = alloc_workqueue("ESP_IF_RX_WORK_QUEUE", 0, 0);
+	/* Prepare interface RX NAPI */
+	adapter.napi_dev = esp_alloc_dummy_netdev();
 
-	if (!adapter.if_rx_workqueue) {
+	if (!adapter.napi_dev) {
 		deinit_adapter();
 		return NULL;
 	}
 
-	INIT_WORK(&adapter.if_rx_work, esp_if_rx_work);
+	if (napi_weight <= 0)
+		napi_weight = NAPI_POLL_WEIGHT;
+
+	NETIF_NAPI_ADD(adapter.napi_dev, &adapter.napi, esp_rx_napi_poll, napi_weight);
+	napi_enable(&adapter.napi);
+
+	adapter.cmd_window = clamp(cmd_window, 1, ESP_CMD_MAX_WINDOW);
 
 	skb_queue_head_init(&adapter.events_skb_q);
 
@@ -826,18 +1134,26 @@ static struct esp_adapter *init_adapter(void)
 
 	INIT_WORK(&adapter.mac_flter_work, update_mac_filter);
 
+	esp_debugfs_init(&adapter);
+
 	return &adapter;
 }
 
 static void deinit_adapter(void)
 {
-	skb_queue_purge(&adapter.events_skb_q);
+	esp_debugfs_deinit(&adapter);
+
+	if (adapter.napi_dev) {
+		napi_disable(&adapter.napi);
+		netif_napi_del(&adapter.napi);
+		esp_free_dummy_netdev(adapter.napi_dev);
+		adapter.napi_dev = NULL;
+	}
 
 	if (adapter.events_wq)
 		destroy_workqueue(adapter.events_wq);
 
-	if (adapter.if_rx_workqueue)
-		destroy_workqueue(adapter.if_rx_workqueue);
+	skb_queue_purge(&adapter.events_skb_q);
 
 	if (adapter.mac_filter_wq)
 		destroy_workqueue(adapter.mac_filter_wq);
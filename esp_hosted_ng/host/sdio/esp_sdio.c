@@ -20,7 +20,10 @@
 #include "esp_stats.h"
 #include "include/esp_kernel_port.h"
 
-#define MAX_WRITE_RETRIES       2
+/* Pause netdev queues, when slave is left with fewer Rx buffers */
+#define TX_CREDIT_LOW_WATERMARK 2
+/* Credit poll interval, when no credit update interrupt arrives */
+#define TX_CREDIT_POLL_MS       5
 #define TX_MAX_PENDING_COUNT    200
 #define TX_RESUME_THRESHOLD     (TX_MAX_PENDING_COUNT/5)
 
@@ -30,8 +33,9 @@
 } while (0);
 
 struct esp_sdio_context sdio_context;
-static atomic_t tx_pending;
-static atomic_t queue_items[MAX_PRIORITY_QUEUES];
+/* Per netdev Tx queue. Written by every transmitting CPU, kept off lines
+ * of read mostly data */
+static atomic_t tx_pending[ESP_TX_SLOTS] ____cacheline_aligned_in_smp;
 
 #ifdef CONFIG_ENABLE_MONITOR_PROCESS
 struct task_struct *monitor_thread;
@@ -40,9 +44,16 @@ struct task_struct *tx_thread;
 
 volatile u8 host_sleep;
 
+static bool sdio_aggregation = true;
+
+module_param(sdio_aggregation, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(sdio_aggregation, "Write multiple queued packets with single CMD53, if ESP supports it");
+
 static int init_context(struct esp_sdio_context *context);
 static struct sk_buff *read_packet(struct esp_adapter *adapter);
+static struct sk_buff *read_packet_from_slave(struct esp_sdio_context *context);
 static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb);
+static void esp_process_credit_update(struct esp_sdio_context *context);
 /*int deinit_context(struct esp_adapter *adapter);*/
 
 static const struct sdio_device_id esp_devices[] = {
@@ -51,15 +62,106 @@ static const struct sdio_device_id esp_devices[] = {
 	{}
 };
 
+static void esp_rx_enqueue(struct esp_sdio_context *context, struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+
+	if (header->if_type == ESP_INTERNAL_IF)
+		skb_queue_tail(&context->rx_q[PRIO_Q_HIGH], skb);
+	else if (header->if_type == ESP_HCI_IF)
+		skb_queue_tail(&context->rx_q[PRIO_Q_MID], skb);
+	else
+		skb_queue_tail(&context->rx_q[PRIO_Q_LOW], skb);
+}
+
+/* Length of record at start of buf_len bytes, 0 if it doesn't look valid */
+static u32 esp_rx_record_len(struct esp_payload_header *header, u32 buf_len)
+{
+	u16 len = 0, offset = 0;
+
+	if (buf_len < sizeof(struct esp_payload_header))
+		return 0;
+
+	len = le16_to_cpu(header->len);
+	offset = le16_to_cpu(header->offset);
+
+	if (!len || (offset < sizeof(struct esp_payload_header)) || (len + offset > buf_len))
+		return 0;
+
+	return len + offset;
+}
+
+/* With ESP_SDIO_TX_STREAM_SUPPORT, single read carries all packets queued
+ * at ESP, back to back. Split it into per packet skbs, using header of each.
+ * Returns number of skbs queued to rx_q */
+static u32 esp_rx_split_enqueue(struct esp_sdio_context *context, struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
+	struct sk_buff *record_skb = NULL;
+	struct sk_buff_head records;
+	u32 first_len = 0, pos = 0, len = 0;
+	u32 queued = 1;
+
+	first_len = esp_rx_record_len(header, skb->len);
+	if (!first_len) {
+		/* Leave it to rx path to validate and drop */
+		esp_rx_enqueue(context, skb);
+		return queued;
+	}
+
+	/* First record stays in skb. Records behind it share its data, each
+	 * through clone narrowed down to that record */
+	__skb_queue_head_init(&records);
+
+	for (pos = first_len; pos < skb->len; pos += len) {
+		header = (struct esp_payload_header *) (skb->data + pos);
+
+		len = esp_rx_record_len(header, skb->len - pos);
+		if (!len)
+			break;
+
+		record_skb = skb_clone(skb, GFP_ATOMIC);
+		if (!record_skb) {
+			esp_err("SKB clone failed, dropping rest of Rx batch\n");
+			break;
+		}
+
+		skb_pull(record_skb, pos);
+		skb_trim(record_skb, len);
+		__skb_queue_tail(&records, record_skb);
+	}
+
+	skb_trim(skb, first_len);
+	esp_rx_enqueue(context, skb);
+
+	while ((record_skb = __skb_dequeue(&records))) {
+		esp_rx_enqueue(context, record_skb);
+		queued++;
+	}
+
+	return queued;
+}
+
 static void esp_process_interrupt(struct esp_sdio_context *context, u32 int_status)
 {
+	struct sk_buff *skb = NULL;
+
 	if (!context) {
 		return;
 	}
 
 	if (int_status & ESP_SLAVE_RX_NEW_PACKET_INT) {
-		esp_process_new_packet_intr(context->adapter);
+		/* Bus reads may sleep, so fetch here in SDIO IRQ thread and
+		 * leave delivery to RX NAPI, which drains rx_q. Whole batch
+		 * is queued before NAPI is kicked once */
+		skb = read_packet_from_slave(context);
+
+		if (skb && esp_rx_split_enqueue(context, skb))
+			esp_process_new_packet_intr(context->adapter);
 	}
+
+	if (int_status & BIT(ESP_CREDIT_UPDATE))
+		esp_process_credit_update(context);
 }
 
 static void esp_handle_isr(struct sdio_func *func)
@@ -214,7 +316,7 @@ static void flush_sdio(struct esp_sdio_context *context)
 		return;
 
 	while (1) {
-		skb = read_packet(context->adapter);
+		skb = read_packet_from_slave(context);
 
 		if (!skb) {
 			break;
@@ -241,13 +343,21 @@ static void esp_remove(struct sdio_func *func)
 #endif
 	if (context) {
 		context->state = ESP_CONTEXT_INIT;
-		for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
-			skb_queue_purge(&(sdio_context.tx_q[prio_q_idx]));
+		for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+			skb_queue_purge(&(sdio_context.rx_q[prio_q_idx]));
+		}
 	}
 
 	if (tx_thread)
 		kthread_stop(tx_thread);
 
+	/* Tx thread, consumer of tx_q, is stopped now */
+	if (context) {
+		for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+			esp_tx_queue_purge(&(sdio_context.tx_q[prio_q_idx]));
+		}
+	}
+
 	if (context) {
 		generate_slave_intr(context, BIT(ESP_CLOSE_DATA_PATH));
 		msleep(100);
@@ -340,10 +450,14 @@ static int init_context(struct esp_sdio_context *context)
 		esp_err("Failed to get adapter\n");
 
 	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
-		skb_queue_head_init(&(sdio_context.tx_q[prio_q_idx]));
-		atomic_set(&queue_items[prio_q_idx], 0);
+		esp_tx_queue_init(&(sdio_context.tx_q[prio_q_idx]));
+		skb_queue_head_init(&(sdio_context.rx_q[prio_q_idx]));
 	}
 
+	init_waitqueue_head(&context->tx_wait);
+	context->tx_credits = 0;
+	atomic_set(&context->credit_update, 0);
+
 	context->adapter->if_type = ESP_IF_TYPE_SDIO;
 
 	return ret;
@@ -351,11 +465,8 @@ static int init_context(struct esp_sdio_context *context)
 
 static struct sk_buff *read_packet(struct esp_adapter *adapter)
 {
-	u32 len_from_slave, data_left, len_to_read, size, num_blocks;
-	int ret = 0;
-	struct sk_buff *skb;
-	u8 *pos;
 	struct esp_sdio_context *context;
+	struct sk_buff *skb = NULL;
 
 	if (!adapter || !adapter->if_context) {
 		esp_err("INVALID args\n");
@@ -364,6 +475,22 @@ static struct sk_buff *read_packet(struct esp_adapter *adapter)
 
 	context = adapter->if_context;
 
+	skb = skb_dequeue(&(context->rx_q[PRIO_Q_HIGH]));
+	if (!skb)
+		skb = skb_dequeue(&(context->rx_q[PRIO_Q_MID]));
+	if (!skb)
+		skb = skb_dequeue(&(context->rx_q[PRIO_Q_LOW]));
+
+	return skb;
+}
+
+static struct sk_buff *read_packet_from_slave(struct esp_sdio_context *context)
+{
+	u32 len_from_slave, data_left, len_to_read, size, num_blocks;
+	int ret = 0;
+	struct sk_buff *skb;
+	u8 *pos;
+
 	if (!context ||  (context->state != ESP_CONTEXT_READY) || !context->func) {
 		esp_err("Invalid context/state\n");
 		return NULL;
@@ -384,7 +511,7 @@ static struct sk_buff *read_packet(struct esp_adapter *adapter)
 	size = ESP_BLOCK_SIZE * 4;
 
 	if (len_from_slave > size) {
-		esp_info("Rx large packet: %d\n", len_from_slave);
+		esp_dbg("Rx batch: %d\n", len_from_slave);
 	}
 
 	skb = esp_alloc_skb(len_from_slave);
@@ -448,6 +575,8 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
 	struct esp_skb_cb *cb = NULL;
 	uint8_t prio = PRIO_Q_LOW;
+	u16 txq = ESP_NET_TXQ_BE;
+	u16 slot = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -468,68 +597,256 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	}
 
 	cb = (struct esp_skb_cb *)skb->cb;
-	if (cb && cb->priv && (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT)) {
-		esp_tx_pause(cb->priv);
-		dev_kfree_skb(skb);
-		skb = NULL;
-/*		esp_err("TX Pause busy");*/
-		return -EBUSY;
+	txq = esp_skb_net_txq(skb);
+	slot = esp_skb_tx_slot(skb);
+	if (cb && cb->priv && (atomic_read(&tx_pending[slot]) >= TX_MAX_PENDING_COUNT)) {
+		esp_tx_pause_queue(cb->priv, txq);
+
+		/* Rest of TSO super-packet is queued anyway */
+		if (!cb->gso_seg) {
+			dev_kfree_skb(skb);
+			skb = NULL;
+/*			esp_err("TX Pause busy");*/
+			return -EBUSY;
+		}
 	}
 
 	/* Enqueue SKB in tx_q */
-	atomic_inc(&tx_pending);
+	atomic_inc(&tx_pending[slot]);
 
-	/* Notify to process queue */
 	if (payload_header->if_type == ESP_INTERNAL_IF)
 		prio = PRIO_Q_HIGH;
 	else if (payload_header->if_type == ESP_HCI_IF)
 		prio = PRIO_Q_MID;
 	else
-		prio = PRIO_Q_LOW;
+		prio = esp_net_txq_to_prio(txq);
+
+	cb->enqueue_time = ktime_get();
+	esp_tx_bql_sent(skb);
+	esp_tx_queue_push(&(sdio_context.tx_q[prio]), skb);
 
-	atomic_inc(&queue_items[prio]);
-	skb_queue_tail(&(sdio_context.tx_q[prio]), skb);
+	/* Notify to process queue, if tx thread sleeps. Barrier of
+	 * wq_has_sleeper() pairs with the one in wait_event() */
+	if (wq_has_sleeper(&sdio_context.tx_wait))
+		wake_up_interruptible(&sdio_context.tx_wait);
 
 	return 0;
 }
 
-static int is_sdio_write_buffer_available(u32 buf_needed)
+/* Refresh credits from slave token register, only when cached count falls short */
+static bool has_tx_credits(struct esp_sdio_context *context, u32 buf_needed)
 {
-#define BUFFER_AVAILABLE        1
-#define BUFFER_UNAVAILABLE      0
+	if (context->tx_credits < buf_needed)
+		esp_slave_get_tx_buffer_num(context, &context->tx_credits, ACQUIRE_LOCK);
 
-	int ret = 0;
-	static u32 buf_available;
-	struct esp_sdio_context *context = &sdio_context;
-	u8 retry = MAX_WRITE_RETRIES;
+	return context->tx_credits >= buf_needed;
+}
+
+static void esp_sdio_tx_pause_all(struct esp_adapter *adapter)
+{
+	u8 i = 0;
 
-	/*If buffer needed are less than buffer available
-	  then only read for available buffer number from slave*/
-	if (buf_available < buf_needed) {
-		while (retry) {
-			ret = esp_slave_get_tx_buffer_num(context, &buf_available, ACQUIRE_LOCK);
+	for (i = 0; i < ESP_MAX_INTERFACE; i++)
+		esp_tx_pause(adapter->priv[i]);
+}
 
-			if (buf_available < buf_needed) {
+static void esp_sdio_tx_resume_all(struct esp_adapter *adapter)
+{
+	u8 i = 0;
+	u16 txq = 0;
 
-				/* Release SDIO and retry after delay*/
-				retry--;
-				usleep_range(10, 50);
+	for (i = 0; i < ESP_MAX_INTERFACE; i++) {
+		for (txq = 0; txq < ESP_NET_TX_QUEUES; txq++) {
+			if (atomic_read(&tx_pending[esp_tx_slot(adapter->priv[i], txq)]) >= TX_RESUME_THRESHOLD)
 				continue;
-			}
 
-			break;
+			esp_tx_resume_queue(adapter->priv[i], txq);
 		}
 	}
+}
 
-	if (buf_available >= buf_needed)
-		buf_available -= buf_needed;
+/* ESP reloaded its Rx buffers, after host ran out of credits */
+static void esp_process_credit_update(struct esp_sdio_context *context)
+{
+	atomic_set(&context->credit_update, 1);
+	wake_up_interruptible(&context->tx_wait);
+	esp_sdio_tx_resume_all(context->adapter);
+}
 
-	if (!retry) {
-		/* No buffer available at slave */
-		return BUFFER_UNAVAILABLE;
+/* Subqueues paused for lack of credits are resumed as soon as credits are
+ * back, whether or not credit update interrupt came */
+static bool tx_credits_recovered(struct esp_sdio_context *context, u32 buf_needed)
+{
+	if (!has_tx_credits(context, buf_needed))
+		return false;
+
+	if (context->tx_paused) {
+		context->tx_paused = false;
+		esp_sdio_tx_resume_all(context->adapter);
 	}
 
-	return BUFFER_AVAILABLE;
+	return true;
+}
+
+/* Packet stays queued till slave has enough buffers for it */
+static bool wait_for_tx_credits(struct esp_sdio_context *context, u32 buf_needed)
+{
+	if (tx_credits_recovered(context, buf_needed))
+		return true;
+
+	if (context->tx_credits < TX_CREDIT_LOW_WATERMARK) {
+		esp_sdio_tx_pause_all(context->adapter);
+		context->tx_paused = true;
+	}
+
+	/* Ask slave to interrupt on buffer reload. Recheck, as slave might
+	 * have reloaded before it saw the request */
+	atomic_set(&context->credit_update, 0);
+	generate_slave_intr(context, BIT(ESP_CREDIT_REQUEST));
+
+	if (tx_credits_recovered(context, buf_needed))
+		return true;
+
+	/* Timeout covers firmware without credit update interrupt */
+	wait_event_interruptible_timeout(context->tx_wait,
+			atomic_read(&context->credit_update) ||
+			kthread_should_stop() || host_sleep,
+			msecs_to_jiffies(TX_CREDIT_POLL_MS));
+
+	return tx_credits_recovered(context, buf_needed);
+}
+
+static void sdio_mark_more_records(struct esp_payload_header *header)
+{
+	u16 len = le16_to_cpu(header->len) + le16_to_cpu(header->offset);
+
+	header->flags |= MORE_AGGR_RECORDS;
+
+	/* Flag is covered by checksum, so recompute it */
+	if (sdio_context.adapter->capabilities & ESP_CHECKSUM_ENABLED) {
+		header->checksum = 0;
+		header->checksum = cpu_to_le16(esp_compute_checksum(sdio_context.adapter, (u8 *) header, len));
+	}
+}
+
+/* Dequeue next low priority packet, if it fits in max_len */
+static struct sk_buff *sdio_dequeue_low_prio_skb(struct esp_sdio_context *context, u32 max_len)
+{
+	struct esp_tx_queue *q = &context->tx_q[PRIO_Q_LOW];
+	struct sk_buff *tx_skb = NULL;
+	struct esp_skb_cb *cb = NULL;
+	u16 txq = 0;
+	u16 slot = 0;
+
+	tx_skb = esp_tx_queue_peek(q);
+	if (!tx_skb || tx_skb->len > max_len)
+		return NULL;
+
+	tx_skb = esp_tx_queue_dequeue(q);
+	esp_tx_queue_served(&context->tx_mid_burst, PRIO_Q_LOW);
+
+	txq = esp_skb_net_txq(tx_skb);
+	slot = esp_skb_tx_slot(tx_skb);
+	if (atomic_read(&tx_pending[slot]))
+		atomic_dec(&tx_pending[slot]);
+
+	/* resume network tx queue if bearable load */
+	cb = (struct esp_skb_cb *)tx_skb->cb;
+	if (cb && cb->priv && atomic_read(&tx_pending[slot]) < TX_RESUME_THRESHOLD) {
+		esp_tx_resume_queue(cb->priv, txq);
+		#if TEST_RAW_TP
+			esp_raw_tp_queue_resume();
+		#endif
+	}
+
+	return tx_skb;
+}
+
+/* Pack queued low priority packets behind tx_skb, as many as fit in one ESP
+ * Rx buffer, so that they take single credit and single CMD53 write.
+ * Packed packets are moved to done_q, to be completed after write */
+static struct sk_buff *sdio_aggregate_tx_skb(struct esp_sdio_context *context,
+		struct sk_buff *tx_skb, struct sk_buff_head *done_q)
+{
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *agg_skb = NULL, *next_skb = NULL;
+	u32 used = ALIGN(tx_skb->len, SKB_DATA_ADDR_ALIGNMENT);
+
+	if (!(context->adapter->ext_capabilities & ESP_SDIO_AGGREGATION_SUPPORT))
+		return tx_skb;
+
+	if ((used + sizeof(struct esp_payload_header) >= ESP_RX_BUFFER_SIZE) ||
+	    esp_tx_queue_empty(&context->tx_q[PRIO_Q_LOW]))
+		return tx_skb;
+
+	agg_skb = esp_alloc_skb(ESP_RX_BUFFER_SIZE);
+	if (!agg_skb)
+		return tx_skb;
+
+	next_skb = sdio_dequeue_low_prio_skb(context, ESP_RX_BUFFER_SIZE - used);
+	if (!next_skb) {
+		dev_kfree_skb(agg_skb);
+		return tx_skb;
+	}
+
+	memset(agg_skb->data, 0, ESP_RX_BUFFER_SIZE);
+	used = 0;
+
+	while (tx_skb) {
+		if (header)
+			sdio_mark_more_records(header);
+
+		header = (struct esp_payload_header *) (agg_skb->data + used);
+		skb_copy_bits(tx_skb, 0, header, tx_skb->len);
+		used += ALIGN(tx_skb->len, SKB_DATA_ADDR_ALIGNMENT);
+		__skb_queue_tail(done_q, tx_skb);
+
+		tx_skb = next_skb;
+		next_skb = NULL;
+
+		/* Control and HCI packets are not held back behind data */
+		if (!esp_tx_queue_empty(&context->tx_q[PRIO_Q_HIGH]) ||
+		    !esp_tx_queue_empty(&context->tx_q[PRIO_Q_MID]))
+			continue;
+
+		if (used + sizeof(struct esp_payload_header) < ESP_RX_BUFFER_SIZE)
+			next_skb = sdio_dequeue_low_prio_skb(context, ESP_RX_BUFFER_SIZE - used);
+	}
+
+	skb_put(agg_skb, used);
+
+	return agg_skb;
+}
+
+static void sdio_tx_complete(struct esp_adapter *adapter, struct sk_buff *tx_skb, int ret)
+{
+	struct esp_skb_cb *cb = (struct esp_skb_cb *)tx_skb->cb;
+
+	esp_tx_bql_completed(tx_skb);
+
+	if (ret) {
+		/* drop the packet */
+		if (cb->priv)
+			cb->priv->stats.tx_dropped++;
+	} else {
+		esp_update_tx_latency_stats(adapter, cb->enqueue_time);
+	}
+
+	dev_kfree_skb(tx_skb);
+}
+
+/* TX thread sleeps till there is data to send and ESP could take it */
+static bool is_tx_work_pending(struct esp_sdio_context *context)
+{
+	if (kthread_should_stop())
+		return true;
+
+	if (host_sleep || context->state != ESP_CONTEXT_READY)
+		return false;
+
+	return !esp_tx_queue_empty(&context->tx_q[PRIO_Q_HIGH]) ||
+		!esp_tx_queue_empty(&context->tx_q[PRIO_Q_MID]) ||
+		!esp_tx_queue_empty(&context->tx_q[PRIO_Q_LOW]);
 }
 
 static int tx_process(void *data)
@@ -539,85 +856,79 @@ static int tx_process(void *data)
 	u32 buf_needed = 0;
 	u8 *pos = NULL;
 	u32 data_left, len_to_send, pad;
-	struct sk_buff *tx_skb = NULL;
+	struct sk_buff *tx_skb = NULL, *write_skb = NULL;
+	struct sk_buff_head done_q;
 	struct esp_adapter *adapter = (struct esp_adapter *) data;
 	struct esp_sdio_context *context = NULL;
 	struct esp_skb_cb *cb = NULL;
-	u8 retry;
+	u8 prio = PRIO_Q_HIGH;
+	u16 txq = 0;
+	u16 slot = 0;
 
 	context = adapter->if_context;
+	__skb_queue_head_init(&done_q);
 
 	while (!kthread_should_stop()) {
 
-		if (context->state != ESP_CONTEXT_READY) {
-			msleep(10);
-			esp_err("not ready");
+		if (wait_event_interruptible(context->tx_wait, is_tx_work_pending(context)))
 			continue;
-		}
 
-		if (host_sleep) {
-			/* TODO: Use wait_event_interruptible_timeout */
-			msleep(100);
+		if (kthread_should_stop())
+			break;
+
+		prio = esp_tx_queue_select(context->tx_q, context->tx_mid_burst);
+		if (prio >= MAX_PRIORITY_QUEUES)
 			continue;
-		}
 
-		if (atomic_read(&queue_items[PRIO_Q_HIGH]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_HIGH]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_HIGH]);
-		} else if (atomic_read(&queue_items[PRIO_Q_MID]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_MID]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_MID]);
-		} else if (atomic_read(&queue_items[PRIO_Q_LOW]) > 0) {
-			tx_skb = skb_dequeue(&(context->tx_q[PRIO_Q_LOW]));
-			if (!tx_skb) {
-				continue;
-			}
-			atomic_dec(&queue_items[PRIO_Q_LOW]);
-		} else {
-#if 0
-			esp_err("not ready 2 [%d %d]\n",
-					atomic_read(&queue_items[PRIO_Q_OTHERS]),
-					atomic_read(&queue_items[PRIO_Q_SERIAL]));
-#endif
-			msleep(1);
+		/* Only this thread dequeues, so head stays same till dequeued */
+		tx_skb = esp_tx_queue_peek(&(context->tx_q[prio]));
+		if (!tx_skb)
 			continue;
-		}
 
-		if (atomic_read(&tx_pending))
-			atomic_dec(&tx_pending);
+		buf_needed = (tx_skb->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
+
+		/* Write only when slave has buffers, else keep packet queued */
+		if (!wait_for_tx_credits(context, buf_needed))
+			continue;
 
-		retry = MAX_WRITE_RETRIES;
+		tx_skb = esp_tx_queue_dequeue(&(context->tx_q[prio]));
+		esp_tx_queue_served(&context->tx_mid_burst, prio);
+		context->tx_credits -= buf_needed;
+
+		txq = esp_skb_net_txq(tx_skb);
+		slot = esp_skb_tx_slot(tx_skb);
+		if (atomic_read(&tx_pending[slot]))
+			atomic_dec(&tx_pending[slot]);
 
 		/* resume network tx queue if bearable load */
 		cb = (struct esp_skb_cb *)tx_skb->cb;
-		if (cb && cb->priv && atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
-			esp_tx_resume(cb->priv);
+		if (cb && cb->priv && atomic_read(&tx_pending[slot]) < TX_RESUME_THRESHOLD) {
+			esp_tx_resume_queue(cb->priv, txq);
 			#if TEST_RAW_TP
 				esp_raw_tp_queue_resume();
 			#endif
 		}
 
-		buf_needed = (tx_skb->len + ESP_RX_BUFFER_SIZE - 1) / ESP_RX_BUFFER_SIZE;
+		write_skb = tx_skb;
+		if (prio == PRIO_Q_LOW)
+			write_skb = sdio_aggregate_tx_skb(context, tx_skb, &done_q);
 
-		/*If SDIO slave buffer is available to write then only write data
-		else wait till buffer is available*/
-		ret = is_sdio_write_buffer_available(buf_needed);
-		if (!ret) {
-			dev_kfree_skb(tx_skb);
+		/* CMD53 segments have to be 4 byte multiples, which frags of
+		 * arbitrary length can't meet. Copy is made here in TX thread,
+		 * not in xmit path */
+		if ((write_skb == tx_skb) && skb_linearize(tx_skb)) {
+			sdio_tx_complete(adapter, tx_skb, -ENOMEM);
+			tx_skb = write_skb = NULL;
 			continue;
 		}
 
-		pos = tx_skb->data;
+		pos = write_skb->data;
 		data_left = len_to_send = 0;
 
-		data_left = tx_skb->len;
-		pad = ESP_BLOCK_SIZE - (data_left % ESP_BLOCK_SIZE);
+		data_left = write_skb->len;
+		/* No padding for block aligned length, extra block would spill
+		 * into next ESP Rx buffer */
+		pad = (ESP_BLOCK_SIZE - (data_left % ESP_BLOCK_SIZE)) % ESP_BLOCK_SIZE;
 		data_left += pad;
 
 
@@ -636,17 +947,20 @@ static int tx_process(void *data)
 			pos += len_to_send;
 		} while (data_left);
 
-		if (ret) {
-			/* drop the packet */
-			dev_kfree_skb(tx_skb);
-			continue;
+		if (!ret) {
+			context->tx_buffer_count += buf_needed;
+			context->tx_buffer_count = context->tx_buffer_count % ESP_TX_BUFFER_MAX;
 		}
 
-		context->tx_buffer_count += buf_needed;
-		context->tx_buffer_count = context->tx_buffer_count % ESP_TX_BUFFER_MAX;
+		if (write_skb != tx_skb) {
+			while ((tx_skb = __skb_dequeue(&done_q)))
+				sdio_tx_complete(adapter, tx_skb, ret);
+			dev_kfree_skb(write_skb);
+		} else {
+			sdio_tx_complete(adapter, tx_skb, ret);
+		}
 
-		dev_kfree_skb(tx_skb);
-		tx_skb = NULL;
+		tx_skb = write_skb = NULL;
 	}
 
 	do_exit(0);
@@ -723,7 +1037,7 @@ static int monitor_process(void *data)
 						len_reg, context->rx_byte_count,
 						rdata, context->tx_buffer_count, intr);
 
-				skb = read_packet(context->adapter);
+				skb = read_packet_from_slave(context);
 
 				if (!skb)
 					continue;
@@ -750,6 +1064,7 @@ static int esp_probe(struct sdio_func *func,
 {
 	struct esp_sdio_context *context = NULL;
 	int ret = 0;
+	u16 slot = 0;
 
 	if (func->num != 1) {
 		return -EINVAL;
@@ -764,7 +1079,8 @@ static int esp_probe(struct sdio_func *func,
 	}
 
 	context->state = ESP_CONTEXT_READY;
-	atomic_set(&tx_pending, 0);
+	for (slot = 0; slot < ESP_TX_SLOTS; slot++)
+		atomic_set(&tx_pending[slot], 0);
 	ret = init_context(context);
 	if (ret) {
 		deinit_sdio_func(func);
@@ -858,6 +1174,9 @@ static int esp_resume(struct device *dev)
 	msleep(100);
 	generate_slave_intr(context, BIT(ESP_POWER_SAVE_OFF));
 	host_sleep = 0;
+
+	/* Send whatever got queued while asleep */
+	wake_up_interruptible(&context->tx_wait);
 	return 0;
 }
 
@@ -903,6 +1222,7 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 	if (!evt_buf)
 		return;
 
+	adapter->ext_capabilities = 0;
 	pos = evt_buf;
 
 	while (len_left) {
@@ -931,6 +1251,14 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 		} else if (*pos == ESP_BOOTUP_TEST_RAW_TP) {
 			process_test_capabilities(*(pos + 2));
 
+		} else if (*pos == ESP_BOOTUP_EXT_CAPABILITY) {
+
+			if (sdio_aggregation)
+				adapter->ext_capabilities |= *(pos + 2) & ESP_SDIO_AGGREGATION_SUPPORT;
+			/* Batched reads are split by esp_rx_split_enqueue() */
+			adapter->ext_capabilities |= *(pos + 2) & ESP_SDIO_TX_STREAM_SUPPORT;
+			adapter->ext_capabilities |= *(pos + 2) & esp_get_host_ext_capabilities();
+
 		} else if (*pos == ESP_BOOTUP_FW_DATA) {
 
 			if (tag_len != sizeof(struct fw_data))
@@ -950,6 +1278,10 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 		len_left -= (tag_len+2);
 	}
 
+	/* Let ESP know which of the advertised extensions host will use */
+	if (adapter->ext_capabilities)
+		esp_send_host_capability(adapter);
+
 	if (esp_add_card(adapter)) {
 		esp_err("network iterface init failed\n");
 		generate_slave_intr(context, BIT(ESP_CLOSE_DATA_PATH));
@@ -80,9 +80,18 @@ struct esp_sdio_context {
 	struct esp_adapter     *adapter;
 	struct sdio_func       *func;
 	enum context_state     state;
-	struct sk_buff_head    tx_q[MAX_PRIORITY_QUEUES];
+	struct esp_tx_queue    tx_q[MAX_PRIORITY_QUEUES];
+	struct sk_buff_head    rx_q[MAX_PRIORITY_QUEUES];
+	wait_queue_head_t      tx_wait;
 	u32                    rx_byte_count;
 	u32                    tx_buffer_count;
+	/* Slave Rx buffers host could write to, as of last token read */
+	u32                    tx_credits;
+	atomic_t               credit_update;
+	/* Net subqueues stopped for lack of credits, till tx thread sees them back */
+	bool                   tx_paused;
+	/* PRIO_Q_MID packets sent in a row, see esp_tx_queue_select() */
+	u8                     tx_mid_burst;
 };
 
 #endif
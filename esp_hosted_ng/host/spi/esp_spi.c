@@ -8,6 +8,8 @@
 #include <linux/gpio.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "esp_spi.h"
 #include "esp_if.h"
 #include "esp_api.h"
@@ -30,8 +32,35 @@ volatile u8 data_path;
 volatile u8 host_sleep;
 static struct esp_spi_context spi_context;
 static char hardware_type = ESP_FIRMWARE_CHIP_UNRECOGNIZED;
-static atomic_t tx_pending;
+/* Per netdev Tx queue. Written by every transmitting CPU, kept off lines
+ * of read mostly data */
+static atomic_t tx_pending[ESP_TX_SLOTS] ____cacheline_aligned_in_smp;
 static uint8_t esp_reset_after_module_load;
+static bool spi_aggregation = true;
+static bool spi_variable_len = true;
+static bool spi_pipeline = true;
+static bool spi_irq_moderation;
+static bool spi_clk_autotune;
+static bool spi_clk_overclock;
+static uint spi_clk_mhz_hint;
+
+module_param(spi_aggregation, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_aggregation, "Carry multiple packets per SPI transaction, if ESP supports it");
+module_param(spi_variable_len, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_variable_len, "Size SPI transactions to announced length instead of SPI_BUF_SIZE, if ESP supports it");
+module_param(spi_pipeline, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_pipeline, "Submit next SPI transaction before processing Rx of previous one");
+module_param(spi_irq_moderation, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_irq_moderation, "Poll instead of taking GPIO interrupts under sustained load");
+module_param(spi_clk_autotune, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_clk_autotune, "Ramp SPI clock up while link is error free, back off on errors. Needs checksum enabled on ESP");
+module_param(spi_clk_overclock, bool, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_clk_overclock, "Let auto tuning raise SPI clock above the one ESP announces. Host to ESP corruption is not detected, use only if ESP side was verified");
+module_param(spi_clk_mhz_hint, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(spi_clk_mhz_hint, "SPI clock to start auto tuning from. Updated with clock chosen by auto tuning, so it can be passed on next load");
+
+/* Clocks auto tuning steps through */
+static const u8 spi_clk_steps[SPI_CLK_NUM_STEPS] = { 8, 10, 13, 16, 20, 26, 30, 40 };
 
 static struct esp_if_ops if_ops = {
 	.read		= read_packet,
@@ -42,7 +71,10 @@ static DEFINE_MUTEX(spi_lock);
 
 static void open_data_path(void)
 {
-	atomic_set(&tx_pending, 0);
+	u16 slot = 0;
+
+	for (slot = 0; slot < ESP_TX_SLOTS; slot++)
+		atomic_set(&tx_pending[slot], 0);
 	msleep(200);
 	data_path = OPEN_DATAPATH;
 }
@@ -53,22 +85,31 @@ static void close_data_path(void)
 	msleep(200);
 }
 
-static irqreturn_t spi_data_ready_interrupt_handler(int irq, void *dev)
+static void spi_kick_work(void)
 {
-	/* ESP peripheral has queued buffer for transmission */
 	if (spi_context.spi_workqueue)
 		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
+}
 
-	return IRQ_HANDLED;
+static irqreturn_t spi_data_ready_interrupt_handler(int irq, void *dev)
+{
+	/* ESP peripheral has queued buffer for transmission */
+	spi_context.irq_stats.data_ready_irqs++;
+
+	return IRQ_WAKE_THREAD;
  }
 
 static irqreturn_t spi_interrupt_handler(int irq, void *dev)
 {
 	/* ESP peripheral is ready for next SPI transaction */
-	if (spi_context.spi_workqueue)
-		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
+	spi_context.irq_stats.handshake_irqs++;
+	atomic_inc(&spi_context.hs_edges);
 
-	return IRQ_HANDLED;
+	/* Spi work polls on its own, edge is only counted */
+	if (READ_ONCE(spi_context.poll_mode))
+		return IRQ_HANDLED;
+
+	return IRQ_WAKE_THREAD;
 }
 
 static struct sk_buff *read_packet(struct esp_adapter *adapter)
@@ -106,6 +147,9 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	u32 max_pkt_size = SPI_BUF_SIZE - sizeof(struct esp_payload_header);
 	struct esp_payload_header *payload_header = (struct esp_payload_header *) skb->data;
 	struct esp_skb_cb *cb = NULL;
+	u8 prio = PRIO_Q_LOW;
+	u16 txq = ESP_NET_TXQ_BE;
+	u16 slot = 0;
 
 	if (!adapter || !adapter->if_context || !skb || !skb->data || !skb->len) {
 		esp_err("Invalid args\n");
@@ -130,31 +174,150 @@ static int write_packet(struct esp_adapter *adapter, struct sk_buff *skb)
 	}
 
 	cb = (struct esp_skb_cb *)skb->cb;
-	if (cb && cb->priv && (atomic_read(&tx_pending) >= TX_MAX_PENDING_COUNT)) {
-		esp_tx_pause(cb->priv);
-		dev_kfree_skb(skb);
-		skb = NULL;
-		/*esp_err("TX Pause busy");*/
-		if (spi_context.spi_workqueue)
-			queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
-		return -EBUSY;
+	txq = esp_skb_net_txq(skb);
+	slot = esp_skb_tx_slot(skb);
+	if (cb && cb->priv && (atomic_read(&tx_pending[slot]) >= TX_MAX_PENDING_COUNT)) {
+		esp_tx_pause_queue(cb->priv, txq);
+
+		/* Rest of TSO super-packet is queued anyway */
+		if (!cb->gso_seg) {
+			dev_kfree_skb(skb);
+			skb = NULL;
+			/*esp_err("TX Pause busy");*/
+			spi_kick_work();
+			return -EBUSY;
+		}
 	}
 
 	/* Enqueue SKB in tx_q */
-	if (payload_header->if_type == ESP_INTERNAL_IF) {
-		skb_queue_tail(&spi_context.tx_q[PRIO_Q_HIGH], skb);
-	} else if (payload_header->if_type == ESP_HCI_IF) {
-		skb_queue_tail(&spi_context.tx_q[PRIO_Q_MID], skb);
-	} else {
-		skb_queue_tail(&spi_context.tx_q[PRIO_Q_LOW], skb);
-		atomic_inc(&tx_pending);
+	if (payload_header->if_type == ESP_INTERNAL_IF)
+		prio = PRIO_Q_HIGH;
+	else if (payload_header->if_type == ESP_HCI_IF)
+		prio = PRIO_Q_MID;
+	else
+		prio = esp_net_txq_to_prio(txq);
+
+	atomic_inc(&tx_pending[slot]);
+	esp_tx_bql_sent(skb);
+	if (esp_tx_queue_push(&spi_context.tx_q[prio], skb))
+		spi_kick_work();
+
+	return 0;
+}
+
+static void spi_clk_tune_set_step(u8 step)
+{
+	struct esp_spi_clk_tune *tune = &spi_context.clk_tune;
+
+	tune->step = step;
+	spi_clk_mhz_hint = spi_clk_steps[step];
+	adjust_spi_clock(spi_clk_steps[step]);
+}
+
+static u8 spi_clk_tune_top(void)
+{
+	struct esp_spi_clk_tune *tune = &spi_context.clk_tune;
+
+	return min(tune->ceiling, tune->limit);
+}
+
+/* Start tuning from hint of earlier run, else clock announced by ESP.
+ * Only Rx checksums catch errors, frames ESP fails to sample are not
+ * seen here, so announced clock is upper limit unless spi_clk_overclock.
+ * Ceiling and per clock stats carry over ESP resets, as link is same */
+static void spi_clk_tune_reset(u8 esp_clk_mhz)
+{
+	struct esp_spi_clk_tune *tune = &spi_context.clk_tune;
+	uint start_mhz = spi_clk_mhz_hint ? spi_clk_mhz_hint : esp_clk_mhz;
+	u8 step = 0;
+
+	tune->limit = SPI_CLK_NUM_STEPS - 1;
+	if (!spi_clk_overclock)
+		while (tune->limit && spi_clk_steps[tune->limit] > esp_clk_mhz)
+			tune->limit--;
+
+	while (step < spi_clk_tune_top() && spi_clk_steps[step + 1] <= start_mhz)
+		step++;
+
+	tune->window_trans = 0;
+	tune->window_errs = 0;
+	tune->last_csum_errs = atomic_read(&spi_context.adapter->rx_checksum_errors);
+
+	esp_info("SPI clock auto tuning from %u MHz\n", spi_clk_steps[step]);
+	spi_clk_tune_set_step(step);
+}
+
+static void spi_clk_tune_update(void)
+{
+	struct esp_spi_clk_tune *tune = &spi_context.clk_tune;
+	int csum_errs = atomic_read(&spi_context.adapter->rx_checksum_errors);
+	u32 errs = tune->window_errs + (csum_errs - tune->last_csum_errs);
+
+	tune->steps[tune->step].errors += csum_errs - tune->last_csum_errs;
+	tune->last_csum_errs = csum_errs;
+	tune->window_trans = 0;
+	tune->window_errs = 0;
+
+	if (errs > SPI_CLK_TUNE_MAX_ERRS) {
+		if (!tune->step)
+			return;
+
+		esp_warn("%u SPI errors at %u MHz, backing off\n", errs, spi_clk_steps[tune->step]);
+		tune->ceiling = tune->step - 1;
+		spi_clk_tune_set_step(tune->step - 1);
+	} else if (tune->step < spi_clk_tune_top()) {
+		spi_clk_tune_set_step(tune->step + 1);
 	}
+}
 
-	if (spi_context.spi_workqueue)
-		queue_work(spi_context.spi_workqueue, &spi_context.spi_work);
+/* Account completed transaction t to current clock. Called under spi_lock */
+static void spi_clk_tune_account(struct esp_spi_trans *t, bool error)
+{
+	struct esp_spi_clk_tune *tune = &spi_context.clk_tune;
+	struct esp_spi_clk_step_stats *stats = &tune->steps[tune->step];
+
+	if (!tune->enabled)
+		return;
+
+	stats->transactions++;
+	stats->busy_us += ktime_us_delta(t->end_time, t->start_time);
+	if (error)
+		stats->errors++;
+	else
+		stats->bytes += t->len;
+
+	tune->window_trans++;
+	tune->window_errs += error;
+
+	if (tune->window_trans >= SPI_CLK_TUNE_WINDOW)
+		spi_clk_tune_update();
+}
+
+static int spi_clk_tune_show(struct seq_file *s, void *unused)
+{
+	struct esp_spi_context *context = s->private;
+	struct esp_spi_clk_tune *tune = &context->clk_tune;
+	struct esp_spi_clk_step_stats *stats = NULL;
+	u8 step = 0;
+
+	seq_printf(s, "auto tuning: %s, clock %u MHz, ceiling %u MHz\n",
+			tune->enabled ? "on" : "off", context->spi_clk_mhz,
+			spi_clk_steps[spi_clk_tune_top()]);
+	seq_printf(s, "%4s %14s %10s %8s\n", "MHz", "transactions", "errors", "Mbps");
+
+	for (step = 0; step < SPI_CLK_NUM_STEPS; step++) {
+		stats = &tune->steps[step];
+		if (!stats->transactions)
+			continue;
+
+		seq_printf(s, "%4u %14llu %10llu %8llu\n", spi_clk_steps[step],
+				stats->transactions, stats->errors,
+				stats->busy_us ? div64_u64(stats->bytes * 8, stats->busy_us) : 0);
+	}
 
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(spi_clk_tune);
 
 void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 {
@@ -165,6 +328,7 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 	 */
 	u8 len_left = len, tag_len;
 	u8 *pos;
+	u8 esp_clk_mhz = 0;
 	uint8_t iface_idx = 0;
 	uint8_t prio_q_idx = 0;
 
@@ -178,6 +342,8 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 	if (esp_reset_after_module_load)
 		set_bit(ESP_CLEANUP_IN_PROGRESS, &adapter->state_flags);
 
+	adapter->ext_capabilities = 0;
+	spi_context.rx_len_hint = 0;
 	pos = evt_buf;
 
 	while (len_left) {
@@ -202,7 +368,8 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 
 		} else if (*pos == ESP_BOOTUP_SPI_CLK_MHZ) {
 
-			adjust_spi_clock(*(pos + 2));
+			/* Applied once capabilities are known, below */
+			esp_clk_mhz = *(pos + 2);
 			adapter->dev = &spi_context.esp_spi_dev->dev;
 
 		} else if (*pos == ESP_BOOTUP_FIRMWARE_CHIP_ID) {
@@ -211,6 +378,15 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 
 		} else if (*pos == ESP_BOOTUP_TEST_RAW_TP) {
 			process_test_capabilities(*(pos + 2));
+
+		} else if (*pos == ESP_BOOTUP_EXT_CAPABILITY) {
+
+			if (spi_aggregation)
+				adapter->ext_capabilities |= *(pos + 2) & ESP_SPI_AGGREGATION_SUPPORT;
+			if (spi_variable_len)
+				adapter->ext_capabilities |= *(pos + 2) & ESP_SPI_VARIABLE_LEN_SUPPORT;
+			adapter->ext_capabilities |= *(pos + 2) & esp_get_host_ext_capabilities();
+
 		} else {
 			esp_warn("Unsupported tag in event");
 		}
@@ -219,6 +395,27 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 		len_left -= (tag_len+2);
 	}
 
+	if (esp_clk_mhz) {
+		/* Auto tuning sees corrupt frames only through Rx checksum
+		 * failures, so without checksum it would just ramp up.
+		 * Below slowest step there is nothing to tune within limit */
+		mutex_lock(&spi_lock);
+		spi_context.clk_tune.enabled = spi_clk_autotune &&
+			(adapter->capabilities & ESP_CHECKSUM_ENABLED) &&
+			(spi_clk_overclock || esp_clk_mhz >= spi_clk_steps[0]);
+		if (spi_context.clk_tune.enabled) {
+			spi_clk_tune_reset(esp_clk_mhz);
+		} else {
+			if (spi_clk_autotune && !(adapter->capabilities & ESP_CHECKSUM_ENABLED))
+				esp_warn("Checksum disabled on ESP, SPI clock auto tuning off\n");
+			else if (spi_clk_autotune)
+				esp_warn("ESP clock %u MHz below tuning range, SPI clock auto tuning off\n",
+						esp_clk_mhz);
+			adjust_spi_clock(esp_clk_mhz);
+		}
+		mutex_unlock(&spi_lock);
+	}
+
 	if ((hardware_type != ESP_FIRMWARE_CHIP_ESP32) &&
 	    (hardware_type != ESP_FIRMWARE_CHIP_ESP32S2) &&
 	    (hardware_type != ESP_FIRMWARE_CHIP_ESP32C3) &&
@@ -253,9 +450,12 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 		 *   there is no need to re-init them
 		 */
 
+		/* Tx queues are drained by spi work only, which runs under spi_lock */
+		mutex_lock(&spi_lock);
 		for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
-			skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
+			esp_tx_queue_purge(&spi_context.tx_q[prio_q_idx]);
 		}
+		mutex_unlock(&spi_lock);
 
 		for (iface_idx = 0; iface_idx < ESP_MAX_INTERFACE; iface_idx++) {
 
@@ -276,11 +476,17 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 
 		esp_remove_card(adapter);
 
+		mutex_lock(&spi_lock);
 		for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
-			skb_queue_head_init(&spi_context.tx_q[prio_q_idx]);
+			esp_tx_queue_purge(&spi_context.tx_q[prio_q_idx]);
 		}
+		mutex_unlock(&spi_lock);
 	}
 
+	/* Let ESP know which of the advertised extensions host will use */
+	if (adapter->ext_capabilities)
+		esp_send_host_capability(adapter);
+
 	if (esp_add_card(adapter)) {
 		esp_err("network iterface init failed\n");
 	}
@@ -293,17 +499,14 @@ void process_event_esp_bootup(struct esp_adapter *adapter, u8 *evt_buf, u8 len)
 }
 
 
-static int process_rx_buf(struct sk_buff *skb)
+static int validate_rx_record(struct esp_payload_header *header, u16 buf_len)
 {
-	struct esp_payload_header *header;
 	u16 len = 0;
 	u16 offset = 0;
 
-	if (!skb)
+	if (buf_len < sizeof(struct esp_payload_header))
 		return -EINVAL;
 
-	header = (struct esp_payload_header *) skb->data;
-
 	if (header->if_type >= ESP_MAX_IF) {
 		return -EINVAL;
 	}
@@ -322,18 +525,16 @@ static int process_rx_buf(struct sk_buff *skb)
 
 	len += sizeof(struct esp_payload_header);
 
-	if (len > SPI_BUF_SIZE) {
+	if (len > buf_len) {
 		return -EINVAL;
 	}
 
-	/* Trim SKB to actual size */
-	skb_trim(skb, len);
-
+	return len;
+}
 
-	if (!data_path) {
-		/*esp_info("%u datapath closed\n", __LINE__);*/
-		return -EPERM;
-	}
+static void spi_rx_enqueue(struct sk_buff *skb)
+{
+	struct esp_payload_header *header = (struct esp_payload_header *) skb->data;
 
 	/* enqueue skb for read_packet to pick it */
 	if (header->if_type == ESP_INTERNAL_IF)
@@ -342,109 +543,685 @@ static int process_rx_buf(struct sk_buff *skb)
 		skb_queue_tail(&spi_context.rx_q[PRIO_Q_MID], skb);
 	else
 		skb_queue_tail(&spi_context.rx_q[PRIO_Q_LOW], skb);
+}
+
+static int process_rx_buf(struct sk_buff *skb)
+{
+	struct esp_payload_header *header;
+	struct sk_buff *record_skb = NULL;
+	int len = 0;
+	u16 stride = 0;
+	u8 more_records = 0;
+	u8 queued = 0;
+	int ret = 0;
+
+	if (!skb)
+		return -EINVAL;
+
+	/* With aggregation, transaction carries back to back records, each
+	 * 4 byte aligned, and all but last marked with MORE_AGGR_RECORDS */
+	do {
+		header = (struct esp_payload_header *) skb->data;
+
+		len = validate_rx_record(header, skb->len);
+		if (len < 0) {
+			ret = len;
+			break;
+		}
+
+		if (!data_path) {
+			/*esp_info("%u datapath closed\n", __LINE__);*/
+			ret = -EPERM;
+			break;
+		}
+
+		more_records = (spi_context.adapter->ext_capabilities & ESP_SPI_AGGREGATION_SUPPORT) &&
+			(header->flags & MORE_AGGR_RECORDS);
+		stride = ALIGN(len, SKB_DATA_ADDR_ALIGNMENT);
+
+		if (more_records && stride < skb->len) {
+			record_skb = esp_alloc_skb(len);
+			if (!record_skb) {
+				ret = -ENOMEM;
+				break;
+			}
+
+			skb_put_data(record_skb, skb->data, len);
+			spi_rx_enqueue(record_skb);
+			skb_pull(skb, stride);
+		} else {
+			/* Trim SKB to actual size */
+			skb_trim(skb, len);
+			spi_rx_enqueue(skb);
+			more_records = 0;
+		}
+
+		queued++;
+	} while (more_records);
+
+	spi_context.trans_stats.packets += queued;
 
 	/* indicate reception of new packet */
-	esp_process_new_packet_intr(spi_context.adapter);
+	if (queued)
+		esp_process_new_packet_intr(spi_context.adapter);
 
-	return 0;
+	return ret;
 }
 
-static void esp_spi_work(struct work_struct *work)
+static bool spi_tx_queued(void)
+{
+	u8 prio_q_idx = 0;
+
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++)
+		if (!esp_tx_queue_empty(&spi_context.tx_q[prio_q_idx]))
+			return true;
+
+	return false;
+}
+
+/* Dequeue head of highest priority non-empty tx_q, only if it fits max_len.
+ * Called from spi work under spi_lock, the only consumer of tx_q */
+static struct sk_buff *spi_dequeue_tx_skb(u32 max_len)
 {
-	struct spi_transfer trans;
-	struct sk_buff *tx_skb = NULL, *rx_skb = NULL;
+	struct esp_tx_queue *q = NULL;
+	struct sk_buff *tx_skb = NULL;
 	struct esp_skb_cb *cb = NULL;
-	u8 *rx_buf = NULL;
+	u8 prio = 0;
+	u16 txq = 0;
+	u16 slot = 0;
+
+	prio = esp_tx_queue_select(spi_context.tx_q, spi_context.tx_mid_burst);
+	if (prio >= MAX_PRIORITY_QUEUES)
+		return NULL;
+
+	q = &spi_context.tx_q[prio];
+
+	tx_skb = esp_tx_queue_peek(q);
+	if (!tx_skb || tx_skb->len > max_len)
+		return NULL;
+
+	tx_skb = esp_tx_queue_dequeue(q);
+	esp_tx_queue_served(&spi_context.tx_mid_burst, prio);
+	spi_context.trans_stats.packets++;
+
+	txq = esp_skb_net_txq(tx_skb);
+	slot = esp_skb_tx_slot(tx_skb);
+	if (atomic_read(&tx_pending[slot]))
+		atomic_dec(&tx_pending[slot]);
+
+	/* resume network tx queue if bearable load */
+	cb = (struct esp_skb_cb *)tx_skb->cb;
+	if (cb && cb->priv && atomic_read(&tx_pending[slot]) < TX_RESUME_THRESHOLD) {
+		esp_tx_resume_queue(cb->priv, txq);
+		#if TEST_RAW_TP
+			esp_raw_tp_queue_resume();
+		#endif
+	}
+
+	return tx_skb;
+}
+
+static void spi_mark_more_records(struct esp_payload_header *header)
+{
+	u16 len = le16_to_cpu(header->len) + le16_to_cpu(header->offset);
+
+	header->flags |= MORE_AGGR_RECORDS;
+
+	/* Flag is covered by checksum, so recompute it */
+	if (spi_context.adapter->capabilities & ESP_CHECKSUM_ENABLED) {
+		header->checksum = 0;
+		header->checksum = cpu_to_le16(esp_compute_checksum(spi_context.adapter, (u8 *) header, len));
+	}
+}
+
+/* Pack as many queued packets as fit in SPI_BUF_SIZE behind tx_skb */
+static struct sk_buff *spi_aggregate_tx_skb(struct sk_buff *tx_skb)
+{
+	struct esp_payload_header *header = NULL;
+	struct sk_buff *agg_skb = NULL, *next_skb = NULL;
+	u32 used = ALIGN(tx_skb->len, SKB_DATA_ADDR_ALIGNMENT);
+
+	if (!(spi_context.adapter->ext_capabilities & ESP_SPI_AGGREGATION_SUPPORT))
+		return tx_skb;
+
+	if ((used + sizeof(struct esp_payload_header) >= SPI_BUF_SIZE) || !spi_tx_queued())
+		return tx_skb;
+
+	agg_skb = esp_alloc_skb(SPI_BUF_SIZE);
+	if (!agg_skb)
+		return tx_skb;
+
+	next_skb = spi_dequeue_tx_skb(SPI_BUF_SIZE - used);
+	if (!next_skb) {
+		dev_kfree_skb(agg_skb);
+		return tx_skb;
+	}
+
+	memset(agg_skb->data, 0, SPI_BUF_SIZE);
+	used = 0;
+
+	while (tx_skb) {
+		if (header)
+			spi_mark_more_records(header);
+
+		header = (struct esp_payload_header *) (agg_skb->data + used);
+		skb_copy_bits(tx_skb, 0, header, tx_skb->len);
+		used += ALIGN(tx_skb->len, SKB_DATA_ADDR_ALIGNMENT);
+		esp_tx_bql_completed(tx_skb);
+		dev_kfree_skb(tx_skb);
+
+		tx_skb = next_skb;
+		next_skb = NULL;
+
+		if (used + sizeof(struct esp_payload_header) < SPI_BUF_SIZE)
+			next_skb = spi_dequeue_tx_skb(SPI_BUF_SIZE - used);
+	}
+
+	skb_put(agg_skb, used);
+
+	return agg_skb;
+}
+
+/* Transaction length: SPI_BUF_SIZE, or with variable length mode,
+ * max(tx_len, announced rx_len) DMA aligned */
+static u16 spi_get_trans_len(struct sk_buff *tx_skb, int rx_pending)
+{
+	u16 tx_len = tx_skb ? tx_skb->len : 0;
+	u16 rx_len = 0;
+
+	if (!(spi_context.adapter->ext_capabilities & ESP_SPI_VARIABLE_LEN_SUPPORT))
+		return SPI_BUF_SIZE;
+
+	if (spi_context.rx_len_hint)
+		rx_len = spi_context.rx_len_hint;
+	else if (rx_pending)
+		rx_len = SPI_BUF_SIZE;
+
+	/* Enough to always pick next length announcement */
+	rx_len = max_t(u16, rx_len, sizeof(struct esp_payload_header));
+
+	return min_t(u16, ALIGN(max(tx_len, rx_len), SKB_DATA_ADDR_ALIGNMENT), SPI_BUF_SIZE);
+}
+
+static void spi_update_rx_len_hint(struct esp_payload_header *header)
+{
+	if (!(spi_context.adapter->ext_capabilities & ESP_SPI_VARIABLE_LEN_SUPPORT))
+		return;
+
+	spi_context.rx_len_hint = min_t(u16, header->reserved1 * SPI_NEXT_TX_LEN_UNIT, SPI_BUF_SIZE);
+}
+
+/* Rx buffers are only written by SPI controller and parsed within the
+ * transaction length, so recycled ones need no zeroing */
+static u8 *spi_rx_buf_get(void)
+{
+	u8 *buf = NULL;
+
+	if (spi_context.rx_pool_count) {
+		spi_context.pool_stats.hits++;
+		return spi_context.rx_pool[--spi_context.rx_pool_count];
+	}
+
+	spi_context.pool_stats.misses++;
+
+	buf = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+	if (!buf)
+		spi_context.pool_stats.alloc_fail++;
+
+	return buf;
+}
+
+static void spi_rx_buf_put(u8 *buf)
+{
+	if (spi_context.rx_pool_count < SPI_RX_POOL_SIZE) {
+		spi_context.rx_pool[spi_context.rx_pool_count++] = buf;
+		spi_context.pool_stats.recycled++;
+	} else {
+		skb_free_frag(buf);
+	}
+}
+
+/* skb takes over the buffer, pool refills on later miss */
+static struct sk_buff *spi_rx_buf_to_skb(u8 *buf, u16 len)
+{
+	struct sk_buff *skb = build_skb(buf, SPI_RX_BUF_TRUESIZE);
+
+	if (!skb)
+		return NULL;
+
+	skb_reserve(skb, SPI_RX_BUF_HEADROOM);
+	skb_put(skb, len);
+	spi_context.pool_stats.skb_built++;
+
+	return skb;
+}
+
+static void spi_rx_pool_fill(void)
+{
+	u8 *buf = NULL;
+
+	while (spi_context.rx_pool_count < SPI_RX_POOL_SIZE) {
+		buf = netdev_alloc_frag(SPI_RX_BUF_TRUESIZE);
+		if (!buf)
+			break;
+
+		spi_context.rx_pool[spi_context.rx_pool_count++] = buf;
+	}
+}
+
+static void spi_rx_pool_drain(void)
+{
+	while (spi_context.rx_pool_count)
+		skb_free_frag(spi_context.rx_pool[--spi_context.rx_pool_count]);
+}
+
+static int spi_pool_stats_show(struct seq_file *s, void *unused)
+{
+	struct esp_spi_context *context = s->private;
+	struct esp_spi_pool_stats *stats = &context->pool_stats;
+
+	seq_printf(s, "pool size:  %u\n", SPI_RX_POOL_SIZE);
+	seq_printf(s, "available:  %u\n", context->rx_pool_count);
+	seq_printf(s, "hits:       %llu\n", stats->hits);
+	seq_printf(s, "misses:     %llu\n", stats->misses);
+	seq_printf(s, "alloc fail: %llu\n", stats->alloc_fail);
+	seq_printf(s, "recycled:   %llu\n", stats->recycled);
+	seq_printf(s, "skb built:  %llu\n", stats->skb_built);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_pool_stats);
+
+static int spi_trans_stats_show(struct seq_file *s, void *unused)
+{
+	struct esp_spi_context *context = s->private;
+	struct esp_spi_trans_stats *stats = &context->trans_stats;
+	struct esp_spi_irq_stats *irq_stats = &context->irq_stats;
+	u64 total_us = stats->busy_us + stats->gap_us;
+	u64 irqs = irq_stats->handshake_irqs + irq_stats->data_ready_irqs;
+
+	seq_printf(s, "pipeline:   %s\n", spi_pipeline ? "on" : "off");
+	seq_printf(s, "transfers:  %llu\n", stats->transfers);
+	seq_printf(s, "pipelined:  %llu\n", stats->pipelined);
+	seq_printf(s, "busy us:    %llu\n", stats->busy_us);
+	seq_printf(s, "gap us:     %llu\n", stats->gap_us);
+	seq_printf(s, "bus util:   %llu%%\n",
+			total_us ? div64_u64(stats->busy_us * 100, total_us) : 0);
+	seq_printf(s, "packets:    %llu\n", stats->packets);
+	seq_printf(s, "handshake settle waits: %llu\n", stats->hs_settle);
+	seq_printf(s, "irq moderation: %s, %s mode\n", spi_irq_moderation ? "on" : "off",
+			context->poll_mode ? "poll" : "interrupt");
+	seq_printf(s, "handshake irqs:  %llu\n", irq_stats->handshake_irqs);
+	seq_printf(s, "data ready irqs: %llu\n", irq_stats->data_ready_irqs);
+	seq_printf(s, "poll enter: %llu\n", irq_stats->poll_enter);
+	seq_printf(s, "poll exit:  %llu\n", irq_stats->poll_exit);
+	seq_printf(s, "irqs per 100 packets: %llu\n",
+			stats->packets ? div64_u64(irqs * 100, stats->packets) : 0);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_trans_stats);
+
+/* Frags are handed to SPI controller through their kernel address */
+static bool spi_can_tx_in_place(struct sk_buff *tx_skb)
+{
+	int i = 0;
+
+	for (i = 0; i < skb_shinfo(tx_skb)->nr_frags; i++)
+		if (PageHighMem(skb_frag_page(&skb_shinfo(tx_skb)->frags[i])))
+			return false;
+
+	return true;
+}
+
+/* Clock out fragmented tx_skb in place, one transfer per linear part and
+ * frag, and zeros for rest of trans_len. CS stays asserted throughout, so
+ * ESP sees single transaction. Returns number of transfers set up */
+static int spi_setup_sg_transfers(struct esp_spi_trans *t, u8 *rx_buf, u16 trans_len)
+{
+	struct sk_buff *tx_skb = t->tx_skb;
+	struct spi_transfer *xfer = t->xfers;
+	skb_frag_t *frag = NULL;
+	u16 offset = 0;
+	int i = 0;
+
+	xfer->tx_buf = tx_skb->data;
+	xfer->len = skb_headlen(tx_skb);
+
+	for (i = 0; i < skb_shinfo(tx_skb)->nr_frags; i++) {
+		frag = &skb_shinfo(tx_skb)->frags[i];
+		xfer++;
+		xfer->tx_buf = skb_frag_address(frag);
+		xfer->len = skb_frag_size(frag);
+	}
+
+	if (tx_skb->len < trans_len) {
+		/* Null tx_buf shifts out zeros */
+		xfer++;
+		xfer->len = trans_len - tx_skb->len;
+	}
+
+	for (i = 0; &t->xfers[i] <= xfer; i++) {
+		t->xfers[i].rx_buf = rx_buf + offset;
+		t->xfers[i].speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
+		offset += t->xfers[i].len;
+	}
+
+	return xfer - t->xfers + 1;
+}
+
+/* Runs in SPI controller context, possibly atomic */
+static void spi_trans_complete(void *context)
+{
+	struct esp_spi_trans *t = context;
+
+	t->end_time = ktime_get();
+	t->end_edges = atomic_read(&spi_context.hs_edges);
+	complete(&t->done);
+}
+
+/* Whether ESP has set up its next transaction. Handshake goes low only in
+ * ESP's post transaction ISR, so right after a transaction completes here,
+ * high level may still be the one of that transaction. It is trusted once
+ * a rising edge was counted since, or once it stays high past
+ * SPI_HANDSHAKE_SETTLE_US. Called under spi_lock */
+static bool spi_handshake_ready(void)
+{
+	s64 since_end;
+
+	if (!gpio_get_value(HANDSHAKE_PIN))
+		return false;
+
+	if (atomic_read(&spi_context.hs_edges) != spi_context.last_end_edges)
+		return true;
+
+	since_end = ktime_us_delta(ktime_get(), spi_context.last_end_time);
+	if (since_end >= SPI_HANDSHAKE_SETTLE_US)
+		return true;
+
+	spi_context.trans_stats.hs_settle++;
+	udelay(SPI_HANDSHAKE_SETTLE_US - since_end);
+
+	/* Low by now if it was left over, else ESP raised it again */
+	return !!gpio_get_value(HANDSHAKE_PIN);
+}
+
+/* Set up and submit next transaction on t, if ESP is ready for one and
+ * either side has data. Returns t, or NULL if nothing was submitted.
+ * Called from spi work under spi_lock */
+static struct esp_spi_trans *spi_start_trans(struct esp_spi_trans *t)
+{
+	struct sk_buff *tx_skb = NULL;
+	u8 *rx_data = NULL;
+	u16 trans_len = 0;
+	int num_xfers = 1;
 	int ret = 0;
-	volatile int trans_ready, rx_pending;
+	int i = 0;
+	volatile int rx_pending;
 
-	mutex_lock(&spi_lock);
+	if (!spi_handshake_ready())
+		return NULL;
 
-	trans_ready = gpio_get_value(HANDSHAKE_PIN);
 	rx_pending = gpio_get_value(SPI_DATA_READY_PIN);
 
-	if (trans_ready) {
-		if (data_path) {
-			tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_HIGH]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_MID]);
-			if (!tx_skb)
-				tx_skb = skb_dequeue(&spi_context.tx_q[PRIO_Q_LOW]);
-			if (tx_skb) {
-				if (atomic_read(&tx_pending))
-					atomic_dec(&tx_pending);
-
-				/* resume network tx queue if bearable load */
-				cb = (struct esp_skb_cb *)tx_skb->cb;
-				if (cb && cb->priv && atomic_read(&tx_pending) < TX_RESUME_THRESHOLD) {
-					esp_tx_resume(cb->priv);
-					#if TEST_RAW_TP
-						esp_raw_tp_queue_resume();
-					#endif
-				}
-			}
-		}
+	if (data_path) {
+		tx_skb = spi_dequeue_tx_skb(SPI_BUF_SIZE);
+		if (tx_skb)
+			tx_skb = spi_aggregate_tx_skb(tx_skb);
+	}
 
-		if (rx_pending || tx_skb) {
-			memset(&trans, 0, sizeof(trans));
-			trans.speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
-
-			/* Setup and execute SPI transaction
-			 *	Tx_buf: Check if tx_q has valid buffer for transmission,
-			 *		else keep it blank
-			 *
-			 *	Rx_buf: Allocate memory for incoming data. This will be freed
-			 *		immediately if received buffer is invalid.
-			 *		If it is a valid buffer, upper layer will free it.
-			 * */
-
-			/* Configure TX buffer if available */
-
-			if (tx_skb) {
-				trans.tx_buf = tx_skb->data;
-				/*print_hex_dump(KERN_ERR, "tx: ", DUMP_PREFIX_ADDRESS, 16, 1, trans.tx_buf, 32, 1);*/
-			} else {
-				tx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-				trans.tx_buf = skb_put(tx_skb, SPI_BUF_SIZE);
-				memset((void *)trans.tx_buf, 0, SPI_BUF_SIZE);
-			}
+	if (!rx_pending && !tx_skb)
+		return NULL;
 
-			/* Configure RX buffer */
-			rx_skb = esp_alloc_skb(SPI_BUF_SIZE);
-			rx_buf = skb_put(rx_skb, SPI_BUF_SIZE);
+	memset(t->xfers, 0, sizeof(t->xfers));
 
-			memset(rx_buf, 0, SPI_BUF_SIZE);
+	/* Setup and submit SPI transaction
+	 *	Tx_buf: Check if tx_q has valid buffer for transmission,
+	 *		else clock out zeroes from tx_dummy_buf
+	 *
+	 *	Rx_buf: Taken from rx_pool. Goes back to pool if received
+	 *		data is not valid, else skb is built around it and
+	 *		upper layer will free it.
+	 * */
 
-			trans.rx_buf = rx_buf;
-			trans.len = SPI_BUF_SIZE;
+	trans_len = spi_get_trans_len(tx_skb, rx_pending);
+
+	/* Configure TX buffer if available. Packet counts as
+	 * completed for BQL once it is committed to this transfer */
+	if (tx_skb)
+		esp_tx_bql_completed(tx_skb);
+
+	if (tx_skb && skb_is_nonlinear(tx_skb) &&
+	    !spi_can_tx_in_place(tx_skb) && skb_linearize(tx_skb)) {
+		dev_kfree_skb(tx_skb);
+		return NULL;
+	}
+
+	if (tx_skb) {
+		/* Zero pad, if transaction is longer than packet. Fragmented
+		 * skb is padded by spi_setup_sg_transfers() instead */
+		if (!skb_is_nonlinear(tx_skb) &&
+		    (spi_context.adapter->ext_capabilities & ESP_SPI_VARIABLE_LEN_SUPPORT) &&
+		    skb_put_padto(tx_skb, trans_len))
+			return NULL;
+		t->xfers[0].tx_buf = tx_skb->data;
+		/*print_hex_dump(KERN_ERR, "tx: ", DUMP_PREFIX_ADDRESS, 16, 1, tx_skb->data, 32, 1);*/
+	} else {
+		t->xfers[0].tx_buf = spi_context.tx_dummy_buf;
+	}
+
+	/* Configure RX buffer */
+	t->rx_buf = spi_rx_buf_get();
+	if (!t->rx_buf) {
+		if (tx_skb)
+			dev_kfree_skb(tx_skb);
+		return NULL;
+	}
+	rx_data = t->rx_buf + SPI_RX_BUF_HEADROOM;
+
+	t->tx_skb = tx_skb;
+	t->len = trans_len;
+	t->rx_expected = rx_pending;
+
+	if (tx_skb && skb_is_nonlinear(tx_skb)) {
+		num_xfers = spi_setup_sg_transfers(t, rx_data, trans_len);
+	} else {
+		t->xfers[0].rx_buf = rx_data;
+		t->xfers[0].len = trans_len;
+		t->xfers[0].speed_hz = spi_context.spi_clk_mhz * NUMBER_1M;
+	}
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0))
-			if (hardware_type == ESP_FIRMWARE_CHIP_ESP32) {
-				trans.cs_change = 1;
-			}
+	if (hardware_type == ESP_FIRMWARE_CHIP_ESP32) {
+		t->xfers[num_xfers - 1].cs_change = 1;
+	}
 #endif
 
-			ret = spi_sync_transfer(spi_context.esp_spi_dev, &trans, 1);
-			if (ret) {
-				esp_err("SPI Transaction failed: %d", ret);
-				dev_kfree_skb(rx_skb);
-				dev_kfree_skb(tx_skb);
-			} else {
+	spi_message_init(&t->msg);
+	for (i = 0; i < num_xfers; i++)
+		spi_message_add_tail(&t->xfers[i], &t->msg);
+	t->msg.complete = spi_trans_complete;
+	t->msg.context = t;
+	reinit_completion(&t->done);
+	t->start_time = ktime_get();
+
+	ret = spi_async(spi_context.esp_spi_dev, &t->msg);
+	if (ret) {
+		esp_err("SPI Transaction failed: %d", ret);
+		spi_rx_buf_put(t->rx_buf);
+		if (tx_skb)
+			dev_kfree_skb(tx_skb);
+		t->rx_buf = NULL;
+		t->tx_skb = NULL;
+		return NULL;
+	}
 
-				/* Free rx_skb if received data is not valid */
-				if (process_rx_buf(rx_skb)) {
-					dev_kfree_skb(rx_skb);
-				}
+	spi_context.trans_stats.transfers++;
 
-				if (tx_skb)
-					dev_kfree_skb(tx_skb);
-			}
+	return t;
+}
+
+/* Process Rx of completed transaction t and release its buffers */
+static void spi_finish_trans(struct esp_spi_trans *t)
+{
+	struct sk_buff *rx_skb = NULL;
+	u8 *rx_data = t->rx_buf + SPI_RX_BUF_HEADROOM;
+	bool error = false;
+
+	spi_context.trans_stats.busy_us += ktime_us_delta(t->end_time, t->start_time);
+
+	if (t->msg.status) {
+		esp_err("SPI Transaction failed: %d", t->msg.status);
+		spi_rx_buf_put(t->rx_buf);
+		error = true;
+	} else {
+		/* skb only for valid data, dummy or invalid Rx recycles buffer */
+		if (data_path &&
+		    validate_rx_record((struct esp_payload_header *) rx_data, t->len) >= 0)
+			rx_skb = spi_rx_buf_to_skb(t->rx_buf, t->len);
+		else if (data_path && t->rx_expected)
+			/* ESP had data, but it did not make it across */
+			error = true;
+
+		if (!rx_skb)
+			spi_rx_buf_put(t->rx_buf);
+		else if (process_rx_buf(rx_skb))
+			dev_kfree_skb(rx_skb);
+	}
+
+	spi_clk_tune_account(t, error);
+
+	if (t->tx_skb)
+		dev_kfree_skb(t->tx_skb);
+
+	t->rx_buf = NULL;
+	t->tx_skb = NULL;
+}
+
+/* Without pipelining, one transaction per run, as interrupts trigger
+ * next run. With it, next transaction is submitted as soon as ESP signals
+ * it afresh after current one completes, see spi_handshake_ready(), and
+ * current Rx is processed while next is on the bus. Only one is ever on
+ * the bus, as ESP prepares one at a time and signals each over handshake
+ * pin. Returns number of transactions run */
+static u8 spi_run_transactions(void)
+{
+	struct esp_spi_trans *cur = NULL, *next = NULL;
+	ktime_t cur_end;
+	u8 done = 0;
+
+	cur = spi_start_trans(&spi_context.trans[0]);
+
+	while (cur) {
+		wait_for_completion(&cur->done);
+		cur_end = cur->end_time;
+		spi_context.last_end_time = cur_end;
+		spi_context.last_end_edges = cur->end_edges;
+		done++;
+
+		/* Announced length sizes next transaction, so pick it first */
+		if (!cur->msg.status)
+			spi_update_rx_len_hint((struct esp_payload_header *)
+					(cur->rx_buf + SPI_RX_BUF_HEADROOM));
+
+		next = NULL;
+
+		if (spi_pipeline && done < SPI_PIPELINE_MAX_BURST) {
+			next = spi_start_trans(cur == &spi_context.trans[0] ?
+					&spi_context.trans[1] : &spi_context.trans[0]);
+			if (next)
+				spi_context.trans_stats.pipelined++;
+		}
+
+		spi_finish_trans(cur);
+
+		/* ESP may have got ready meanwhile */
+		if (!next && spi_pipeline && done < SPI_PIPELINE_MAX_BURST)
+			next = spi_start_trans(cur);
+
+		if (next)
+			spi_context.trans_stats.gap_us +=
+				ktime_us_delta(next->start_time, cur_end);
+
+		cur = next;
+	}
+
+	return done;
+}
+
+/* Adaptive interrupt moderation. Run that hit the burst limit means
+ * sustained load, so spi work keeps polling. Data ready interrupt is
+ * masked, handshake one only counts edges then and wakes no thread. Back
+ * to interrupt mode after SPI_POLL_IDLE_LIMIT empty polls.
+ * Called under spi_lock */
+static void spi_update_irq_mode(u8 done)
+{
+	struct esp_spi_irq_stats *stats = &spi_context.irq_stats;
+
+	if (done >= SPI_PIPELINE_MAX_BURST) {
+		spi_context.idle_polls = 0;
+		if (!spi_context.poll_mode) {
+			/* May run in thread of this very irq, so no sync */
+			disable_irq_nosync(SPI_DATA_READY_IRQ);
+			WRITE_ONCE(spi_context.poll_mode, 1);
+			stats->poll_enter++;
 		}
+		spi_kick_work();
+		return;
+	}
+
+	if (!spi_context.poll_mode)
+		return;
+
+	if (done)
+		spi_context.idle_polls = 0;
+	else
+		spi_context.idle_polls++;
+
+	if (spi_context.idle_polls < SPI_POLL_IDLE_LIMIT) {
+		spi_kick_work();
+		return;
 	}
 
+	/* Edge seen while masked is replayed on enable */
+	WRITE_ONCE(spi_context.poll_mode, 0);
+	spi_context.idle_polls = 0;
+	enable_irq(SPI_DATA_READY_IRQ);
+	stats->poll_exit++;
+}
+
+static void spi_process_transactions(void)
+{
+	u8 done = 0;
+
+	mutex_lock(&spi_lock);
+
+	done = spi_run_transactions();
+
+	if (spi_irq_moderation)
+		spi_update_irq_mode(done);
+	else if (done >= SPI_PIPELINE_MAX_BURST)
+		/* Let tx flush and others take spi_lock */
+		spi_kick_work();
+
 	mutex_unlock(&spi_lock);
 }
 
+/* Tx kick from write_packet() and continued polling */
+static void esp_spi_work(struct work_struct *work)
+{
+	spi_process_transactions();
+}
+
+/* Handshake and data ready interrupts run transactions in their threads,
+ * without a trip through workqueue */
+static irqreturn_t spi_irq_thread(int irq, void *dev)
+{
+	spi_process_transactions();
+
+	return IRQ_HANDLED;
+}
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0))
 #include <linux/platform_device.h>
 static int __spi_controller_match(struct device *dev, const void *data)
@@ -544,7 +1321,7 @@ static int spi_dev_init(int spi_clk_mhz)
 		return status;
 	}
 
-	status = request_irq(SPI_IRQ, spi_interrupt_handler,
+	status = request_threaded_irq(SPI_IRQ, spi_interrupt_handler, spi_irq_thread,
 			IRQF_SHARED | IRQF_TRIGGER_RISING,
 			"ESP_SPI", spi_context.esp_spi_dev);
 	if (status) {
@@ -570,8 +1347,8 @@ static int spi_dev_init(int spi_clk_mhz)
 		return status;
 	}
 
-	status = request_irq(SPI_DATA_READY_IRQ, spi_data_ready_interrupt_handler,
-			IRQF_SHARED | IRQF_TRIGGER_RISING,
+	status = request_threaded_irq(SPI_DATA_READY_IRQ, spi_data_ready_interrupt_handler,
+			spi_irq_thread, IRQF_SHARED | IRQF_TRIGGER_RISING,
 			"ESP_SPI_DATA_READY", spi_context.esp_spi_dev);
 	if (status) {
 		gpio_free(HANDSHAKE_PIN);
@@ -591,6 +1368,7 @@ static int spi_init(void)
 {
 	int status = 0;
 	uint8_t prio_q_idx = 0;
+	uint8_t trans_idx = 0;
 	struct esp_adapter *adapter;
 
 	spi_context.spi_workqueue = create_workqueue("ESP_SPI_WORK_QUEUE");
@@ -603,11 +1381,24 @@ static int spi_init(void)
 
 	INIT_WORK(&spi_context.spi_work, esp_spi_work);
 
+	for (trans_idx = 0; trans_idx < SPI_TRANS_DEPTH; trans_idx++)
+		init_completion(&spi_context.trans[trans_idx].done);
+
 	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
-		skb_queue_head_init(&spi_context.tx_q[prio_q_idx]);
+		esp_tx_queue_init(&spi_context.tx_q[prio_q_idx]);
 		skb_queue_head_init(&spi_context.rx_q[prio_q_idx]);
 	}
 
+	spi_context.tx_dummy_buf = kzalloc(SPI_BUF_SIZE, GFP_KERNEL);
+	if (!spi_context.tx_dummy_buf) {
+		esp_err("Failed to allocate SPI dummy buffer\n");
+		spi_exit();
+		return -ENOMEM;
+	}
+
+	/* Pool misses later, if not filled up here */
+	spi_rx_pool_fill();
+
 	status = spi_dev_init(spi_context.spi_clk_mhz);
 	if (status) {
 		spi_exit();
@@ -624,6 +1415,15 @@ static int spi_init(void)
 
 	adapter->dev = &spi_context.esp_spi_dev->dev;
 
+	if (adapter->debugfs_dir) {
+		spi_context.pool_stats_file = debugfs_create_file("spi_buf_pool", 0444,
+				adapter->debugfs_dir, &spi_context, &spi_pool_stats_fops);
+		spi_context.trans_stats_file = debugfs_create_file("spi_trans", 0444,
+				adapter->debugfs_dir, &spi_context, &spi_trans_stats_fops);
+		spi_context.clk_tune.file = debugfs_create_file("spi_clk_tune", 0444,
+				adapter->debugfs_dir, &spi_context, &spi_clk_tune_fops);
+	}
+
 	return status;
 }
 
@@ -637,7 +1437,6 @@ static void spi_exit(void)
 	msleep(200);
 
 	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
-		skb_queue_purge(&spi_context.tx_q[prio_q_idx]);
 		skb_queue_purge(&spi_context.rx_q[prio_q_idx]);
 	}
 
@@ -647,6 +1446,22 @@ static void spi_exit(void)
 		spi_context.spi_workqueue = NULL;
 	}
 
+	/* spi work, consumer of tx_q and rx_pool, is gone now. It waits for
+	 * its transactions to complete, so none is in flight either */
+	for (prio_q_idx = 0; prio_q_idx < MAX_PRIORITY_QUEUES; prio_q_idx++) {
+		esp_tx_queue_purge(&spi_context.tx_q[prio_q_idx]);
+	}
+
+	spi_rx_pool_drain();
+	kfree(spi_context.tx_dummy_buf);
+	spi_context.tx_dummy_buf = NULL;
+	debugfs_remove(spi_context.pool_stats_file);
+	spi_context.pool_stats_file = NULL;
+	debugfs_remove(spi_context.trans_stats_file);
+	spi_context.trans_stats_file = NULL;
+	debugfs_remove(spi_context.clk_tune.file);
+	spi_context.clk_tune.file = NULL;
+
 	esp_remove_card(spi_context.adapter);
 
 	if (spi_context.adapter->hcidev)
@@ -687,6 +1502,8 @@ int esp_init_interface_layer(struct esp_adapter *adapter)
 	adapter->if_type = ESP_IF_TYPE_SPI;
 	spi_context.adapter = adapter;
 	spi_context.spi_clk_mhz = SPI_INITIAL_CLK_MHZ;
+	spi_context.clk_tune.ceiling = SPI_CLK_NUM_STEPS - 1;
+	spi_context.clk_tune.limit = SPI_CLK_NUM_STEPS - 1;
 
 	return spi_init();
 }
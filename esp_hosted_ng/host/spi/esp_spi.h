@@ -7,6 +7,8 @@
 #ifndef _ESP_SPI_H_
 #define _ESP_SPI_H_
 
+#include <linux/spi/spi.h>
+#include <linux/completion.h>
 #include "esp.h"
 
 #define HANDSHAKE_PIN           22
@@ -15,10 +17,96 @@
 #define SPI_DATA_READY_IRQ      gpio_to_irq(SPI_DATA_READY_PIN)
 #define SPI_BUF_SIZE            1600
 
+/* Rx buffers recycled across transactions. Each has room for skb to be
+ * built around it, once it carries valid data */
+#define SPI_RX_POOL_SIZE        8
+#define SPI_RX_BUF_HEADROOM     NET_SKB_PAD
+#define SPI_RX_BUF_TRUESIZE     (SKB_DATA_ALIGN(SPI_RX_BUF_HEADROOM + SPI_BUF_SIZE) + \
+				 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+struct esp_spi_pool_stats {
+	u64                         hits;       /* Rx buffer taken from pool */
+	u64                         misses;     /* Pool empty, Rx buffer allocated */
+	u64                         alloc_fail;
+	u64                         recycled;   /* Dummy or invalid Rx, buffer back to pool */
+	u64                         skb_built;  /* Valid Rx, buffer handed up as skb */
+};
+
+/* Transactions spi work cycles through: one on the bus, while Rx of
+ * other is processed */
+#define SPI_TRANS_DEPTH         2
+/* Transactions per run, before spi_lock is yielded. Run that reaches it
+ * switches to poll mode, with spi_irq_moderation */
+#define SPI_PIPELINE_MAX_BURST  32
+/* Empty polls, before switching back to interrupt mode */
+#define SPI_POLL_IDLE_LIMIT     8
+/* ESP lowers handshake in its post transaction ISR. Level still high this
+ * long after a transaction ended is not left over from it */
+#define SPI_HANDSHAKE_SETTLE_US 10
+
+struct esp_spi_trans {
+	struct spi_message          msg;
+	/* Linear part and each frag of tx skb, plus zero padding */
+	struct spi_transfer         xfers[MAX_SKB_FRAGS + 2];
+	struct completion           done;
+	struct sk_buff              *tx_skb;
+	u8                          *rx_buf;
+	u16                         len;
+	/* Data ready was high at submit, so ESP had data to send */
+	u8                          rx_expected;
+	ktime_t                     start_time;
+	ktime_t                     end_time;
+	/* Handshake edges counted when it completed */
+	int                         end_edges;
+};
+
+struct esp_spi_trans_stats {
+	u64                         transfers;
+	u64                         pipelined;  /* Submitted before Rx of previous was processed */
+	u64                         busy_us;    /* Submit to completion */
+	u64                         gap_us;     /* Bus idle between back to back transactions */
+	u64                         packets;    /* Tx and Rx, aggregated ones counted each */
+	u64                         hs_settle;  /* Waits for possibly stale handshake level */
+};
+
+struct esp_spi_irq_stats {
+	u64                         handshake_irqs;
+	u64                         data_ready_irqs;
+	u64                         poll_enter;
+	u64                         poll_exit;
+};
+
+/* Clock auto tuning: after every SPI_CLK_TUNE_WINDOW transactions, clock
+ * steps up if errors stayed within SPI_CLK_TUNE_MAX_ERRS, else steps down
+ * and the failing step is not tried again */
+#define SPI_CLK_NUM_STEPS       8
+#define SPI_CLK_TUNE_WINDOW     4096
+#define SPI_CLK_TUNE_MAX_ERRS   4
+
+struct esp_spi_clk_step_stats {
+	u64                         transactions;
+	u64                         errors;     /* Failed or corrupt transfers, Rx checksum failures */
+	u64                         bytes;
+	u64                         busy_us;
+};
+
+struct esp_spi_clk_tune {
+	/* spi_clk_autotune, if ESP checksums frames. Set at bootup */
+	bool                        enabled;
+	uint8_t                     step;       /* Index in spi_clk_steps[] */
+	uint8_t                     ceiling;    /* Highest step, lowered on errors */
+	uint8_t                     limit;      /* Highest step ESP allows, set at bootup */
+	u32                         window_trans;
+	u32                         window_errs;
+	int                         last_csum_errs;
+	struct esp_spi_clk_step_stats steps[SPI_CLK_NUM_STEPS];
+	struct dentry               *file;
+};
+
 struct esp_spi_context {
 	struct esp_adapter          *adapter;
 	struct spi_device           *esp_spi_dev;
-	struct sk_buff_head         tx_q[MAX_PRIORITY_QUEUES];
+	struct esp_tx_queue         tx_q[MAX_PRIORITY_QUEUES];
 	struct sk_buff_head         rx_q[MAX_PRIORITY_QUEUES];
 	struct workqueue_struct     *spi_workqueue;
 	struct work_struct          spi_work;
@@ -27,6 +115,32 @@ struct esp_spi_context {
 	uint8_t                     spi_clk_mhz;
 	uint8_t                     spi_gpio_enabled;
 	uint8_t                     reserved[2];
+	/* Length of ESP's next transaction as announced, 0 if not known */
+	uint16_t                    rx_len_hint;
+	/* PRIO_Q_MID packets sent in a row, see esp_tx_queue_select() */
+	uint8_t                     tx_mid_burst;
+	/* Used under spi_lock */
+	void                        *rx_pool[SPI_RX_POOL_SIZE];
+	uint8_t                     rx_pool_count;
+	/* Zeroes, clocked out when there is nothing to send */
+	u8                          *tx_dummy_buf;
+	struct esp_spi_pool_stats   pool_stats;
+	struct dentry               *pool_stats_file;
+	/* Used under spi_lock */
+	struct esp_spi_trans        trans[SPI_TRANS_DEPTH];
+	struct esp_spi_trans_stats  trans_stats;
+	struct dentry               *trans_stats_file;
+	struct esp_spi_irq_stats    irq_stats;
+	/* Handshake rising edges, counted in hard irq also in poll mode */
+	atomic_t                    hs_edges;
+	/* Used under spi_lock, see spi_handshake_ready() */
+	int                         last_end_edges;
+	ktime_t                     last_end_time;
+	/* Used under spi_lock, see spi_update_irq_mode() */
+	uint8_t                     poll_mode;
+	uint8_t                     idle_polls;
+	/* Used under spi_lock */
+	struct esp_spi_clk_tune     clk_tune;
 };
 
 enum {